@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IAI_KMS_40_DRIVER_CLOCK_ESTIMATOR_HPP_
+#define IAI_KMS_40_DRIVER_CLOCK_ESTIMATOR_HPP_
+
+#include <cstddef>
+#include <vector>
+
+namespace iai_kms_40_driver
+{
+  // Maps the sensor's timestamps onto the host clock. A line host = offset +
+  // rate * sensor is fitted by least squares to the latest (timestamp,
+  // receive time) pairs, which estimates both the offset and the drift of the
+  // sensor clock. Receive times jitter with scheduling and network delays,
+  // the fit averages that out: mapped stamps follow the sensor clock and lag
+  // it by the mean transport delay. Pairs far off the line, i.e. reads which
+  // were held up, are left out of the fit.
+  class ClockEstimator
+  {
+    public:
+      // window: pairs in the fit; outlier_sigmas: residuals beyond this many
+      // standard deviations (at least min_tolerance seconds) are outliers
+      ClockEstimator(size_t window=500, double outlier_sigmas=3.0,
+          double min_tolerance=0.0005);
+
+      void reset();
+
+      // Adds a pair, returns false if it was rejected as an outlier. A
+      // timestamp which goes backwards or a long run of outliers means the
+      // sensor or the host clock jumped, the estimator starts over.
+      bool update(long sensor_time, double host_time);
+
+      // Host time of sensor_time. Until there are enough pairs for a fit
+      // this is the host time of the latest pair.
+      double toHost(long sensor_time) const;
+
+      bool valid() const { return valid_; }
+      // host seconds per sensor tick
+      double rate() const { return rate_; }
+
+      unsigned long outliers() const { return outliers_; }
+      unsigned long resets() const { return resets_; }
+
+    private:
+      struct Pair
+      {
+        double sensor, host;  // relative to the origin
+      };
+
+      std::vector<Pair> pairs_;
+      size_t next_, count_;
+      double outlier_sigmas_, min_tolerance_;
+
+      long origin_sensor_, last_sensor_;
+      double origin_host_, last_host_;
+
+      // fit: host = mean_host_ + rate_ * (sensor - mean_sensor_), relative
+      bool valid_;
+      double mean_sensor_, mean_host_, rate_, tolerance_;
+
+      size_t consecutive_outliers_;
+      unsigned long outliers_, resets_;
+
+      // least squares fit of the pairs within max_residual of the current
+      // fit, of all pairs if max_residual is negative
+      bool fit(double max_residual);
+  };
+}
+
+#endif // IAI_KMS_40_DRIVER_CLOCK_ESTIMATOR_HPP_
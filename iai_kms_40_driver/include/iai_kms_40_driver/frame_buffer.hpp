@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IAI_KMS_40_DRIVER_FRAME_BUFFER_HPP_
+#define IAI_KMS_40_DRIVER_FRAME_BUFFER_HPP_
+
+#include <string>
+#include <vector>
+
+namespace iai_kms_40_driver
+{
+  // Splits a byte stream into delimiter-terminated frames. TCP hands out
+  // the stream in arbitrary pieces, so one read may hold several frames or
+  // only part of one. Append every read, then take frames until there are
+  // none left; an incomplete frame stays buffered for the next read. If a
+  // read does not fit, append the rest after taking the frames.
+  class FrameBuffer
+  {
+    public:
+      FrameBuffer(size_t capacity=4096, char delimiter='\n');
+
+      // Returns how much of data was taken, less than size only if the
+      // buffer is full and holds complete frames. A frame longer than the
+      // capacity is dropped up to the next delimiter and counted as a
+      // resync.
+      size_t append(const char* data, size_t size);
+      size_t append(const std::string& data) { return append(data.data(), data.size()); }
+
+      // Next complete frame without its delimiter and a trailing '\r',
+      // empty lines are skipped. False if no complete frame is buffered.
+      bool nextFrame(std::string& frame);
+
+      // Same as a span, valid until the next call of append() or
+      // nextFrame(). A frame which wraps around the end of the ring is
+      // copied into a preallocated scratch buffer, nothing is allocated.
+      bool nextFrame(const char*& frame, size_t& size);
+
+      void clear();
+      size_t size() const { return size_; }
+
+      unsigned long bytes() const { return bytes_; }
+      unsigned long frames() const { return frames_; }
+      unsigned long resyncs() const { return resyncs_; }
+
+    private:
+      std::vector<char> buffer_, scratch_;
+      char delimiter_;
+      size_t head_, size_;
+      bool discarding_;
+      unsigned long bytes_, frames_, resyncs_;
+
+      // offset of the first delimiter from head_, or size_ if there is none
+      size_t findDelimiter() const;
+  };
+}
+#endif // IAI_KMS_40_DRIVER_FRAME_BUFFER_HPP_
@@ -27,32 +27,156 @@
 #define IAI_KMS_40_DRIVER_KMS_40_DRIVER_HPP_
 
 #include <pthread.h>
+#include <semaphore.h>
+#include <vector>
 
+#include <iai_kms_40_driver/clock_estimator.hpp>
 #include <iai_kms_40_driver/socket_connection.hpp>
+#include <iai_kms_40_driver/frame_buffer.hpp>
+#include <iai_kms_40_driver/seqlock.hpp>
+#include <iai_kms_40_driver/spsc_queue.hpp>
 #include <iai_kms_40_driver/wrench.hpp>
+#include <iai_kms_40_driver/wrench_filter.hpp>
 
 namespace iai_kms_40_driver
 {
+  // Counters of the data stream since start()
+  struct StreamStats
+  {
+    StreamStats() : 
+        bytes(0), frames(0), resyncs(0), overruns(0), clock_outliers(0), clock_resets(0),
+        saturated(0), rate(0.0), max_delay(0.0), connected(false), disconnects(0),
+        downtime(0.0) {}
+    unsigned long bytes;    // received from the sensor
+    unsigned long frames;   // parsed into wrenches
+    unsigned long resyncs;  // times input had to be dropped to find the next frame
+    unsigned long overruns; // samples lost because the consumer fell behind
+    unsigned long clock_outliers; // samples left out of the clock estimate
+    unsigned long clock_resets;   // sensor timestamp jumps
+    unsigned long saturated;      // samples beyond the limits of the filter config
+    // over the last second
+    double rate;            // frames/s
+    double max_delay;       // s, latest a frame arrived behind the sensor clock
+    bool connected;
+    unsigned long disconnects;
+    double downtime;        // s without connection, of the outages which ended
+  };
+
+  // A wrench, when the read which brought it returned and when the sensor
+  // measured it
+  struct WrenchSample
+  {
+    WrenchSample() : receive_time(0.0), stamp(0.0), saturated(false) {}
+    Wrench wrench;          // filtered as configured with setFilter()
+    double receive_time;    // CLOCK_REALTIME, s
+    double stamp;           // wrench.timestamp_ mapped to CLOCK_REALTIME, s
+    bool saturated;         // the raw wrench exceeded a limit
+  };
+
+  // CLOCK_MONOTONIC in s, the time base of the connection supervision
+  double monotonicTime();
+
   class KMS40Driver
   {
     public:
       KMS40Driver();
       ~KMS40Driver();
 
+      // Connects and starts the stream, read by a thread of the driver.
       bool start(const std::string& ip, const std::string port,
           const timeval& read_timeout, unsigned int frame_divider);
 
+      // Same without a thread: someone else calls readAvailable() whenever
+      // fd() is readable and supervises the connection, see KMS40Reader.
+      // Stop that first, then stop().
+      bool connect(const std::string& ip, const std::string port,
+          const timeval& read_timeout, unsigned int frame_divider);
+      // False if the connection is gone
+      bool readAvailable();
+      int fd() const { return socket_conn_.fd(); }
+
+      // Connection supervision, the thread of start() does it by itself.
+      // A connection is lost when a read fails or stalled() says the
+      // stream went quiet. connectionLost() closes it, then reconnect()
+      // is tried from retryTime() on, with exponential backoff. It opens
+      // the connection again and restarts the stream with the settings of
+      // connect().
+      bool connected();
+      bool stalled();
+      void connectionLost();
+      double retryTime() const { return retry_at_; }   // CLOCK_MONOTONIC, s
+      bool reconnect();
+
       void stop();
 
       Wrench currentWrench();
+      WrenchSample currentSample();
+      StreamStats streamStats();
+
+      // Keep every sample for popWrenches(), up to capacity of them; 0, the
+      // default, keeps only the latest for currentWrench(). Call before start().
+      void setQueueCapacity(size_t capacity);
+
+      // Moves up to max_samples of the oldest queued samples into samples,
+      // each sample is handed out exactly once. Waits up to timeout seconds
+      // if the queue is empty, not at all if timeout is 0. Returns the
+      // number of samples. Only one thread may pop at a time.
+      size_t popWrenches(std::vector<WrenchSample>& samples, size_t max_samples,
+          double timeout);
+
+      // Posts sem instead of the driver's own semaphore after new samples,
+      // so one consumer can wait for several drivers and then pop them with
+      // a timeout of 0. Call before start().
+      void setQueueSemaphore(sem_t* sem);
+
+      // Pipeline the reader thread runs every wrench through, no filtering
+      // by default. Call before start(), which fails if the config is invalid.
+      void setFilter(const WrenchFilterConfig& config);
+
+      // Starts averaging the next 'samples' raw wrenches into a new bias,
+      // returns at once. tares() counts the completed ones, bias() returns
+      // the latest.
+      void requestTare(size_t samples);
+      unsigned long tares();
+      Wrench bias();
 
     private:
       SocketConnection socket_conn_;
-      Wrench wrench_, wrench_buffer_;
+      FrameBuffer frame_buffer_;
+      const char* unread_;    // rest of the last socket read which did not fit
+      size_t unread_size_;
+      Wrench wrench_;
+      WrenchSample sample_;
+      StreamStats stats_;
+      ClockEstimator clock_;
+      WrenchFilterConfig filter_config_;
+      WrenchFilter filter_;
+
+      // handed from the reader thread to the consumers, the reader never
+      // waits for them
+      SeqLock<WrenchSample> latest_sample_;
+      SeqLock<StreamStats> latest_stats_;
+      SpscQueue<WrenchSample> queue_;
+      size_t queue_capacity_;
+      sem_t own_sem_;
+      sem_t* queue_sem_;      // posted after samples were pushed
+      SeqLock<Wrench> latest_bias_;
+      size_t tare_request_;   // samples of a requested tare, 0 if none
+      unsigned long tares_;
+
+      // statistics window
+      double window_start_, window_delay_;
+      unsigned long window_frames_;
+
+      // connection, kept for reconnects
+      std::string ip_, port_;
+      timeval read_timeout_;
+      unsigned int frame_divider_;
+      bool connected_;
+      double last_data_, down_since_, retry_at_, backoff_, stall_timeout_;   // CLOCK_MONOTONIC, s
 
       pthread_t thread_; 
-      pthread_mutex_t mutex_; 
-      bool exit_requested_, running_;
+      bool exit_requested_, running_, threaded_;
 
       // actual function run be our thread
       void* run();
@@ -64,8 +188,12 @@ namespace iai_kms_40_driver
       bool configureStream(unsigned int frame_divider);
       bool requestStreamStart();
       bool requestStreamStop();
-      void blockingReadWrench();
+      bool openStream();
+      bool fillFrameBuffer(bool& new_data);
+      bool blockingReadWrenches();
       void copyWrenchIntoBuffer();
+      void publishStats();
+      bool blockingReadFrame(std::string& frame);
       bool kmsServiceRequest(const std::string& request, const std::string& response);
   };
 }
@@ -26,12 +26,56 @@
 #ifndef IAI_KMS_40_DRIVER_KMS_40_DRIVER_NODE_HPP_
 #define IAI_KMS_40_DRIVER_KMS_40_DRIVER_NODE_HPP_
 
+#include <semaphore.h>
+#include <boost/shared_ptr.hpp>
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <geometry_msgs/WrenchStamped.h>
+#include <std_srvs/Trigger.h>
+#include <iai_kms_40_driver/WrenchArray.h>
 #include <iai_kms_40_driver/kms_40_driver.hpp>
+#include <iai_kms_40_driver/kms_40_reader.hpp>
 
 namespace iai_kms_40_driver
 {
+  // One sensor of the node: its driver, its topic and its tare service,
+  // configured by the parameters in the namespace of nh.
+  class KMS40Sensor
+  {
+    public:
+      KMS40Sensor(const ros::NodeHandle& nh);
+
+      // Connects the driver; the node reads the stream.
+      bool startUp(const std::string& publish_mode, int batch_size, sem_t* samples_sem,
+          ros::CallbackQueue* service_queue);
+      void shutDown();
+
+      KMS40Driver& driver() { return driver_; }
+
+      void publishLatest();
+      void publishEvents();
+      void publishBatches(size_t batch_size);
+
+    private:
+      ros::NodeHandle nh_;
+      KMS40Driver driver_;
+      ros::Publisher pub_;
+      geometry_msgs::WrenchStamped msg_;
+      iai_kms_40_driver::WrenchArray batch_msg_;
+      std::vector<WrenchSample> samples_;
+      double sample_rate_;
+
+      ros::ServiceServer tare_srv_;
+      int tare_samples_;
+
+      bool readFilterConfig(WrenchFilterConfig& config);
+      void warnSaturation(const WrenchSample& sample);
+      bool tare(std_srvs::Trigger::Request& request, std_srvs::Trigger::Response& response);
+  };
+
+  // Publishes one sensor configured by the private parameters, or several
+  // listed in the parameter 'sensors', each configured in ~<name>/. One
+  // realtime thread reads all of them.
   class KMS40DriverNode
   {
     public:
@@ -43,12 +87,22 @@ namespace iai_kms_40_driver
   
     private:
       ros::NodeHandle nh_;
-      ros::Publisher pub_;
-      geometry_msgs::WrenchStamped msg_;
-      KMS40Driver driver_;
+      std::vector< boost::shared_ptr<KMS40Sensor> > sensors_;
+      KMS40Reader reader_;
+      sem_t samples_sem_;     // posted by every driver after new samples
+      std::string publish_mode_;
+      int batch_size_;
+
+      // the tare services wait for their samples, they get their own thread
+      ros::CallbackQueue service_queue_;
+      ros::AsyncSpinner service_spinner_;
   
       bool startUp();
+      void shutDown();
       void loop();
+      void publishEvents();
+      void publishBatches();
+      void waitForSamples(double timeout);
   };
 } // namespace iai_kms_40_driver
 #endif // IAI_KMS_40_DRIVER_KMS_40_DRIVER_NODE_HPP_
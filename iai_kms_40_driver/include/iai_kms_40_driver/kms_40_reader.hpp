@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IAI_KMS_40_DRIVER_KMS_40_READER_HPP_
+#define IAI_KMS_40_DRIVER_KMS_40_READER_HPP_
+
+#include <pthread.h>
+#include <vector>
+
+#include <iai_kms_40_driver/kms_40_driver.hpp>
+
+namespace iai_kms_40_driver
+{
+  // One realtime thread which reads the streams of several connected
+  // drivers, see KMS40Driver::connect(). It sleeps in epoll until any of
+  // the sockets is readable and lets that driver parse what arrived, each
+  // driver keeps its own samples and statistics. A connection which fails
+  // or stalls leaves the epoll set; a second, ordinary thread reconnects
+  // it and puts it back, so the reader never waits for a connect.
+  class KMS40Reader
+  {
+    public:
+      KMS40Reader();
+      ~KMS40Reader();
+
+      // The drivers must stay connected until stop().
+      bool start(const std::vector<KMS40Driver*>& drivers);
+      void stop();
+
+    private:
+      std::vector<KMS40Driver*> drivers_;
+      int epoll_fd_;
+      pthread_t thread_, supervisor_;
+      bool exit_requested_, running_;
+
+      bool watch(size_t index);
+      void drop(size_t index);
+
+      void* run();
+      static void* run_s(void *ptr) { return ((KMS40Reader *) ptr)->run(); }
+      void* supervise();
+      static void* supervise_s(void *ptr) { return ((KMS40Reader *) ptr)->supervise(); }
+  };
+}
+#endif // IAI_KMS_40_DRIVER_KMS_40_READER_HPP_
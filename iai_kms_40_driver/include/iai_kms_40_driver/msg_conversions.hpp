@@ -33,5 +33,8 @@ namespace iai_kms_40_driver
 {
   geometry_msgs::WrenchStamped& populateMsg(const Wrench& wrench, 
       geometry_msgs::WrenchStamped& msg);
+
+  geometry_msgs::Wrench& populateMsg(const Wrench& wrench, 
+      geometry_msgs::Wrench& msg);
 } // namespace iai_kms_40_driver
 #endif // IAI_KMS_40_DRIVER_MSG_CONVERSIONS_HPP_
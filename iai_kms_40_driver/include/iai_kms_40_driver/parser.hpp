@@ -26,46 +26,167 @@
 #ifndef IAI_KMS_40_DRIVER_PARSER_H_
 #define IAI_KMS_40_DRIVER_PARSER_H_
 
-#include <boost/spirit/include/qi.hpp>
-#include <boost/spirit/include/phoenix_core.hpp>
-#include <boost/spirit/include/phoenix_operator.hpp>
-
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <iai_kms_40_driver/wrench.hpp>
 
 namespace iai_kms_40_driver
 {
+  namespace detail
+  {
+    inline const char* skip_space(const char* p, const char* last)
+    {
+      while (p != last && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        ++p;
+      return p;
+    }
+
+    inline bool parse_literal(const char*& p, const char* last, const char* literal)
+    {
+      p = skip_space(p, last);
+      for (; *literal; ++literal, ++p)
+        if (p == last || *p != *literal)
+          return false;
+      return true;
+    }
+
+    // Decimal digits are collected into an integer mantissa. If there are at
+    // most 19 of them, the mantissa fits into 53 bits and the power of ten is
+    // at most 22, both are exact doubles and one multiplication or division
+    // rounds correctly; anything else goes through strtod() on a copy on the
+    // stack.
+    inline bool parse_double(const char*& p, const char* last, double& value)
+    {
+      static const double powers[] = {
+          1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+          1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+      const char* start = p = skip_space(p, last);
+      bool negative = false;
+      uint64_t mantissa = 0;
+      int digits, scale = 0;
+
+      if (p != last && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+
+      const char* integer = p;
+      for (; p != last && (unsigned) (*p - '0') < 10; ++p)
+        mantissa = mantissa * 10 + (*p - '0');
+      digits = p - integer;
+
+      if (p != last && *p == '.')
+      {
+        const char* fraction = ++p;
+        for (; p != last && (unsigned) (*p - '0') < 10; ++p)
+          mantissa = mantissa * 10 + (*p - '0');
+        scale = fraction - p;
+        digits -= scale;
+      }
+
+      if (digits == 0)
+        return false;
+
+      if (p != last && (*p == 'e' || *p == 'E'))
+      {
+        bool negative_exponent = false;
+        int exponent = 0;
+        ++p;
+        if (p != last && (*p == '-' || *p == '+'))
+          negative_exponent = (*p++ == '-');
+        const char* exponent_digits = p;
+        for (; p != last && (unsigned) (*p - '0') < 10; ++p)
+          if (exponent < 10000)
+            exponent = exponent * 10 + (*p - '0');
+        if (p == exponent_digits)
+          return false;
+        scale += negative_exponent ? -exponent : exponent;
+      }
+
+      if (digits <= 19 && mantissa <= (uint64_t(1) << 53) && scale >= -22 && scale <= 22)
+      {
+        value = (double) mantissa;
+        value = (scale < 0) ? value / powers[-scale] : value * powers[scale];
+        if (negative)
+          value = -value;
+        return true;
+      }
+
+      char copy[64];
+      if ((size_t) (p - start) >= sizeof(copy))
+        return false;
+      memcpy(copy, start, p - start);
+      copy[p - start] = '\0';
+      value = strtod(copy, 0);
+      return true;
+    }
+
+    inline bool parse_long(const char*& p, const char* last, long& value)
+    {
+      p = skip_space(p, last);
+      bool negative = false;
+      unsigned long result = 0;
+      const char* digits = 0;
+
+      if (p != last && (*p == '-' || *p == '+'))
+        negative = (*p++ == '-');
+
+      for (digits = p; p != last && *p >= '0' && *p <= '9'; ++p)
+      {
+        if (result > (ULONG_MAX - 9) / 10)
+          return false;
+        result = result * 10 + (*p - '0');
+      }
+
+      if (p == digits || result > (unsigned long) LONG_MAX + negative)
+        return false;
+
+      value = negative ? (long) (0 - result) : (long) result;
+      return true;
+    }
+  }
+
+  // Parses one frame 'F={fx,fy,fz,tx,ty,tz},timestamp' in [first, last)
+  // without allocating. Blanks are allowed between the tokens, nothing but
+  // blanks after the timestamp. The wrench is only changed on success.
+  inline bool parse_wrench(const char* first, const char* last, Wrench& wrench)
+  {
+    double values[6];
+    long timestamp;
+    const char* p = first;
+
+    if (!detail::parse_literal(p, last, "F={"))
+      return false;
+
+    for (int i=0; i < 6; ++i)
+    {
+      if (!detail::parse_double(p, last, values[i]))
+        return false;
+      if (!detail::parse_literal(p, last, (i < 5) ? "," : "},"))
+        return false;
+    }
+
+    if (!detail::parse_long(p, last, timestamp))
+      return false;
+
+    if (detail::skip_space(p, last) != last)
+      return false;
+
+    wrench.fx_ = values[0];
+    wrench.fy_ = values[1];
+    wrench.fz_ = values[2];
+    wrench.tx_ = values[3];
+    wrench.ty_ = values[4];
+    wrench.tz_ = values[5];
+    wrench.timestamp_ = timestamp;
+    return true;
+  }
+
   inline bool parse_wrench(const std::string& msg, Wrench& wrench)
   {
-    using boost::spirit::qi::double_;
-    using boost::spirit::qi::long_;
-    using boost::spirit::qi::_1;
-    using boost::spirit::qi::phrase_parse;
-    using boost::spirit::ascii::space;
-    using boost::phoenix::ref;
-
-    std::string::const_iterator first = msg.begin();
-    std::string::const_iterator last = msg.end();
-
-    bool r = phrase_parse(first, last, 
-
-        //  Begin grammar
-        (
-                "F={" >> double_[ref(wrench.fx_) = _1] >> ','
-                      >> double_[ref(wrench.fy_) = _1] >> ','
-                      >> double_[ref(wrench.fz_) = _1] >> ','
-                      >> double_[ref(wrench.tx_) = _1] >> ','
-                      >> double_[ref(wrench.ty_) = _1] >> ','
-                      >> double_[ref(wrench.tz_) = _1] >> "},"
-                      >> long_[ref(wrench.timestamp_) = _1]
-
-        ),
-        //  End grammar
-
-        space);
-
-    // fail if we did not even get a partial match
-    return r;
+    return parse_wrench(msg.data(), msg.data() + msg.size(), wrench);
   }
 }
 #endif // IAI_KMS_40_DRIVER_PARSER_H_
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IAI_KMS_40_DRIVER_SEQLOCK_HPP_
+#define IAI_KMS_40_DRIVER_SEQLOCK_HPP_
+
+namespace iai_kms_40_driver
+{
+  // Latest value of a single writer for any number of readers. Neither side
+  // blocks: the writer bumps the sequence around its update, a reader copies
+  // the value and retries if the sequence was odd or changed meanwhile.
+  // T must be copyable member by member, without pointers into itself.
+  template <class T>
+  class SeqLock
+  {
+    public:
+      SeqLock() : seq_( 0 ) {}
+
+      void write(const T& value)
+      {
+        __atomic_store_n(&seq_, seq_ + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        value_ = value;
+        __atomic_store_n(&seq_, seq_ + 1, __ATOMIC_RELEASE);
+      }
+
+      T read() const
+      {
+        T value;
+        unsigned int start;
+        do
+        {
+          start = __atomic_load_n(&seq_, __ATOMIC_ACQUIRE);
+          value = value_;
+          __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while ( (start & 1) || __atomic_load_n(&seq_, __ATOMIC_RELAXED) != start );
+
+        return value;
+      }
+
+    private:
+      unsigned int seq_;  // odd while a write is in progress
+      T value_;
+  };
+}
+
+#endif // IAI_KMS_40_DRIVER_SEQLOCK_HPP_
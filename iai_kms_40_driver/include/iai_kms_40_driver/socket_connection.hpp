@@ -28,6 +28,7 @@
 
 #include <netdb.h>
 #include <string>
+#include <vector>
 
 namespace iai_kms_40_driver
 {
@@ -38,21 +39,40 @@ namespace iai_kms_40_driver
       SocketConnection();
       ~SocketConnection();
 
+      // Connects, giving up after the read timeout, and sets the socket
+      // options once: the read timeout, TCP_NODELAY, TCP_QUICKACK and a
+      // receive buffer for ~1 s of stream.
       bool open(const std::string& ip, const std::string port, 
           const timeval& read_timeout);
       
       void shutdown();
 
       bool ready() const;
+      int fd() const { return socket_fd_; }
 
       bool sendMessage(const std::string& msg);
+
+      // Waits up to the read timeout for data. On success data points into
+      // a receive buffer of the connection, valid until the next read; size
+      // is 0 if nothing arrived in time. False if the connection is gone.
+      bool read(const char*& data, size_t& size);
+
+      // Same as a copy, empty on timeout or error
       std::string readChunk();
 
+      // system calls for reads, writes and options since construction
+      unsigned long syscalls() const { return syscalls_; }
+
     private:
       int socket_fd_;
       timeval read_timeout_;
+      std::vector<char> buffer_;
+      unsigned long syscalls_;
+
+      static const size_t buffer_size_ = 4096;
 
-      static const size_t buffer_size_ = 1024;
+      bool connectWithTimeout(const struct sockaddr* addr, socklen_t addr_len);
+      static const int kernel_buffer_size_ = 65536;
   };
 }
 #endif // IAI_KMS_40_DRIVER_SOCKET_CONNECTION_HPP_
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IAI_KMS_40_DRIVER_SPSC_QUEUE_HPP_
+#define IAI_KMS_40_DRIVER_SPSC_QUEUE_HPP_
+
+#include <cstddef>
+#include <vector>
+
+namespace iai_kms_40_driver
+{
+  // Bounded queue for exactly one producer and one consumer thread. Both
+  // sides are wait-free: push() fails instead of waiting for room, pop()
+  // fails instead of waiting for data.
+  template <class T>
+  class SpscQueue
+  {
+    public:
+      explicit SpscQueue(size_t capacity = 0) : 
+          slots_( capacity ), head_( 0 ), tail_( 0 )
+      {}
+
+      // Not thread-safe, only call while neither side uses the queue.
+      void reset(size_t capacity)
+      {
+        slots_.assign(capacity, T());
+        head_ = tail_ = 0;
+      }
+
+      size_t capacity() const
+      {
+        return slots_.size();
+      }
+
+      // Producer side. Returns false if the queue is full.
+      bool push(const T& value)
+      {
+        size_t tail = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+        if ( tail - __atomic_load_n(&head_, __ATOMIC_ACQUIRE) >= slots_.size() )
+          return false;
+
+        slots_[tail % slots_.size()] = value;
+        __atomic_store_n(&tail_, tail + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+
+      // Consumer side. Returns false if the queue is empty.
+      bool pop(T& value)
+      {
+        size_t head = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+        if ( head == __atomic_load_n(&tail_, __ATOMIC_ACQUIRE) )
+          return false;
+
+        value = slots_[head % slots_.size()];
+        __atomic_store_n(&head_, head + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+
+    private:
+      std::vector<T> slots_;
+      // the two counters live on separate cache lines, each side writes one
+      char pad0_[64];
+      size_t head_;   // next slot to pop, written by the consumer
+      char pad1_[64];
+      size_t tail_;   // next slot to push, written by the producer
+  };
+}
+
+#endif // IAI_KMS_40_DRIVER_SPSC_QUEUE_HPP_
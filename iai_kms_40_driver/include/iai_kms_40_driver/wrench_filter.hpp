@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef IAI_KMS_40_DRIVER_WRENCH_FILTER_HPP_
+#define IAI_KMS_40_DRIVER_WRENCH_FILTER_HPP_
+
+#include <cstddef>
+#include <vector>
+
+#include <iai_kms_40_driver/wrench.hpp>
+
+namespace iai_kms_40_driver
+{
+  struct WrenchFilterConfig
+  {
+    enum Type { NONE, BIQUAD, MOVING_AVERAGE };
+
+    WrenchFilterConfig() : 
+        type(NONE), cutoff(10.0), window(10), force_limit(0.0), torque_limit(0.0) {}
+
+    Type type;
+    double cutoff;          // Hz, Butterworth low-pass for BIQUAD
+    size_t window;          // samples averaged for MOVING_AVERAGE
+    double force_limit;     // N, larger raw forces are saturated, 0 to ignore
+    double torque_limit;    // Nm, same for torques
+  };
+
+  // Per sample processing of the raw wrenches: saturation check, bias
+  // subtraction and low-pass, in that order. All six channels are kept
+  // side by side and run through the same operations, the loops over them
+  // vectorize. Not thread-safe, the driver runs it in its reader thread.
+  class WrenchFilter
+  {
+    public:
+      static const size_t CHANNELS = 6;
+
+      WrenchFilter();
+
+      // Resets filter state and bias; sample_rate in Hz.
+      bool configure(const WrenchFilterConfig& config, double sample_rate);
+      void reset();
+
+      // Filters wrench in place. Returns true if the raw wrench exceeded
+      // a limit of the configuration.
+      bool process(Wrench& wrench);
+
+      // Averages the next 'samples' raw wrenches into a new bias. Filtering
+      // goes on with the old bias until the average is complete.
+      void startTare(size_t samples);
+      bool taring() const { return tare_remaining_ > 0; }
+      Wrench bias() const;
+
+    private:
+      WrenchFilterConfig config_;
+
+      double bias_[CHANNELS];
+      double tare_sum_[CHANNELS];
+      size_t tare_samples_, tare_remaining_;
+
+      // biquad, transposed direct form II
+      double b0_, b1_, b2_, a1_, a2_;
+      double z1_[CHANNELS], z2_[CHANNELS];
+
+      // moving average over a ring of window x CHANNELS samples
+      std::vector<double> ring_;
+      double sum_[CHANNELS];
+      size_t ring_index_, ring_fill_;
+  };
+}
+
+#endif // IAI_KMS_40_DRIVER_WRENCH_FILTER_HPP_
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iai_kms_40_driver/clock_estimator.hpp>
+#include <algorithm>
+#include <math.h>
+
+// pairs before the first fit is used
+#define MIN_FIT_PAIRS 20
+
+namespace iai_kms_40_driver
+{
+  ClockEstimator::ClockEstimator(size_t window, double outlier_sigmas, double min_tolerance) :
+      pairs_( std::max(window, (size_t) MIN_FIT_PAIRS) ), outlier_sigmas_( outlier_sigmas ),
+      min_tolerance_( min_tolerance ), outliers_( 0 ), resets_( 0 )
+  {
+    reset();
+  }
+
+  void ClockEstimator::reset()
+  {
+    next_ = count_ = 0;
+    origin_sensor_ = last_sensor_ = 0;
+    origin_host_ = last_host_ = 0.0;
+    valid_ = false;
+    mean_sensor_ = mean_host_ = rate_ = tolerance_ = 0.0;
+    consecutive_outliers_ = 0;
+  }
+
+  bool ClockEstimator::update(long sensor_time, double host_time)
+  {
+    if ( count_ > 0 && (sensor_time < last_sensor_ ||
+         consecutive_outliers_ >= pairs_.size() / 4) )
+    {
+      reset();
+      resets_++;
+    }
+
+    if ( count_ == 0 )
+    {
+      origin_sensor_ = sensor_time;
+      origin_host_ = host_time;
+    }
+
+    last_sensor_ = sensor_time;
+    last_host_ = host_time;
+
+    Pair pair;
+    pair.sensor = sensor_time - origin_sensor_;
+    pair.host = host_time - origin_host_;
+
+    if ( valid_ &&
+         fabs(pair.host - mean_host_ - rate_ * (pair.sensor - mean_sensor_)) > tolerance_ )
+    {
+      consecutive_outliers_++;
+      outliers_++;
+      return false;
+    }
+    consecutive_outliers_ = 0;
+
+    pairs_[next_] = pair;
+    next_ = (next_ + 1) % pairs_.size();
+    count_ = std::min(count_ + 1, pairs_.size());
+
+    // refit without the outliers of a first fit over the whole window
+    if ( count_ >= MIN_FIT_PAIRS && fit(-1.0) )
+      valid_ = fit(tolerance_);
+
+    return true;
+  }
+
+  double ClockEstimator::toHost(long sensor_time) const
+  {
+    if ( !valid_ )
+      return last_host_;
+
+    double sensor = sensor_time - origin_sensor_;
+    return origin_host_ + mean_host_ + rate_ * (sensor - mean_sensor_);
+  }
+
+  bool ClockEstimator::fit(double max_residual)
+  {
+    double sum_sensor = 0.0, sum_host = 0.0;
+    size_t n = 0;
+    for (size_t i=0; i < count_; ++i)
+      if ( max_residual < 0 || fabs(pairs_[i].host - mean_host_ -
+           rate_ * (pairs_[i].sensor - mean_sensor_)) <= max_residual )
+      {
+        sum_sensor += pairs_[i].sensor;
+        sum_host += pairs_[i].host;
+        n++;
+      }
+
+    if ( n < 2 )
+      return false;
+
+    // centered sums, the origin may be far away after a while
+    double mean_sensor = sum_sensor / n, mean_host = sum_host / n;
+    double sxx = 0.0, sxy = 0.0, syy = 0.0;
+    for (size_t i=0; i < count_; ++i)
+      if ( max_residual < 0 || fabs(pairs_[i].host - mean_host_ -
+           rate_ * (pairs_[i].sensor - mean_sensor_)) <= max_residual )
+      {
+        double dx = pairs_[i].sensor - mean_sensor;
+        double dy = pairs_[i].host - mean_host;
+        sxx += dx * dx;
+        sxy += dx * dy;
+        syy += dy * dy;
+      }
+
+    // a sensor which does not count can not be mapped
+    if ( !(sxx > 0.0) )
+      return false;
+
+    mean_sensor_ = mean_sensor;
+    mean_host_ = mean_host;
+    rate_ = sxy / sxx;
+
+    double sigma = sqrt(std::max(0.0, syy - rate_ * sxy) / n);
+    tolerance_ = std::max(outlier_sigmas_ * sigma, min_tolerance_);
+
+    return true;
+  }
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iai_kms_40_driver/frame_buffer.hpp>
+#include <algorithm>
+#include <string.h>
+
+namespace iai_kms_40_driver
+{
+  FrameBuffer::FrameBuffer(size_t capacity, char delimiter) :
+      buffer_( capacity ), scratch_( capacity ), delimiter_( delimiter ), head_( 0 ), size_( 0 ),
+      discarding_( false ), bytes_( 0 ), frames_( 0 ), resyncs_( 0 )
+  {
+  }
+
+  size_t FrameBuffer::append(const char* data, size_t size)
+  {
+    const char* first = data;
+
+    while (size > 0)
+    {
+      // rest of a frame which did not fit, drop it
+      if (discarding_)
+      {
+        const char* end = (const char*) memchr(data, delimiter_, size);
+        if (!end)
+        {
+          data += size;
+          break;
+        }
+        size -= end + 1 - data;
+        data = end + 1;
+        discarding_ = false;
+        continue;
+      }
+
+      if (size_ == buffer_.size())
+      {
+        // the complete frames have to be taken first
+        if (findDelimiter() < size_)
+          break;
+
+        // full without a delimiter: no frame can be that long
+        head_ = size_ = 0;
+        discarding_ = true;
+        resyncs_++;
+        continue;
+      }
+
+      // copy as much as fits, wrapping around at the end
+      size_t tail = (head_ + size_) % buffer_.size();
+      size_t chunk = std::min(size, buffer_.size() - size_);
+      chunk = std::min(chunk, buffer_.size() - tail);
+      memcpy(&buffer_[tail], data, chunk);
+      size_ += chunk;
+      data += chunk;
+      size -= chunk;
+    }
+
+    bytes_ += data - first;
+    return data - first;
+  }
+
+  bool FrameBuffer::nextFrame(std::string& frame)
+  {
+    const char* data;
+    size_t size;
+
+    if (!nextFrame(data, size))
+      return false;
+
+    frame.assign(data, size);
+    return true;
+  }
+
+  bool FrameBuffer::nextFrame(const char*& frame, size_t& size)
+  {
+    for (size_t end = findDelimiter(); end < size_; end = findDelimiter())
+    {
+      size_t first = std::min(end, buffer_.size() - head_);
+      if (first == end)
+        frame = &buffer_[head_];
+      else
+      {
+        memcpy(&scratch_[0], &buffer_[head_], first);
+        memcpy(&scratch_[first], &buffer_[0], end - first);
+        frame = &scratch_[0];
+      }
+      size = end;
+
+      head_ = (head_ + end + 1) % buffer_.size();
+      size_ -= end + 1;
+
+      if (size > 0 && frame[size - 1] == '\r')
+        size--;
+
+      if (size > 0)
+      {
+        frames_++;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void FrameBuffer::clear()
+  {
+    head_ = size_ = 0;
+    discarding_ = false;
+  }
+
+  size_t FrameBuffer::findDelimiter() const
+  {
+    size_t first = std::min(size_, buffer_.size() - head_);
+
+    const char* end = (const char*) memchr(&buffer_[head_], delimiter_, first);
+    if (end)
+      return end - &buffer_[head_];
+
+    end = (const char*) memchr(&buffer_[0], delimiter_, size_ - first);
+    if (end)
+      return first + (end - &buffer_[0]);
+
+    return size_;
+  }
+}
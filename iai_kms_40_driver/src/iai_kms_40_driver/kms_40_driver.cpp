@@ -25,31 +25,125 @@
 
 #include <iai_kms_40_driver/kms_40_driver.hpp>
 #include <iai_kms_40_driver/parser.hpp>
-#include <iai_kms_40_driver/pthread_scoped_lock.hpp>
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <time.h>
+#include <unistd.h>
+
+// frames per second the sensor sends with a frame divider of 1
+#define KMS40_FRAME_RATE 500.0
+
+// bytes the framer holds: a whole socket read plus the incomplete frame
+// in front of it, with room to spare
+#define FRAME_BUFFER_SIZE 16384
+
+// s between reconnect attempts, doubling from the first to the last
+#define MIN_BACKOFF 0.25
+#define MAX_BACKOFF 8.0
+
+// frame periods, but at least a second, without data until the connection
+// counts as lost
+#define STALL_FRAMES 25
+
+// lines a service request reads while looking for its response,
+// the stream may still be running when it is sent
+#define MAX_SERVICE_FRAMES 1000
 
 namespace iai_kms_40_driver
 {
-  KMS40Driver::KMS40Driver() : exit_requested_( false ), running_( false )
+  double monotonicTime()
   {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+  }
+
+  KMS40Driver::KMS40Driver() : 
+      frame_buffer_( FRAME_BUFFER_SIZE ), unread_( 0 ), unread_size_( 0 ),
+      queue_capacity_( 0 ), queue_sem_( &own_sem_ ), tare_request_( 0 ), tares_( 0 ),
+      read_timeout_( ), frame_divider_( 1 ), connected_( false ), last_data_( 0.0 ),
+      down_since_( 0.0 ), retry_at_( 0.0 ), backoff_( MIN_BACKOFF ), stall_timeout_( 1.0 ),
+      exit_requested_( false ), running_( false ), threaded_( false )
+  {
+    sem_init(&own_sem_, 0, 0);
   }
 
   KMS40Driver::~KMS40Driver()
   {
     stop();
+    sem_destroy(&own_sem_);
   }
 
   bool KMS40Driver::start(const std::string& ip, const std::string port,
       const timeval& read_timeout, unsigned int frame_divider)
   {
-    if ( !socket_conn_.open(ip, port, read_timeout) )
+    if ( !connect(ip, port, read_timeout, frame_divider) )
+      return false;
+
+    exit_requested_ = false;
+    if ( !spinRealtimeThread() )
+    {
+      std::cout << "Error when spinning realtime thread.\n";
+      stop();
+      return false;
+    }
+
+    threaded_ = true;
+    return true;
+  }
+
+  bool KMS40Driver::connect(const std::string& ip, const std::string port,
+      const timeval& read_timeout, unsigned int frame_divider)
+  {
+    ip_ = ip;
+    port_ = port;
+    read_timeout_ = read_timeout;
+    frame_divider_ = frame_divider;
+
+    stats_ = StreamStats();
+    sample_ = WrenchSample();
+    clock_.reset();
+    latest_stats_.write(stats_);
+    queue_.reset(queue_capacity_);
+    tare_request_ = 0;
+    window_start_ = window_delay_ = 0.0;
+    window_frames_ = 0;
+
+    if ( frame_divider < 1 ||
+         !filter_.configure(filter_config_, KMS40_FRAME_RATE / frame_divider) )
+    {
+      std::cout << "Invalid filter configuration for the frame rate.\n";
+      return false;
+    }
+    latest_bias_.write(filter_.bias());
+
+    stall_timeout_ = std::max(1.0, STALL_FRAMES * frame_divider / KMS40_FRAME_RATE);
+    backoff_ = MIN_BACKOFF;
+
+    if ( !openStream() )
+      return false;
+
+    last_data_ = monotonicTime();
+    stats_.connected = connected_ = true;
+    publishStats();
+
+    running_ = true;
+    return true;
+  }
+
+  bool KMS40Driver::openStream()
+  {
+    frame_buffer_.clear();
+    unread_size_ = 0;
+
+    if ( !socket_conn_.open(ip_, port_, read_timeout_) )
     {
       std::cout << "Errr during opening of socket.\n";
       return false;
     }
 
-    if ( !configureStream(frame_divider) )
+    if ( !configureStream(frame_divider_) )
     {
       std::cout << "Error during configuring of stream.\n";
       socket_conn_.shutdown();
@@ -63,16 +157,55 @@ namespace iai_kms_40_driver
       return false;
     } 
 
-    if ( !spinRealtimeThread() )
+    return true;
+  }
+
+  bool KMS40Driver::connected()
+  {
+    return __atomic_load_n(&connected_, __ATOMIC_ACQUIRE);
+  }
+
+  bool KMS40Driver::stalled()
+  {
+    return monotonicTime() - last_data_ > stall_timeout_;
+  }
+
+  void KMS40Driver::connectionLost()
+  {
+    socket_conn_.shutdown();
+
+    down_since_ = monotonicTime();
+    backoff_ = MIN_BACKOFF;
+    retry_at_ = down_since_ + backoff_;
+
+    std::cout << "Lost the connection to the KMS40 at " << ip_ << ":" << port_ 
+        << ", reconnecting.\n";
+
+    stats_.connected = false;
+    stats_.disconnects++;
+    publishStats();
+    __atomic_store_n(&connected_, false, __ATOMIC_RELEASE);
+  }
+
+  bool KMS40Driver::reconnect()
+  {
+    if ( !openStream() )
     {
-      std::cout << "Error when spinning realtime thread.\n";
-      requestStreamStop();
-      socket_conn_.shutdown();
+      backoff_ = std::min(2 * backoff_, MAX_BACKOFF);
+      retry_at_ = monotonicTime() + backoff_;
       return false;
     }
- 
-    exit_requested_ = false;
-    running_ = true;
+
+    last_data_ = monotonicTime();
+    double downtime = last_data_ - down_since_;
+    std::cout << "Reconnected to the KMS40 at " << ip_ << ":" << port_ << " after "
+        << downtime << " s.\n";
+
+    stats_.connected = true;
+    stats_.downtime += downtime;
+    publishStats();
+    __atomic_store_n(&connected_, true, __ATOMIC_RELEASE);
+
     return true;
   }
 
@@ -80,40 +213,100 @@ namespace iai_kms_40_driver
   {
     if(running_)
     {
-      pthread_mutex_lock(&mutex_);
-      exit_requested_ = true;
-      pthread_mutex_unlock(&mutex_);
-  
-      if ( !requestStreamStop() )
+      // the thread leaves after its current read, then the socket is ours
+      if ( threaded_ )
+      {
+        __atomic_store_n(&exit_requested_, true, __ATOMIC_RELAXED);
+        pthread_join(thread_, 0);
+        threaded_ = false;
+      }
+
+      if ( connected() && !requestStreamStop() )
         std::cout << "Error during request to stop data streaming.\n";
-  
-      struct timespec read_timeout;
-      read_timeout.tv_sec = 1;
-      read_timeout.tv_nsec = 0;
-  
-      pthread_join(thread_, 0);
 
       running_ = false;
     }
 
     socket_conn_.shutdown();
+    connected_ = false;
   }
 
   Wrench KMS40Driver::currentWrench()
   {
-    pthread_scoped_lock lock(&mutex_);
-    return wrench_buffer_;
+    return latest_sample_.read().wrench;
   }
 
-  bool KMS40Driver::spinRealtimeThread()
+  WrenchSample KMS40Driver::currentSample()
+  {
+    return latest_sample_.read();
+  }
+
+  StreamStats KMS40Driver::streamStats()
+  {
+    return latest_stats_.read();
+  }
+
+  void KMS40Driver::setQueueCapacity(size_t capacity)
   {
-    // setting up mutex
-    pthread_mutexattr_t mattr;
-    pthread_mutexattr_init(&mattr);
-    pthread_mutexattr_setprotocol(&mattr, PTHREAD_PRIO_INHERIT);
+    queue_capacity_ = capacity;
+  }
+
+  size_t KMS40Driver::popWrenches(std::vector<WrenchSample>& samples, size_t max_samples,
+      double timeout)
+  {
+    samples.clear();
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t) timeout;
+    deadline.tv_nsec += (long) ((timeout - (time_t) timeout) * 1e9);
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+
+    // the semaphore may count more posts than there are samples left,
+    // an empty queue after a wakeup just means waiting again
+    WrenchSample sample;
+    while ( true )
+    {
+      while ( samples.size() < max_samples && queue_.pop(sample) )
+        samples.push_back(sample);
+
+      if ( !samples.empty() || timeout <= 0.0 ||
+           sem_timedwait(queue_sem_, &deadline) != 0 )
+        return samples.size();
+    }
+  }
+
+  void KMS40Driver::setQueueSemaphore(sem_t* sem)
+  {
+    queue_sem_ = sem;
+  }
+
+  void KMS40Driver::setFilter(const WrenchFilterConfig& config)
+  {
+    filter_config_ = config;
+  }
+
+  void KMS40Driver::requestTare(size_t samples)
+  {
+    __atomic_store_n(&tare_request_, samples, __ATOMIC_RELEASE);
+  }
 
-    pthread_mutex_init(&mutex_,  &mattr);
+  unsigned long KMS40Driver::tares()
+  {
+    return __atomic_load_n(&tares_, __ATOMIC_ACQUIRE);
+  }
 
+  Wrench KMS40Driver::bias()
+  {
+    return latest_bias_.read();
+  }
+
+  bool KMS40Driver::spinRealtimeThread()
+  {
     // setting up thread
     pthread_attr_t tattr;
     struct sched_param sparam;
@@ -147,33 +340,181 @@ namespace iai_kms_40_driver
 
   void* KMS40Driver::run()
   {
-    while( !exit_requested_ )
+    while( !__atomic_load_n(&exit_requested_, __ATOMIC_RELAXED) )
     {
-      blockingReadWrench();
-      copyWrenchIntoBuffer();
+      if ( connected() )
+      {
+        if ( !blockingReadWrenches() || stalled() )
+          connectionLost();
+        continue;
+      }
+
+      double wait = retry_at_ - monotonicTime();
+      if ( wait <= 0.0 )
+        reconnect();
+      else
+        // short naps, a stop request should not wait for the backoff
+        usleep(std::min(wait, 0.1) * 1e6);
     }
 
     return 0;
   }
 
-  void KMS40Driver::blockingReadWrench()
+  bool KMS40Driver::readAvailable()
   {
-    std::string readData = socket_conn_.readChunk();
-    
-    if( !parse_wrench(readData, wrench_) )
-      std::cout << "Error parsing wrench message!\nMessage:\n" << readData << std::endl;
+    return blockingReadWrenches();
+  }
+
+  // One read may carry several frames or only part of one, every complete
+  // frame is parsed and the rest waits for the next read.
+  // Appends what is left of the last read, or reads the socket if nothing
+  // is. new_data is false after a read timeout.
+  bool KMS40Driver::fillFrameBuffer(bool& new_data)
+  {
+    if ( unread_size_ == 0 )
+    {
+      if ( !socket_conn_.read(unread_, unread_size_) )
+        return false;
+      if ( unread_size_ > 0 )
+        last_data_ = monotonicTime();
+    }
+
+    new_data = unread_size_ > 0;
+    size_t appended = frame_buffer_.append(unread_, unread_size_);
+    unread_ += appended;
+    unread_size_ -= appended;
+    return true;
+  }
+
+  bool KMS40Driver::blockingReadWrenches()
+  {
+    bool new_data;
+    if ( !fillFrameBuffer(new_data) )
+      return false;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    sample_.receive_time = now.tv_sec + now.tv_nsec * 1e-9;
+
+    const char* frame;
+    size_t size;
+    bool pushed = false;
+    while ( true )
+    {
+      if ( !frame_buffer_.nextFrame(frame, size) )
+      {
+        // the rest of a read which did not fit before the frames were taken
+        if ( unread_size_ == 0 )
+          break;
+        fillFrameBuffer(new_data);
+        continue;
+      }
+
+      if( parse_wrench(frame, frame + size, wrench_) )
+      {
+        stats_.frames++;
+
+        clock_.update(wrench_.timestamp_, sample_.receive_time);
+
+        if ( __atomic_load_n(&tare_request_, __ATOMIC_RELAXED) > 0 )
+          filter_.startTare(__atomic_exchange_n(&tare_request_, 0, __ATOMIC_ACQUIRE));
+
+        bool taring = filter_.taring();
+        sample_.saturated = filter_.process(wrench_);
+        if ( sample_.saturated )
+          stats_.saturated++;
+        if ( taring && !filter_.taring() )
+        {
+          latest_bias_.write(filter_.bias());
+          __atomic_add_fetch(&tares_, 1, __ATOMIC_RELEASE);
+        }
+
+        sample_.wrench = wrench_;
+
+        sample_.stamp = clock_.toHost(wrench_.timestamp_);
+        window_frames_++;
+        if ( clock_.valid() )
+          window_delay_ = std::max(window_delay_, sample_.receive_time - sample_.stamp);
+
+        if ( queue_capacity_ > 0 )
+        {
+          // a consumer which falls behind loses the newest samples
+          if ( queue_.push(sample_) )
+            pushed = true;
+          else
+            stats_.overruns++;
+        }
+      }
+      else
+      {
+        stats_.resyncs++;
+        std::cout << "Error parsing wrench message!\nMessage:\n" << std::string(frame, size) << std::endl;
+      }
+    }
+
+    copyWrenchIntoBuffer();
+
+    if ( pushed )
+      sem_post(queue_sem_);
+
+    return true;
   }
 
   void KMS40Driver::copyWrenchIntoBuffer()
   {
-    pthread_scoped_lock lock(&mutex_);
-    wrench_buffer_ = wrench_;
+    stats_.bytes = frame_buffer_.bytes();
+
+    latest_sample_.write(sample_);
+
+    double window = sample_.receive_time - window_start_;
+    if ( window >= 1.0 )
+    {
+      if ( window_start_ > 0.0 )
+      {
+        stats_.rate = window_frames_ / window;
+        stats_.max_delay = window_delay_;
+      }
+      window_start_ = sample_.receive_time;
+      window_delay_ = 0.0;
+      window_frames_ = 0;
+    }
+
+    publishStats();
+  }
+
+  void KMS40Driver::publishStats()
+  {
+    StreamStats stats = stats_;
+    stats.resyncs += frame_buffer_.resyncs();
+    stats.clock_outliers = clock_.outliers();
+    stats.clock_resets = clock_.resets();
+    latest_stats_.write(stats);
   }
 
+  bool KMS40Driver::blockingReadFrame(std::string& frame)
+  {
+    bool new_data;
+    while ( !frame_buffer_.nextFrame(frame) )
+      if ( !fillFrameBuffer(new_data) || !new_data )
+        return false;
+
+    return true;
+  }
+
+  // The response may arrive behind stream frames or together with them,
+  // frames which follow it stay buffered for the thread.
   bool KMS40Driver::kmsServiceRequest(const std::string& request, const std::string& response)
   {
-    socket_conn_.sendMessage(request);
-    
-    return (socket_conn_.readChunk().compare(response) == 0);
+    if ( !socket_conn_.sendMessage(request) )
+      return false;
+
+    std::string expected = response.substr(0, response.find_last_not_of("\r\n") + 1);
+    std::string frame;
+    for (int i=0; i < MAX_SERVICE_FRAMES && blockingReadFrame(frame); ++i)
+      if ( frame == expected )
+        return true;
+
+    return false;
   }
 }
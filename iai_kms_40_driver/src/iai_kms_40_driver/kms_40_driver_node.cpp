@@ -23,6 +23,9 @@
  * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
+#include <sstream>
+#include <time.h>
 #include <iai_kms_40_driver/kms_40_driver_node.hpp>
 #include <iai_kms_40_driver/msg_conversions.hpp>
 #include <iai_kms_40_driver/parser.hpp>
@@ -41,72 +44,294 @@ namespace iai_kms_40_driver
     return result;
   }
 
-  KMS40DriverNode::KMS40DriverNode(const ros::NodeHandle& nh) : nh_(nh) 
+  // seconds a publishing loop waits for samples before it checks ros::ok()
+  const double sample_wait = 0.1;
+
+  KMS40Sensor::KMS40Sensor(const ros::NodeHandle& nh) :
+      nh_(nh), sample_rate_(500.0), tare_samples_(100)
   {
-    pub_ = nh_.advertise<geometry_msgs::WrenchStamped>("wrench", 1);
-  }
-  
-  KMS40DriverNode::~KMS40DriverNode()
-  { 
   }
-  
-  void KMS40DriverNode::run()
-  {
-    if(!startUp())
-      return;
-  
-    loop();
-  
-    driver_.stop();
-  }
-  
-  bool KMS40DriverNode::startUp()
+
+  bool KMS40Sensor::startUp(const std::string& publish_mode, int batch_size,
+      sem_t* samples_sem, ros::CallbackQueue* service_queue)
   {
     std::string ip, port;
     double timeout;
     int frame_divider;
+    const char* ns = nh_.getNamespace().c_str();
 
     if ( !nh_.getParam("ip", ip) )
     {
-      ROS_ERROR("Could not find ROS parameter for IP");
+      ROS_ERROR("Could not find ROS parameter for IP in %s", ns);
       return false;
     }
 
     if ( !nh_.getParam("port", port) )
     {
-      ROS_ERROR("Could not find ROS parameter for TCP port");
+      ROS_ERROR("Could not find ROS parameter for TCP port in %s", ns);
       return false;
     }
 
     if ( !nh_.getParam("tcp_timeout", timeout) )
     {
-      ROS_ERROR("Could not find ROS parameter for TCP timeout");
+      ROS_ERROR("Could not find ROS parameter for TCP timeout in %s", ns);
       return false;
     }
 
     if ( !nh_.getParam("frame_id", msg_.header.frame_id) )
     {
-      ROS_ERROR("Could not find ROS parameter for frame-id");
+      ROS_ERROR("Could not find ROS parameter for frame-id in %s", ns);
       return false;
     }
+    batch_msg_.header.frame_id = msg_.header.frame_id;
 
     if ( !nh_.getParam("frame_divider", frame_divider) )
     {
-      ROS_ERROR("Could not find ROS parameter for frame divider");
+      ROS_ERROR("Could not find ROS parameter for frame divider in %s", ns);
       return false;
     }
 
     if ( frame_divider > 500 || frame_divider < 1)
     {
-      ROS_ERROR("Frame divider not set to at least 1 or maximum 500");
+      ROS_ERROR("Frame divider not set to at least 1 or maximum 500 in %s", ns);
+      return false;
+    }
+
+    if ( publish_mode == "batch" )
+    {
+      pub_ = nh_.advertise<iai_kms_40_driver::WrenchArray>("wrenches", 10);
+      batch_msg_.stamps.reserve(batch_size);
+      batch_msg_.wrenches.reserve(batch_size);
+    }
+    else
+      pub_ = nh_.advertise<geometry_msgs::WrenchStamped>("wrench", 
+          (publish_mode == "event") ? 100 : 1);
+
+    // about two seconds of samples at the full 500 Hz
+    if ( publish_mode != "rate" )
+      driver_.setQueueCapacity(std::max(1000, 4 * batch_size));
+    driver_.setQueueSemaphore(samples_sem);
+
+    WrenchFilterConfig filter_config;
+    if ( !readFilterConfig(filter_config) )
+      return false;
+    driver_.setFilter(filter_config);
+
+    // the sensor sends 500 frames/s with a frame divider of 1
+    sample_rate_ = 500.0 / frame_divider;
+
+    if ( !driver_.connect(ip, port, convertTime(timeout), frame_divider) )
+      return false;
+
+    ros::NodeHandle service_nh(nh_);
+    service_nh.setCallbackQueue(service_queue);
+    tare_srv_ = service_nh.advertiseService("tare", &KMS40Sensor::tare, this);
+
+    return true;
+  }
+
+  void KMS40Sensor::shutDown()
+  {
+    driver_.stop();
+
+    StreamStats stats = driver_.streamStats();
+    ROS_INFO("%s: %lu frames, %.1f frames/s and at most %.1f ms delay in the last second, "
+        "%lu resyncs, %lu overruns, %lu disconnects with %.1f s downtime",
+        nh_.getNamespace().c_str(), stats.frames, stats.rate, stats.max_delay * 1e3,
+        stats.resyncs, stats.overruns, stats.disconnects, stats.downtime);
+  }
+
+  bool KMS40Sensor::readFilterConfig(WrenchFilterConfig& config)
+  {
+    std::string filter;
+    int window;
+
+    nh_.param("filter", filter, std::string("none"));
+    nh_.param("filter_cutoff", config.cutoff, 10.0);
+    nh_.param("filter_window", window, 10);
+    nh_.param("force_limit", config.force_limit, 0.0);
+    nh_.param("torque_limit", config.torque_limit, 0.0);
+    nh_.param("tare_samples", tare_samples_, 100);
+
+    if ( filter == "none" )
+      config.type = WrenchFilterConfig::NONE;
+    else if ( filter == "biquad" )
+      config.type = WrenchFilterConfig::BIQUAD;
+    else if ( filter == "moving_average" )
+      config.type = WrenchFilterConfig::MOVING_AVERAGE;
+    else
+    {
+      ROS_ERROR("Unknown filter '%s', use none, biquad or moving_average", filter.c_str());
+      return false;
+    }
+
+    if ( window < 1 || tare_samples_ < 1 )
+    {
+      ROS_ERROR("filter_window and tare_samples must be at least 1");
+      return false;
+    }
+    config.window = window;
+
+    return true;
+  }
+
+  void KMS40Sensor::publishLatest()
+  {
+    // the sensor's own timestamp, mapped onto the host clock by the driver
+    WrenchSample sample = driver_.currentSample();
+    if ( sample.stamp > 0.0 )
+      msg_.header.stamp = ros::Time(sample.stamp);
+    else
+      msg_.header.stamp = ros::Time::now();
+
+    pub_.publish(populateMsg(sample.wrench, msg_));
+    warnSaturation(sample);
+  }
+
+  void KMS40Sensor::publishEvents()
+  {
+    while ( driver_.popWrenches(samples_, 100, 0.0) > 0 )
+      for (size_t i=0; i < samples_.size(); ++i)
+      {
+        msg_.header.stamp = ros::Time(samples_[i].stamp);
+        pub_.publish(populateMsg(samples_[i].wrench, msg_));
+        warnSaturation(samples_[i]);
+      }
+  }
+
+  void KMS40Sensor::publishBatches(size_t batch_size)
+  {
+    while ( driver_.popWrenches(samples_, batch_size - batch_msg_.wrenches.size(), 0.0) > 0 )
+    {
+      for (size_t i=0; i < samples_.size(); ++i)
+      {
+        batch_msg_.stamps.push_back(ros::Time(samples_[i].stamp));
+        batch_msg_.wrenches.push_back(geometry_msgs::Wrench());
+        populateMsg(samples_[i].wrench, batch_msg_.wrenches.back());
+        warnSaturation(samples_[i]);
+      }
+
+      if ( batch_msg_.wrenches.size() >= batch_size )
+      {
+        batch_msg_.header.stamp = batch_msg_.stamps.back();
+        pub_.publish(batch_msg_);
+        batch_msg_.stamps.clear();
+        batch_msg_.wrenches.clear();
+      }
+    }
+  }
+
+  void KMS40Sensor::warnSaturation(const WrenchSample& sample)
+  {
+    if ( sample.saturated )
+      ROS_WARN_THROTTLE(1.0, "Wrench beyond force_limit or torque_limit, the sensor may be saturated");
+  }
+
+  bool KMS40Sensor::tare(std_srvs::Trigger::Request& request,
+      std_srvs::Trigger::Response& response)
+  {
+    unsigned long tares = driver_.tares();
+    driver_.requestTare(tare_samples_);
+
+    // the stream goes on while the samples are averaged
+    ros::WallTime deadline = ros::WallTime::now() + 
+        ros::WallDuration(2.0 * tare_samples_ / sample_rate_ + 1.0);
+    while ( driver_.tares() == tares && ros::WallTime::now() < deadline )
+      ros::WallDuration(0.01).sleep();
+
+    std::ostringstream message;
+    response.success = driver_.tares() != tares;
+    if ( response.success )
+      message << "New bias " << driver_.bias();
+    else
+      message << "No samples from the sensor to tare with";
+    response.message = message.str();
+
+    return true;
+  }
+
+  KMS40DriverNode::KMS40DriverNode(const ros::NodeHandle& nh) : 
+      nh_(nh), batch_size_(1), service_spinner_(1, &service_queue_)
+  {
+    sem_init(&samples_sem_, 0, 0);
+  }
+  
+  KMS40DriverNode::~KMS40DriverNode()
+  { 
+    sem_destroy(&samples_sem_);
+  }
+  
+  void KMS40DriverNode::run()
+  {
+    if(startUp())
+      loop();
+  
+    shutDown();
+  }
+  
+  bool KMS40DriverNode::startUp()
+  {
+    // 'rate': the latest wrench at publish_rate, 'event': every sample in a
+    // WrenchStamped, 'batch': batch_size samples per WrenchArray
+    nh_.param("publish_mode", publish_mode_, std::string("rate"));
+    nh_.param("batch_size", batch_size_, 10);
+
+    if ( !(publish_mode_ == "rate" || publish_mode_ == "event" || publish_mode_ == "batch") ||
+         batch_size_ < 1 )
+    {
+      ROS_ERROR("Unknown publish_mode '%s' or batch_size not greater 0",
+          publish_mode_.c_str());
+      return false;
+    }
+
+    std::vector<std::string> names;
+    if ( nh_.getParam("sensors", names) )
+    {
+      for (size_t i=0; i < names.size(); ++i)
+        sensors_.push_back(boost::shared_ptr<KMS40Sensor>(
+            new KMS40Sensor(ros::NodeHandle(nh_, names[i]))));
+    }
+    else
+      sensors_.push_back(boost::shared_ptr<KMS40Sensor>(new KMS40Sensor(nh_)));
+
+    if ( sensors_.empty() )
+    {
+      ROS_ERROR("Parameter 'sensors' does not name any sensor");
       return false;
     }
 
-    return driver_.start(ip, port, convertTime(timeout), frame_divider);
+    std::vector<KMS40Driver*> drivers;
+    for (size_t i=0; i < sensors_.size(); ++i)
+    {
+      if ( !sensors_[i]->startUp(publish_mode_, batch_size_, &samples_sem_, &service_queue_) )
+        return false;
+      drivers.push_back(&sensors_[i]->driver());
+    }
+
+    if ( !reader_.start(drivers) )
+      return false;
+
+    service_spinner_.start();
+
+    return true;
+  }
+
+  void KMS40DriverNode::shutDown()
+  {
+    service_spinner_.stop();
+    reader_.stop();
+
+    for (size_t i=0; i < sensors_.size(); ++i)
+      sensors_[i]->shutDown();
   }
   
   void KMS40DriverNode::loop()
   {
+    if ( publish_mode_ == "event" )
+      return publishEvents();
+    if ( publish_mode_ == "batch" )
+      return publishBatches();
+
     int publish_rate;
 
     if ( !nh_.getParam("publish_rate", publish_rate) )
@@ -124,14 +349,53 @@ namespace iai_kms_40_driver
     ros::Rate r(publish_rate);
     while(ros::ok())
     {
-      // TODO: Getting the timestamp here is a hack! This should come from the driver.
-      //       However, at the time of writing the firmware only reported a meaningless
-      //       timestamp, i.e. relative to system bootup time.
-      msg_.header.stamp = ros::Time::now();
- 
-      pub_.publish(populateMsg(driver_.currentWrench(), msg_));
+      for (size_t i=0; i < sensors_.size(); ++i)
+        sensors_[i]->publishLatest();
+
       ros::spinOnce();
       r.sleep();
     }
   }
+
+  void KMS40DriverNode::publishEvents()
+  {
+    while(ros::ok())
+    {
+      waitForSamples(sample_wait);
+
+      for (size_t i=0; i < sensors_.size(); ++i)
+        sensors_[i]->publishEvents();
+
+      ros::spinOnce();
+    }
+  }
+
+  void KMS40DriverNode::publishBatches()
+  {
+    while(ros::ok())
+    {
+      waitForSamples(sample_wait);
+
+      for (size_t i=0; i < sensors_.size(); ++i)
+        sensors_[i]->publishBatches(batch_size_);
+
+      ros::spinOnce();
+    }
+  }
+
+  void KMS40DriverNode::waitForSamples(double timeout)
+  {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t) timeout;
+    deadline.tv_nsec += (long) ((timeout - (time_t) timeout) * 1e9);
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+
+    // more posts than samples only cost an empty round
+    sem_timedwait(&samples_sem_, &deadline);
+  }
 } // namespace iai_kms_40_driver
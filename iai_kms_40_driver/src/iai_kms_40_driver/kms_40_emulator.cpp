@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Emulates a KMS40 on a local TCP port, so that the driver can be run and
+// benchmarked without the sensor.
+//
+//   kms40_emulator [-p port] [-r rate] [-n frames] [-f file] [-d ppm]
+//                  [-c frames] [-s probability] [-g probability] [-l length]
+//                  [-S seed] [-o]
+//
+//   -p  port to listen on, default 1000
+//   -r  frames per second at LDIV(1), default 500; LDIV(n) divides it
+//   -n  close the connection after this many frames, default 0: never
+//   -f  replay the wrenches of a file with one F={...},ts frame per line,
+//       default: synthetic sine waves with noise
+//   -d  drift of the sensor clock against the host clock in ppm
+//   -c  coalesce a random number of up to this many frames into one write
+//   -s  probability that a write is split at a random byte
+//   -g  probability of a run of garbage without a newline before a frame,
+//       which corrupts that frame
+//   -l  maximum length of a garbage run, default 64
+//   -S  seed of the random numbers, default 1
+//   -o  serve one connection and exit
+//
+// The emulator answers LDIV(n), L1() and L0() like the sensor and streams
+// frames with timestamps in microseconds of its own clock while L1 is on.
+// Connections are served one after the other. When one closes, the number
+// of frames, how many of them were corrupted on purpose and how far the
+// emulator fell behind its schedule is printed. The driver should have
+// parsed all frames which were not corrupted.
+
+#include <iai_kms_40_driver/parser.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// a split write is sent as two segments this far apart
+#define SPLIT_PAUSE_US 100
+// a frame this many periods behind its schedule counts as late
+#define LATE_PERIODS 2.0
+
+namespace
+{
+  using iai_kms_40_driver::Wrench;
+
+  struct Options
+  {
+    int port;
+    double rate;
+    unsigned long frames;
+    std::string replay_file;
+    double drift;
+    int coalesce;
+    double split, garbage;
+    int garbage_length;
+    long seed;
+    bool once;
+  };
+
+  struct Report
+  {
+    unsigned long frames, garbled, late, splits, writes;
+    double max_lag, start, end;
+  };
+
+  double monotonicTime()
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+  }
+
+  bool readReplayFile(const std::string& name, std::vector<Wrench>& wrenches)
+  {
+    std::ifstream file(name.c_str());
+    std::string line;
+    Wrench wrench;
+    while (std::getline(file, line))
+      if (iai_kms_40_driver::parse_wrench(line, wrench))
+        wrenches.push_back(wrench);
+
+    if (wrenches.empty())
+      std::cout << "No frames in '" << name << "'.\n";
+    return !wrenches.empty();
+  }
+
+  Wrench syntheticWrench(unsigned long index)
+  {
+    double t = index * 0.002;
+    Wrench wrench;
+    wrench.fx_ = 2.0 * sin(2 * M_PI * 0.5 * t) + 0.05 * (drand48() - 0.5);
+    wrench.fy_ = -1.0 * cos(2 * M_PI * 0.3 * t) + 0.05 * (drand48() - 0.5);
+    wrench.fz_ = -9.81 + 0.5 * sin(2 * M_PI * 1.1 * t) + 0.05 * (drand48() - 0.5);
+    wrench.tx_ = 0.02 * sin(2 * M_PI * 0.7 * t) + 0.001 * (drand48() - 0.5);
+    wrench.ty_ = 0.01 * cos(2 * M_PI * 0.2 * t) + 0.001 * (drand48() - 0.5);
+    wrench.tz_ = 0.001 * (drand48() - 0.5);
+    return wrench;
+  }
+
+  class Connection
+  {
+    public:
+      Connection(int fd, const Options& options, const std::vector<Wrench>& replay) :
+          fd_(fd), options_(options), replay_(replay), divider_(1), streaming_(false),
+          batch_(1), pending_(0), index_(0), sensor_start_(0.0), next_due_(0.0)
+      {
+        report_.frames = report_.garbled = report_.late = report_.splits = report_.writes = 0;
+        report_.max_lag = 0.0;
+        report_.start = report_.end = monotonicTime();
+      }
+
+      // serves commands and streams until the client closes the connection
+      // or the frame limit is reached
+      const Report& serve()
+      {
+        while (options_.frames == 0 || report_.frames < options_.frames)
+        {
+          struct pollfd pfd = {fd_, POLLIN, 0};
+          double wait = streaming_ ? std::max(0.0, next_due_ - monotonicTime()) : 0.1;
+          struct timespec timeout = {(time_t) wait, (long) ((wait - floor(wait)) * 1e9)};
+
+          int ready = ppoll(&pfd, 1, &timeout, 0);
+          if (ready == -1)
+            break;
+          if (ready == 1 && !receiveCommands())
+            break;
+          if (streaming_ && !streamDueFrames())
+            break;
+        }
+
+        flush();
+        report_.end = monotonicTime();
+        return report_;
+      }
+
+    private:
+      int fd_;
+      const Options& options_;
+      const std::vector<Wrench>& replay_;
+
+      int divider_;
+      bool streaming_;
+      std::string commands_, out_;
+      int batch_, pending_;
+      unsigned long index_;
+      double sensor_start_, next_due_;
+      Report report_;
+
+      double period() const
+      {
+        return divider_ / options_.rate;
+      }
+
+      bool receiveCommands()
+      {
+        char buffer[256];
+        ssize_t received = recv(fd_, buffer, sizeof(buffer), 0);
+        if (received <= 0)
+          return false;
+        commands_.append(buffer, received);
+
+        size_t end;
+        while ((end = commands_.find('\n')) != std::string::npos)
+        {
+          std::string command = commands_.substr(0, end);
+          commands_.erase(0, end + 1);
+          if (!command.empty() && command[command.size() - 1] == '\r')
+            command.erase(command.size() - 1);
+          if (!execute(command))
+            return false;
+        }
+
+        return true;
+      }
+
+      bool execute(const std::string& command)
+      {
+        int divider;
+        char trailer;
+        if (sscanf(command.c_str(), "LDIV(%d%c", &divider, &trailer) == 2 && trailer == ')' &&
+            divider > 0)
+        {
+          divider_ = divider;
+          char text[32];
+          snprintf(text, sizeof(text), "LDIV=%d\n", divider);
+          return reply(text);
+        }
+        else if (command == "L1()")
+        {
+          if (!reply("L1\n"))
+            return false;
+          if (!streaming_)
+          {
+            streaming_ = true;
+            next_due_ = monotonicTime();
+            if (index_ == 0)
+              sensor_start_ = next_due_;
+          }
+          return true;
+        }
+        else if (command == "L0()")
+        {
+          streaming_ = false;
+          return reply("L0\n");
+        }
+
+        std::cout << "Ignoring unknown command '" << command << "'.\n";
+        return true;
+      }
+
+      // replies go out after the frames before them, never split
+      bool reply(const char* text)
+      {
+        out_ += text;
+        return flush(false);
+      }
+
+      bool streamDueFrames()
+      {
+        double now = monotonicTime();
+        while (next_due_ <= now && (options_.frames == 0 || report_.frames < options_.frames))
+        {
+          report_.max_lag = std::max(report_.max_lag, now - next_due_);
+          if (now - next_due_ > LATE_PERIODS * period())
+            ++report_.late;
+
+          appendFrame(next_due_);
+          next_due_ += period() * (1.0 + options_.drift * 1e-6);
+
+          if (++pending_ >= batch_ && !flush())
+            return false;
+        }
+        return true;
+      }
+
+      void appendFrame(double due)
+      {
+        if (options_.garbage > 0 && drand48() < options_.garbage)
+        {
+          int length = 1 + lrand48() % options_.garbage_length;
+          for (int i=0; i < length; ++i)
+            out_ += (char) ('!' + lrand48() % ('~' - '!' + 1));
+          ++report_.garbled;
+        }
+
+        Wrench wrench = replay_.empty() ? syntheticWrench(index_) :
+            replay_[index_ % replay_.size()];
+        // the sensor clock runs at its own rate, the host sees it drift
+        long timestamp = (long) ((due - sensor_start_) * 1e6 / (1.0 + options_.drift * 1e-6));
+
+        char frame[160];
+        snprintf(frame, sizeof(frame), "F={%.3f,%.3f,%.3f,%.4f,%.4f,%.4f},%ld\n",
+            wrench.fx_, wrench.fy_, wrench.fz_, wrench.tx_, wrench.ty_, wrench.tz_, timestamp);
+        out_ += frame;
+
+        ++index_;
+        ++report_.frames;
+      }
+
+      bool flush(bool may_split=true)
+      {
+        pending_ = 0;
+        batch_ = (options_.coalesce > 1) ? 1 + lrand48() % options_.coalesce : 1;
+        if (out_.empty())
+          return true;
+
+        size_t first = out_.size();
+        if (may_split && out_.size() > 1 && options_.split > 0 && drand48() < options_.split)
+        {
+          first = 1 + lrand48() % (out_.size() - 1);
+          ++report_.splits;
+        }
+
+        bool ok = sendAll(out_.data(), first);
+        if (ok && first < out_.size())
+        {
+          usleep(SPLIT_PAUSE_US);
+          ok = sendAll(out_.data() + first, out_.size() - first);
+        }
+
+        out_.clear();
+        ++report_.writes;
+        return ok;
+      }
+
+      bool sendAll(const char* data, size_t size)
+      {
+        while (size > 0)
+        {
+          ssize_t sent = send(fd_, data, size, MSG_NOSIGNAL);
+          if (sent <= 0)
+            return false;
+          data += sent;
+          size -= sent;
+        }
+        return true;
+      }
+  };
+
+  void usage()
+  {
+    std::cout << "usage: kms40_emulator [-p port] [-r rate] [-n frames] [-f file] [-d ppm]\n"
+        "                      [-c frames] [-s probability] [-g probability] [-l length]\n"
+        "                      [-S seed] [-o]\n";
+  }
+
+  bool parseOptions(int argc, char** argv, Options& options)
+  {
+    options.port = 1000;
+    options.rate = 500.0;
+    options.frames = 0;
+    options.drift = 0.0;
+    options.coalesce = 1;
+    options.split = options.garbage = 0.0;
+    options.garbage_length = 64;
+    options.seed = 1;
+    options.once = false;
+
+    int option;
+    while ((option = getopt(argc, argv, "p:r:n:f:d:c:s:g:l:S:oh")) != -1)
+      switch (option)
+      {
+        case 'p': options.port = atoi(optarg); break;
+        case 'r': options.rate = atof(optarg); break;
+        case 'n': options.frames = strtoul(optarg, 0, 10); break;
+        case 'f': options.replay_file = optarg; break;
+        case 'd': options.drift = atof(optarg); break;
+        case 'c': options.coalesce = atoi(optarg); break;
+        case 's': options.split = atof(optarg); break;
+        case 'g': options.garbage = atof(optarg); break;
+        case 'l': options.garbage_length = atoi(optarg); break;
+        case 'S': options.seed = atol(optarg); break;
+        case 'o': options.once = true; break;
+        default: return false;
+      }
+
+    if (optind != argc || options.port <= 0 || options.port > 65535 || !(options.rate > 0) ||
+        options.coalesce < 1 || options.garbage_length < 1 || fabs(options.drift) >= 1e5)
+      return false;
+
+    return true;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  Options options;
+  if (!parseOptions(argc, argv, options))
+  {
+    usage();
+    return 2;
+  }
+
+  std::vector<Wrench> replay;
+  if (!options.replay_file.empty() && !readReplayFile(options.replay_file, replay))
+    return 1;
+
+  srand48(options.seed);
+  signal(SIGPIPE, SIG_IGN);
+
+  int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int reuse = 1;
+  setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+  struct sockaddr_in addr;
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(options.port);
+  if (bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) == -1 || listen(listen_fd, 1) == -1)
+  {
+    std::cout << "Could not listen on port " << options.port << ".\n";
+    return 1;
+  }
+
+  std::cout << "Emulating a KMS40 on port " << options.port << " at " << options.rate
+      << " frames/s.\n" << std::flush;
+
+  while (true)
+  {
+    struct sockaddr_in client;
+    socklen_t client_len = sizeof(client);
+    int fd = accept(listen_fd, (struct sockaddr*) &client, &client_len);
+    if (fd == -1)
+      continue;
+
+    int flag = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+    Connection connection(fd, options, replay);
+    Report report = connection.serve();
+    close(fd);
+
+    double duration = report.end - report.start;
+    std::cout << inet_ntoa(client.sin_addr) << ": " << report.frames << " frames in "
+        << duration << " s, " << report.garbled << " of them garbled, " << report.late
+        << " late (at most " << report.max_lag * 1e3 << " ms), " << report.splits << " of "
+        << report.writes << " writes split.\n" << std::flush;
+
+    if (options.once)
+      return 0;
+  }
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iai_kms_40_driver/kms_40_reader.hpp>
+#include <iostream>
+#include <sys/epoll.h>
+#include <time.h>
+#include <unistd.h>
+
+// ms epoll waits before it checks for a stop request
+#define EPOLL_TIMEOUT 100
+
+// s between checks for stalled streams and for due reconnects
+#define SUPERVISION_PERIOD 0.1
+
+namespace iai_kms_40_driver
+{
+  KMS40Reader::KMS40Reader() : 
+      epoll_fd_( -1 ), exit_requested_( false ), running_( false )
+  {
+  }
+
+  KMS40Reader::~KMS40Reader()
+  {
+    stop();
+  }
+
+  bool KMS40Reader::start(const std::vector<KMS40Driver*>& drivers)
+  {
+    drivers_ = drivers;
+
+    epoll_fd_ = epoll_create1(0);
+    if ( epoll_fd_ == -1 )
+    {
+      std::cout << "Error creating epoll instance.\n";
+      return false;
+    }
+
+    for (size_t i=0; i < drivers_.size(); ++i)
+      if ( !watch(i) )
+      {
+        std::cout << "Error adding sensor " << i << " to epoll.\n";
+        close(epoll_fd_);
+        epoll_fd_ = -1;
+        return false;
+      }
+
+    // same scheduling as the thread of a single driver
+    pthread_attr_t tattr;
+    struct sched_param sparam;
+    sparam.sched_priority = 12;
+    pthread_attr_init(&tattr);
+    pthread_attr_setschedpolicy(&tattr, SCHED_FIFO);
+    pthread_attr_setschedparam(&tattr, &sparam);
+    pthread_attr_setinheritsched (&tattr, PTHREAD_EXPLICIT_SCHED);
+
+    exit_requested_ = false;
+    if ( pthread_create(&thread_, &tattr, &KMS40Reader::run_s, (void *) this) != 0 )
+    {
+      std::cout << "Error when spinning realtime thread.\n";
+      close(epoll_fd_);
+      epoll_fd_ = -1;
+      return false;
+    }
+
+    if ( pthread_create(&supervisor_, 0, &KMS40Reader::supervise_s, (void *) this) != 0 )
+    {
+      std::cout << "Error when spinning supervisor thread.\n";
+      __atomic_store_n(&exit_requested_, true, __ATOMIC_RELAXED);
+      pthread_join(thread_, 0);
+      close(epoll_fd_);
+      epoll_fd_ = -1;
+      return false;
+    }
+
+    running_ = true;
+    return true;
+  }
+
+  void KMS40Reader::stop()
+  {
+    if ( running_ )
+    {
+      __atomic_store_n(&exit_requested_, true, __ATOMIC_RELAXED);
+      pthread_join(thread_, 0);
+      pthread_join(supervisor_, 0);
+      running_ = false;
+    }
+
+    if ( epoll_fd_ != -1 )
+      close(epoll_fd_);
+    epoll_fd_ = -1;
+  }
+
+  bool KMS40Reader::watch(size_t index)
+  {
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.u32 = index;
+    return epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, drivers_[index]->fd(), &event) == 0;
+  }
+
+  // out of the epoll set before the socket is closed, its number may be
+  // reused by the reconnect
+  void KMS40Reader::drop(size_t index)
+  {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, drivers_[index]->fd(), 0);
+    drivers_[index]->connectionLost();
+  }
+
+  void* KMS40Reader::run()
+  {
+    std::vector<struct epoll_event> events(drivers_.size());
+    double last_check = monotonicTime();
+
+    while ( !__atomic_load_n(&exit_requested_, __ATOMIC_RELAXED) )
+    {
+      int ready = epoll_wait(epoll_fd_, &events[0], events.size(), EPOLL_TIMEOUT);
+
+      // a readable socket does not block the read, a hangup reads 0 bytes
+      for (int i=0; i < ready; ++i)
+        if ( !drivers_[events[i].data.u32]->readAvailable() )
+          drop(events[i].data.u32);
+
+      // sensors which went quiet without closing the connection
+      if ( monotonicTime() - last_check >= SUPERVISION_PERIOD )
+      {
+        for (size_t i=0; i < drivers_.size(); ++i)
+          if ( drivers_[i]->connected() && drivers_[i]->stalled() )
+            drop(i);
+        last_check = monotonicTime();
+      }
+    }
+
+    return 0;
+  }
+
+  void* KMS40Reader::supervise()
+  {
+    while ( !__atomic_load_n(&exit_requested_, __ATOMIC_RELAXED) )
+    {
+      for (size_t i=0; i < drivers_.size(); ++i)
+        if ( !drivers_[i]->connected() && monotonicTime() >= drivers_[i]->retryTime() &&
+             drivers_[i]->reconnect() && !watch(i) )
+        {
+          std::cout << "Error adding sensor " << i << " to epoll.\n";
+          drivers_[i]->connectionLost();
+        }
+
+      usleep(SUPERVISION_PERIOD * 1e6);
+    }
+
+    return 0;
+  }
+}
@@ -30,12 +30,20 @@ namespace iai_kms_40_driver
   geometry_msgs::WrenchStamped& populateMsg(const Wrench& wrench,
       geometry_msgs::WrenchStamped& msg)
   {
-    msg.wrench.force.x = wrench.fx_;
-    msg.wrench.force.y = wrench.fy_;
-    msg.wrench.force.z = wrench.fz_;
-    msg.wrench.torque.x = wrench.tx_;
-    msg.wrench.torque.y = wrench.ty_;
-    msg.wrench.torque.z = wrench.tz_;
+    populateMsg(wrench, msg.wrench);
+
+    return msg;
+  }
+
+  geometry_msgs::Wrench& populateMsg(const Wrench& wrench,
+      geometry_msgs::Wrench& msg)
+  {
+    msg.force.x = wrench.fx_;
+    msg.force.y = wrench.fy_;
+    msg.force.z = wrench.fz_;
+    msg.torque.x = wrench.tx_;
+    msg.torque.y = wrench.ty_;
+    msg.torque.z = wrench.tz_;
 
     return msg;
   }
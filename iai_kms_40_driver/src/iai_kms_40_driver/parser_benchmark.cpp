@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Compares parse_wrench() with the Boost.Spirit parser it replaced.
+//
+//   kms40_parser_benchmark [frames.txt] [rounds]
+//
+// frames.txt holds one frame per line as recorded from the sensor, e.g.
+// with 'nc <ip> 1000 > frames.txt' after sending L1(). Without a file a
+// built-in recording is used.
+
+#include <boost/spirit/include/qi.hpp>
+#include <boost/spirit/include/phoenix_core.hpp>
+#include <boost/spirit/include/phoenix_operator.hpp>
+
+#include <iai_kms_40_driver/frame_buffer.hpp>
+#include <iai_kms_40_driver/parser.hpp>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <time.h>
+
+namespace
+{
+  // the parser up to version 0.1.0
+  bool spirit_parse_wrench(const std::string& msg, iai_kms_40_driver::Wrench& wrench)
+  {
+    using boost::spirit::qi::double_;
+    using boost::spirit::qi::long_;
+    using boost::spirit::qi::_1;
+    using boost::spirit::qi::phrase_parse;
+    using boost::spirit::ascii::space;
+    using boost::phoenix::ref;
+
+    std::string::const_iterator first = msg.begin();
+    std::string::const_iterator last = msg.end();
+
+    return phrase_parse(first, last,
+        (
+                "F={" >> double_[ref(wrench.fx_) = _1] >> ','
+                      >> double_[ref(wrench.fy_) = _1] >> ','
+                      >> double_[ref(wrench.fz_) = _1] >> ','
+                      >> double_[ref(wrench.tx_) = _1] >> ','
+                      >> double_[ref(wrench.ty_) = _1] >> ','
+                      >> double_[ref(wrench.tz_) = _1] >> "},"
+                      >> long_[ref(wrench.timestamp_) = _1]
+        ),
+        space);
+  }
+
+  const char* recorded_frames[] = {
+    "F={-0.146,0.412,-1.732,0.0041,-0.0027,0.0003},1234567",
+    "F={-0.151,0.409,-1.729,0.0042,-0.0027,0.0004},1234569",
+    "F={-0.149,0.415,-1.735,0.0040,-0.0028,0.0003},1234571",
+    "F={12.804,-3.117,-25.460,0.8127,1.0362,-0.0412},1234573",
+    "F={12.911,-3.052,-25.533,0.8166,1.0398,-0.0409},1234575",
+    "F={0.000,0.000,0.000,0.0000,0.0000,0.0000},1234577",
+    "F={-101.250,87.125,-399.875,-3.1250,2.5000,-1.7500},1234579",
+    "F={3.5e-2,-1.25e1,2.0E0,1.0e-4,-2.5e-3,7.5e-1},1234581"
+  };
+
+  double now()
+  {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+  }
+
+  bool same(const iai_kms_40_driver::Wrench& a, const iai_kms_40_driver::Wrench& b)
+  {
+    return a.fx_ == b.fx_ && a.fy_ == b.fy_ && a.fz_ == b.fz_ && a.tx_ == b.tx_ &&
+        a.ty_ == b.ty_ && a.tz_ == b.tz_ && a.timestamp_ == b.timestamp_;
+  }
+}
+
+int main(int argc, char** argv)
+{
+  using namespace iai_kms_40_driver;
+
+  std::string stream;
+  if (argc > 1)
+  {
+    std::ifstream file(argv[1]);
+    if (!file)
+    {
+      std::cout << "Could not open " << argv[1] << ".\n";
+      return 1;
+    }
+    std::string line;
+    while (std::getline(file, line))
+      if (line.compare(0, 3, "F={") == 0)
+        stream += line + "\n";
+  }
+  else
+    for (size_t i=0; i < sizeof(recorded_frames) / sizeof(recorded_frames[0]); ++i)
+      stream += std::string(recorded_frames[i]) + "\n";
+
+  long rounds = (argc > 2) ? atol(argv[2]) : 200000;
+
+  // both parsers see the frames the way the driver does, out of a FrameBuffer
+  FrameBuffer frames(stream.size() + 1);
+  size_t num_frames = 0, mismatches = 0;
+  Wrench a, b;
+  const char* frame;
+  size_t size;
+
+  frames.append(stream);
+  while (frames.nextFrame(frame, size))
+  {
+    num_frames++;
+    if (!parse_wrench(frame, frame + size, a) || !spirit_parse_wrench(std::string(frame, size), b) ||
+        !same(a, b))
+    {
+      mismatches++;
+      std::cout << "Parsers disagree on: " << std::string(frame, size) << "\n  " << a << "\n  " << b << "\n";
+    }
+  }
+
+  if (num_frames == 0)
+  {
+    std::cout << "No frames to parse.\n";
+    return 1;
+  }
+
+  double start = now();
+  for (long r=0; r < rounds; ++r)
+  {
+    frames.append(stream);
+    while (frames.nextFrame(frame, size))
+      spirit_parse_wrench(std::string(frame, size), b);
+  }
+  double spirit = (now() - start) / (rounds * num_frames);
+
+  start = now();
+  for (long r=0; r < rounds; ++r)
+  {
+    frames.append(stream);
+    while (frames.nextFrame(frame, size))
+      parse_wrench(frame, frame + size, a);
+  }
+  double span = (now() - start) / (rounds * num_frames);
+
+  std::cout << num_frames << " frames, " << rounds << " rounds, " << mismatches << " mismatches\n";
+  std::cout << "Boost.Spirit on std::string: " << spirit * 1e9 << " ns/frame\n";
+  std::cout << "parse_wrench on span:        " << span * 1e9 << " ns/frame\n";
+
+  return (mismatches == 0) ? 0 : 1;
+}
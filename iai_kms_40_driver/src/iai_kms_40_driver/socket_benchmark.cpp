@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Compares SocketConnection::read() with the read path it replaced, which
+// set the read timeout and copied every chunk into a new std::string.
+//
+//   kms40_socket_benchmark [frames]
+//
+// A local thread streams recorded frames over TCP as fast as it can, the
+// reader feeds them into a FrameBuffer like the driver does. Reported are
+// the reader's CPU time, system calls and heap allocations per frame.
+
+#include <iai_kms_40_driver/frame_buffer.hpp>
+#include <iai_kms_40_driver/socket_connection.hpp>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace
+{
+  unsigned long allocations = 0;
+}
+
+void* operator new(size_t size)
+{
+  __atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+  void* p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) throw()
+{
+  free(p);
+}
+
+namespace
+{
+  const char frame[] = "F={-0.146,0.412,-1.732,0.0041,-0.0027,0.0003},1234567\n";
+
+  struct Stream
+  {
+    int listen_fd;
+    long frames;
+  };
+
+  void* sendStream(void* ptr)
+  {
+    Stream* stream = (Stream*) ptr;
+    int fd = accept(stream->listen_fd, 0, 0);
+
+    std::string chunk;
+    for (int i=0; i < 64; ++i)
+      chunk += frame;
+
+    for (long sent=0; sent < stream->frames; sent += 64)
+      if (send(fd, chunk.data(), chunk.size(), 0) == -1)
+        break;
+
+    close(fd);
+    return 0;
+  }
+
+  // the read path up to version 0.1.0
+  std::string oldReadChunk(int fd, const timeval& read_timeout, unsigned long& syscalls)
+  {
+    char in_buffer[1024];
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (char *)&read_timeout, sizeof(struct timeval));
+    ssize_t bytes_received = recv(fd, &in_buffer, 1024, 0);
+    syscalls += 2;
+
+    if (bytes_received <= 0)
+      return "";
+
+    return std::string(in_buffer, bytes_received);
+  }
+
+  double threadCpuTime()
+  {
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+  }
+
+  struct Result
+  {
+    unsigned long frames, syscalls, allocations;
+    double cpu;
+  };
+
+  bool run(bool old_path, long frames, Result& result)
+  {
+    using namespace iai_kms_40_driver;
+
+    Stream stream;
+    stream.frames = frames;
+    stream.listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    if (bind(stream.listen_fd, (struct sockaddr*) &addr, sizeof(addr)) == -1 ||
+        listen(stream.listen_fd, 1) == -1 ||
+        getsockname(stream.listen_fd, (struct sockaddr*) &addr, &addr_len) == -1)
+    {
+      std::cout << "Could not listen on the loopback device.\n";
+      return false;
+    }
+
+    std::ostringstream port;
+    port << ntohs(addr.sin_port);
+
+    pthread_t sender;
+    pthread_create(&sender, 0, &sendStream, &stream);
+
+    SocketConnection connection;
+    timeval timeout = {1, 0};
+    if (!connection.open("127.0.0.1", port.str(), timeout))
+      return false;
+
+    FrameBuffer frame_buffer(16384);
+    const char* data;
+    size_t size;
+    unsigned long syscalls = connection.syscalls(), old_syscalls = 0;
+    unsigned long allocations_before = allocations;
+    double start = threadCpuTime();
+
+    std::string chunk;
+    const char* read;
+    size_t read_size;
+    while (true)
+    {
+      if (old_path)
+      {
+        chunk = oldReadChunk(connection.fd(), timeout, old_syscalls);
+        if (chunk.empty())
+          break;
+        read = chunk.data();
+        read_size = chunk.size();
+      }
+      else
+      {
+        if (!connection.read(read, read_size) || read_size == 0)
+          break;
+      }
+
+      while (read_size > 0)
+      {
+        size_t appended = frame_buffer.append(read, read_size);
+        read += appended;
+        read_size -= appended;
+
+        while (frame_buffer.nextFrame(data, size))
+          ;
+      }
+    }
+
+    result.cpu = threadCpuTime() - start;
+    result.allocations = allocations - allocations_before;
+    result.syscalls = old_path ? old_syscalls : connection.syscalls() - syscalls;
+    result.frames = frame_buffer.frames();
+
+    pthread_join(sender, 0);
+    close(stream.listen_fd);
+    return true;
+  }
+
+  void report(const char* name, const Result& result)
+  {
+    std::cout << name << (result.cpu / result.frames) * 1e9 << " ns, "
+        << (double) result.syscalls / result.frames << " syscalls, "
+        << (double) result.allocations / result.frames << " allocations per frame\n";
+  }
+}
+
+int main(int argc, char** argv)
+{
+  long frames = (argc > 1) ? atol(argv[1]) : 1000000;
+
+  Result old_result, new_result;
+  if (!run(true, frames, old_result) || !run(false, frames, new_result))
+    return 1;
+
+  std::cout << old_result.frames << " and " << new_result.frames << " frames received\n";
+  report("setsockopt + std::string per read: ", old_result);
+  report("persistent buffer:                 ", new_result);
+
+  return (old_result.frames == new_result.frames) ? 0 : 1;
+}
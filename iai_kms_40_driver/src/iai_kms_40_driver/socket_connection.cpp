@@ -24,15 +24,21 @@
  */
 
 #include <iai_kms_40_driver/socket_connection.hpp>
+#include <algorithm>
 #include <iostream>
+#include <errno.h>
 #include <string.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 namespace iai_kms_40_driver
 {
   SocketConnection::SocketConnection() :
-      socket_fd_( -1 ), read_timeout_( )
+      socket_fd_( -1 ), read_timeout_( ), buffer_( buffer_size_ ), syscalls_( 0 )
   {
   }
 
@@ -74,22 +80,66 @@ namespace iai_kms_40_driver
       return false; 
     }
 
-    // connecting the socket
-    status = connect(socket_fd_, host_info_list->ai_addr, host_info_list->ai_addrlen);
-    if (status == -1)
+    // The window scale is agreed on in the SYN, a receive buffer set after
+    // connecting cannot grow the window past what was offered then.
+    int rcvbuf = kernel_buffer_size_;
+    if ( setsockopt(socket_fd_, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == -1 )
+      std::cout << "Error setting the receive buffer size.\n";
+    syscalls_++;
+
+    // connecting the socket, for at most the read timeout
+    status = connectWithTimeout(host_info_list->ai_addr, host_info_list->ai_addrlen);
+    freeaddrinfo(host_info_list);
+    if (!status)
     {
       std::cout << "Error connecting the socket.\n";
-      freeaddrinfo(host_info_list);
+      shutdown();
 
       return false;
     }
 
-    // free host info list
-    freeaddrinfo(host_info_list);
+    // Frames are small and should neither wait for more data nor for
+    // delayed ACKs. Linux may leave quick ACK mode later on, a continuous
+    // stream gets its ACKs every other segment anyway.
+    int on = 1;
+    if ( setsockopt(socket_fd_, SOL_SOCKET, SO_RCVTIMEO, (char *)&read_timeout_,
+             sizeof(struct timeval)) == -1 ||
+         setsockopt(socket_fd_, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1 ||
+         setsockopt(socket_fd_, IPPROTO_TCP, TCP_QUICKACK, &on, sizeof(on)) == -1 )
+      std::cout << "Error setting socket options.\n";
+    syscalls_ += 3;
 
     return true;
   }
 
+  bool SocketConnection::connectWithTimeout(const struct sockaddr* addr, socklen_t addr_len)
+  {
+    // a blocking connect to a host which is down hangs for minutes
+    int flags = fcntl(socket_fd_, F_GETFL, 0);
+    fcntl(socket_fd_, F_SETFL, flags | O_NONBLOCK);
+
+    int error = 0;
+    if (connect(socket_fd_, addr, addr_len) == -1)
+    {
+      if (errno != EINPROGRESS)
+        return false;
+
+      struct pollfd pfd;
+      pfd.fd = socket_fd_;
+      pfd.events = POLLOUT;
+      int timeout_ms = read_timeout_.tv_sec * 1000 + read_timeout_.tv_usec / 1000;
+      if (poll(&pfd, 1, std::max(timeout_ms, 1)) != 1)
+        return false;
+
+      socklen_t error_len = sizeof(error);
+      if (getsockopt(socket_fd_, SOL_SOCKET, SO_ERROR, &error, &error_len) == -1)
+        return false;
+    }
+
+    fcntl(socket_fd_, F_SETFL, flags);
+    return error == 0;
+  }
+
   void SocketConnection::shutdown()
   {
     if(ready())
@@ -102,39 +152,54 @@ namespace iai_kms_40_driver
     return (socket_fd_ != -1);
   }
 
-  std::string SocketConnection::readChunk()
+  bool SocketConnection::read(const char*& data, size_t& size)
   {
     assert(ready());
 
-    char in_buffer[buffer_size_];
-
-    setsockopt(socket_fd_, SOL_SOCKET, SO_RCVTIMEO, (char *)&read_timeout_,
-        sizeof(struct timeval));
+    data = &buffer_[0];
+    size = 0;
 
-    size_t bytes_received = recv(socket_fd_, &in_buffer, buffer_size_, 0);
+    ssize_t bytes_received = recv(socket_fd_, &buffer_[0], buffer_.size(), 0);
+    syscalls_++;
     // If no data arrives, the program will just wait here until it times out
 
     if (bytes_received == 0)
     {
       std::cout << "Error during reading: host shut down." << std::endl ;
-      return "";
+      return false;
     }
     if (bytes_received == -1) 
     {
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return true;
+
       std::cout << "Error during reading: receive error!" << std::endl ;
-      return "";
+      return false;
     }
 
-    return std::string(in_buffer, bytes_received);
+    size = bytes_received;
+    return true;
+  }
+
+  std::string SocketConnection::readChunk()
+  {
+    const char* data;
+    size_t size;
+
+    if ( !read(data, size) )
+      return "";
+
+    return std::string(data, size);
   }
 
   bool SocketConnection::sendMessage(const std::string& msg)
   {
     assert(ready());
 
-    size_t bytes_sent = send(socket_fd_, msg.c_str(), msg.length(), 0);
+    ssize_t bytes_sent = send(socket_fd_, msg.c_str(), msg.length(), 0);
+    syscalls_++;
 
-    if ( (bytes_sent == -1) || (bytes_sent != msg.length()) )
+    if ( (bytes_sent == -1) || ((size_t) bytes_sent != msg.length()) )
     {
       std::cout << "Error sending a message.\n";
       return false;
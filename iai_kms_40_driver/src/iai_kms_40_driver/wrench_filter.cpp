@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <iai_kms_40_driver/wrench_filter.hpp>
+#include <math.h>
+
+namespace iai_kms_40_driver
+{
+  const size_t WrenchFilter::CHANNELS;
+
+  WrenchFilter::WrenchFilter() : 
+      b0_( 1.0 ), b1_( 0.0 ), b2_( 0.0 ), a1_( 0.0 ), a2_( 0.0 )
+  {
+    reset();
+  }
+
+  bool WrenchFilter::configure(const WrenchFilterConfig& config, double sample_rate)
+  {
+    if ( config.type == WrenchFilterConfig::BIQUAD &&
+         !(config.cutoff > 0.0 && config.cutoff < sample_rate / 2) )
+      return false;
+
+    if ( config.type == WrenchFilterConfig::MOVING_AVERAGE && config.window < 1 )
+      return false;
+
+    config_ = config;
+
+    if ( config_.type == WrenchFilterConfig::BIQUAD )
+    {
+      // low-pass with Q = 1/sqrt(2), bilinear transform
+      double w = 2.0 * M_PI * config_.cutoff / sample_rate;
+      double alpha = sin(w) / sqrt(2.0);
+      double a0 = 1.0 + alpha;
+      b0_ = (1.0 - cos(w)) / 2.0 / a0;
+      b1_ = (1.0 - cos(w)) / a0;
+      b2_ = b0_;
+      a1_ = -2.0 * cos(w) / a0;
+      a2_ = (1.0 - alpha) / a0;
+    }
+
+    if ( config_.type == WrenchFilterConfig::MOVING_AVERAGE )
+      ring_.assign(config_.window * CHANNELS, 0.0);
+    else
+      ring_.clear();
+
+    reset();
+    return true;
+  }
+
+  void WrenchFilter::reset()
+  {
+    for (size_t c=0; c < CHANNELS; ++c)
+      bias_[c] = tare_sum_[c] = z1_[c] = z2_[c] = sum_[c] = 0.0;
+
+    tare_samples_ = tare_remaining_ = 0;
+    ring_index_ = ring_fill_ = 0;
+    ring_.assign(ring_.size(), 0.0);
+  }
+
+  bool WrenchFilter::process(Wrench& wrench)
+  {
+    double x[CHANNELS] = 
+        { wrench.fx_, wrench.fy_, wrench.fz_, wrench.tx_, wrench.ty_, wrench.tz_ };
+
+    bool saturated = false;
+    for (size_t c=0; c < CHANNELS; ++c)
+    {
+      double limit = (c < 3) ? config_.force_limit : config_.torque_limit;
+      saturated |= (limit > 0.0) & (fabs(x[c]) >= limit);
+    }
+
+    if ( tare_remaining_ > 0 )
+    {
+      for (size_t c=0; c < CHANNELS; ++c)
+        tare_sum_[c] += x[c];
+
+      if ( --tare_remaining_ == 0 )
+        for (size_t c=0; c < CHANNELS; ++c)
+          bias_[c] = tare_sum_[c] / tare_samples_;
+    }
+
+    for (size_t c=0; c < CHANNELS; ++c)
+      x[c] -= bias_[c];
+
+    if ( config_.type == WrenchFilterConfig::BIQUAD )
+    {
+      for (size_t c=0; c < CHANNELS; ++c)
+      {
+        double y = b0_ * x[c] + z1_[c];
+        z1_[c] = b1_ * x[c] - a1_ * y + z2_[c];
+        z2_[c] = b2_ * x[c] - a2_ * y;
+        x[c] = y;
+      }
+    }
+    else if ( config_.type == WrenchFilterConfig::MOVING_AVERAGE )
+    {
+      double* slot = &ring_[ring_index_ * CHANNELS];
+      for (size_t c=0; c < CHANNELS; ++c)
+      {
+        sum_[c] += x[c] - slot[c];
+        slot[c] = x[c];
+      }
+
+      if ( ring_fill_ < config_.window )
+        ring_fill_++;
+
+      // start over from the ring once per round, the running sums would
+      // pick up rounding errors forever
+      if ( ++ring_index_ == config_.window )
+      {
+        ring_index_ = 0;
+        for (size_t c=0; c < CHANNELS; ++c)
+          sum_[c] = 0.0;
+        for (size_t i=0; i < config_.window; ++i)
+          for (size_t c=0; c < CHANNELS; ++c)
+            sum_[c] += ring_[i * CHANNELS + c];
+      }
+
+      for (size_t c=0; c < CHANNELS; ++c)
+        x[c] = sum_[c] / ring_fill_;
+    }
+
+    wrench.fx_ = x[0];
+    wrench.fy_ = x[1];
+    wrench.fz_ = x[2];
+    wrench.tx_ = x[3];
+    wrench.ty_ = x[4];
+    wrench.tz_ = x[5];
+
+    return saturated;
+  }
+
+  void WrenchFilter::startTare(size_t samples)
+  {
+    for (size_t c=0; c < CHANNELS; ++c)
+      tare_sum_[c] = 0.0;
+
+    tare_samples_ = tare_remaining_ = samples;
+  }
+
+  Wrench WrenchFilter::bias() const
+  {
+    Wrench bias;
+    bias.fx_ = bias_[0];
+    bias.fy_ = bias_[1];
+    bias.fz_ = bias_[2];
+    bias.tx_ = bias_[3];
+    bias.ty_ = bias_[4];
+    bias.tz_ = bias_[5];
+    return bias;
+  }
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <iai_kms_40_driver/clock_estimator.hpp>
+#include <math.h>
+#include <stdlib.h>
+
+using iai_kms_40_driver::ClockEstimator;
+
+namespace
+{
+  // A sensor sending at 1 kHz with timestamps in microseconds of its own
+  // clock, which runs drift_ppm fast. Frames arrive after a transport delay
+  // of 1 to 1.2 ms.
+  class Sensor
+  {
+    public:
+      Sensor(double drift_ppm) :
+          drift_( drift_ppm * 1e-6 ), host_( 1000.0 ), sensor_start_( 123456789 ) {}
+
+      void next()
+      {
+        host_ += 0.001;
+      }
+
+      long timestamp() const
+      {
+        return sensor_start_ + (long) ((host_ - 1000.0) * 1e6 * (1.0 + drift_));
+      }
+
+      double receiveTime() const
+      {
+        return host_ + 0.001 + 0.0002 * rand() / RAND_MAX;
+      }
+
+      // host time of the frame plus the mean delay, where a mapped stamp
+      // should be
+      double expected() const
+      {
+        return host_ + 0.0011;
+      }
+
+      double drift_, host_;
+      long sensor_start_;
+  };
+}
+
+TEST(ClockEstimator, FollowsDriftingSensorClock)
+{
+  srand(42);
+  ClockEstimator clock;
+  Sensor sensor(50.0);
+
+  EXPECT_FALSE(clock.valid());
+  double max_error = 0.0;
+  for (int i=0; i < 60000; ++i)
+  {
+    sensor.next();
+    EXPECT_TRUE(clock.update(sensor.timestamp(), sensor.receiveTime()));
+    if (i >= 1000)
+      max_error = std::max(max_error, fabs(clock.toHost(sensor.timestamp()) - sensor.expected()));
+  }
+
+  // 60 s at 50 ppm is 3 ms of drift, the fit must not accumulate it
+  ASSERT_TRUE(clock.valid());
+  EXPECT_LT(max_error, 0.0001);
+  EXPECT_EQ(0u, clock.resets());
+}
+
+TEST(ClockEstimator, EstimatesTheDrift)
+{
+  srand(42);
+  // the jitter hides the drift within a short window
+  ClockEstimator clock(5000);
+  Sensor sensor(50.0);
+
+  for (int i=0; i < 10000; ++i)
+  {
+    sensor.next();
+    clock.update(sensor.timestamp(), sensor.receiveTime());
+  }
+
+  ASSERT_TRUE(clock.valid());
+  EXPECT_NEAR(1e-6 / (1.0 + 50e-6), clock.rate(), 1e-6 * 5e-6);
+}
+
+TEST(ClockEstimator, IgnoresDelayedReads)
+{
+  srand(42);
+  ClockEstimator clock;
+  Sensor sensor(50.0);
+
+  double max_error = 0.0;
+  for (int i=0; i < 10000; ++i)
+  {
+    sensor.next();
+    // every 100th read is held up by 20 ms
+    bool delayed = i >= 1000 && i % 100 == 0;
+    bool accepted = clock.update(sensor.timestamp(), sensor.receiveTime() + (delayed ? 0.02 : 0.0));
+    if (i >= 1000)
+    {
+      EXPECT_EQ(!delayed, accepted) << i;
+      max_error = std::max(max_error, fabs(clock.toHost(sensor.timestamp()) - sensor.expected()));
+    }
+  }
+
+  EXPECT_LT(max_error, 0.0001);
+  EXPECT_EQ(90u, clock.outliers());
+  EXPECT_EQ(0u, clock.resets());
+}
+
+TEST(ClockEstimator, StartsOverWhenTheSensorClockGoesBackwards)
+{
+  srand(42);
+  ClockEstimator clock;
+  Sensor sensor(0.0);
+
+  for (int i=0; i < 1000; ++i)
+  {
+    sensor.next();
+    clock.update(sensor.timestamp(), sensor.receiveTime());
+  }
+  ASSERT_TRUE(clock.valid());
+
+  // the sensor was restarted
+  sensor.sensor_start_ -= 5000000;
+  sensor.next();
+  EXPECT_TRUE(clock.update(sensor.timestamp(), sensor.receiveTime()));
+  EXPECT_EQ(1u, clock.resets());
+  EXPECT_FALSE(clock.valid());
+
+  for (int i=0; i < 1000; ++i)
+  {
+    sensor.next();
+    clock.update(sensor.timestamp(), sensor.receiveTime());
+  }
+  ASSERT_TRUE(clock.valid());
+  EXPECT_NEAR(sensor.expected(), clock.toHost(sensor.timestamp()), 0.0001);
+}
+
+TEST(ClockEstimator, StartsOverAfterARunOfOutliers)
+{
+  srand(42);
+  ClockEstimator clock(500);
+  Sensor sensor(0.0);
+
+  for (int i=0; i < 1000; ++i)
+  {
+    sensor.next();
+    clock.update(sensor.timestamp(), sensor.receiveTime());
+  }
+  ASSERT_TRUE(clock.valid());
+
+  // the host clock was set forward by a second
+  sensor.host_ += 1.0;
+  sensor.sensor_start_ -= 1000000;
+  int rejected = 0;
+  for (int i=0; i < 1000; ++i)
+  {
+    sensor.next();
+    if (!clock.update(sensor.timestamp(), sensor.receiveTime()))
+      rejected++;
+  }
+
+  // a quarter of the window is rejected before the estimator starts over
+  EXPECT_EQ(125, rejected);
+  EXPECT_EQ(1u, clock.resets());
+  ASSERT_TRUE(clock.valid());
+  EXPECT_NEAR(sensor.expected(), clock.toHost(sensor.timestamp()), 0.0001);
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
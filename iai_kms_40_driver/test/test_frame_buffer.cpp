@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <iai_kms_40_driver/frame_buffer.hpp>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+using iai_kms_40_driver::FrameBuffer;
+
+namespace
+{
+  std::string numberedFrames(int count)
+  {
+    std::string stream;
+    for (int i=0; i < count; ++i)
+    {
+      char frame[32];
+      snprintf(frame, sizeof(frame), "frame %03d\n", i);
+      stream += frame;
+    }
+    return stream;
+  }
+
+  // appends data in pieces of at most chunk bytes, taking the frames after
+  // every append as the driver does
+  std::vector<std::string> feed(FrameBuffer& buffer, const std::string& data, size_t chunk)
+  {
+    std::vector<std::string> frames;
+    std::string frame;
+    for (size_t offset=0; offset < data.size(); offset += chunk)
+    {
+      const char* read = data.data() + offset;
+      size_t read_size = std::min(chunk, data.size() - offset);
+      while (read_size > 0)
+      {
+        size_t appended = buffer.append(read, read_size);
+        read += appended;
+        read_size -= appended;
+        while (buffer.nextFrame(frame))
+          frames.push_back(frame);
+      }
+    }
+    return frames;
+  }
+}
+
+TEST(FrameBuffer, SplitFrames)
+{
+  std::string stream = numberedFrames(50);
+  for (size_t chunk=1; chunk <= 11; ++chunk)
+  {
+    FrameBuffer buffer(64);
+    std::vector<std::string> frames = feed(buffer, stream, chunk);
+    ASSERT_EQ(50u, frames.size()) << "chunk " << chunk;
+    EXPECT_EQ("frame 000", frames.front());
+    EXPECT_EQ("frame 049", frames.back());
+    EXPECT_EQ(0u, buffer.size());
+    EXPECT_EQ(0u, buffer.resyncs());
+  }
+}
+
+TEST(FrameBuffer, CoalescedFrames)
+{
+  FrameBuffer buffer(256);
+  std::string frame;
+
+  EXPECT_EQ(23u, buffer.append("one\r\ntwo\n\nthree\nfour\nfi"));
+  ASSERT_TRUE(buffer.nextFrame(frame));
+  EXPECT_EQ("one", frame);
+  ASSERT_TRUE(buffer.nextFrame(frame));
+  EXPECT_EQ("two", frame);
+  ASSERT_TRUE(buffer.nextFrame(frame));
+  EXPECT_EQ("three", frame);
+  ASSERT_TRUE(buffer.nextFrame(frame));
+  EXPECT_EQ("four", frame);
+  EXPECT_FALSE(buffer.nextFrame(frame));
+  EXPECT_EQ(2u, buffer.size());
+
+  buffer.append("ve\n");
+  ASSERT_TRUE(buffer.nextFrame(frame));
+  EXPECT_EQ("five", frame);
+  EXPECT_EQ(5u, buffer.frames());
+}
+
+TEST(FrameBuffer, WrappedFrameAsSpan)
+{
+  FrameBuffer buffer(16);
+  const char* frame;
+  size_t size;
+
+  buffer.append("0123456789\n");
+  ASSERT_TRUE(buffer.nextFrame(frame, size));
+  // starts at offset 11 of 16 and wraps around
+  buffer.append("abcdefghij\n");
+  ASSERT_TRUE(buffer.nextFrame(frame, size));
+  EXPECT_EQ("abcdefghij", std::string(frame, size));
+}
+
+TEST(FrameBuffer, OversizedFrameIsDropped)
+{
+  FrameBuffer buffer(16);
+  std::vector<std::string> frames =
+      feed(buffer, "first\n" + std::string(40, 'x') + "\nsecond\n", 7);
+
+  ASSERT_EQ(2u, frames.size());
+  EXPECT_EQ("first", frames[0]);
+  EXPECT_EQ("second", frames[1]);
+  EXPECT_EQ(1u, buffer.resyncs());
+}
+
+TEST(FrameBuffer, FullBufferKeepsCompleteFrames)
+{
+  FrameBuffer buffer(64);
+  std::string stream = numberedFrames(20);
+
+  // a read larger than the buffer must not cost the frames it holds, the
+  // rest is appended once they are taken
+  size_t appended = buffer.append(stream);
+  EXPECT_EQ(64u, appended);
+  EXPECT_EQ(0u, buffer.append(stream.substr(appended)));
+
+  std::vector<std::string> frames;
+  std::string frame;
+  while (buffer.nextFrame(frame))
+    frames.push_back(frame);
+  std::vector<std::string> rest = feed(buffer, stream.substr(appended), stream.size());
+  frames.insert(frames.end(), rest.begin(), rest.end());
+
+  ASSERT_EQ(20u, frames.size());
+  for (size_t i=0; i < frames.size(); ++i)
+    EXPECT_EQ(numberedFrames(20).substr(i * 10, 9), frames[i]);
+  EXPECT_EQ(0u, buffer.resyncs());
+  EXPECT_EQ(stream.size(), buffer.bytes());
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2015, Georg Bartels (georg.bartels@cs.uni-bremen.de)
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <gtest/gtest.h>
+#include <iai_kms_40_driver/parser.hpp>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+using iai_kms_40_driver::Wrench;
+using iai_kms_40_driver::parse_wrench;
+
+namespace
+{
+  // parses text as the only number of the string, the way the frames use it
+  bool parseDouble(const std::string& text, double& value)
+  {
+    const char* p = text.data();
+    return iai_kms_40_driver::detail::parse_double(p, text.data() + text.size(), value) &&
+        p == text.data() + text.size();
+  }
+
+  void expectSameAsStrtod(const std::string& text)
+  {
+    double value;
+    ASSERT_TRUE(parseDouble(text, value)) << text;
+    double expected = strtod(text.c_str(), 0);
+    EXPECT_EQ(0, memcmp(&value, &expected, sizeof(value)))
+        << text << ": " << value << " instead of " << expected;
+  }
+}
+
+TEST(Parser, RandomNumbersMatchStrtod)
+{
+  srand(42);
+  char text[64];
+  for (int i=0; i < 100000; ++i)
+  {
+    double value = (rand() - RAND_MAX / 2) / (double) rand() * pow(10.0, rand() % 12 - 6);
+    int precision = rand() % 18;
+    snprintf(text, sizeof(text), (i % 2) ? "%.*f" : "%.*e", precision, value);
+    expectSameAsStrtod(text);
+    if (HasFailure())
+      return;
+  }
+}
+
+TEST(Parser, EdgeCasesMatchStrtod)
+{
+  const char* cases[] = {
+      "0", "-0", "+0", "0.0", "-0.0", "1", "-1", "+1.5", "1.", ".5", "-.5",
+      "1e0", "1E5", "1e+5", "1e-5", "1.5e22", "1.5e-22", "1e23", "1e-23",
+      "9007199254740992", "9007199254740993", "18446744073709551615",
+      "1234567890123456789", "12345678901234567890", "0.1234567890123456789",
+      "4.9406564584124654e-324", "2.2250738585072014e-308", "1.7976931348623157e308",
+      "1e400", "1e-400", "123.456e-3", "0000000000000000000000001.5"};
+
+  for (size_t i=0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    expectSameAsStrtod(cases[i]);
+}
+
+TEST(Parser, RejectsMalformedNumbers)
+{
+  const char* cases[] = {"", "-", "+", ".", "-.", "e5", ".e5", "1e", "1e+", "--1"};
+  double value;
+
+  for (size_t i=0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+    EXPECT_FALSE(parseDouble(cases[i], value)) << cases[i];
+
+  // the slow path copies to the stack and gives up on absurd lengths
+  EXPECT_FALSE(parseDouble("0." + std::string(100, '1'), value));
+}
+
+TEST(Parser, Wrench)
+{
+  Wrench wrench;
+
+  ASSERT_TRUE(parse_wrench("F={1.5,-2,3e-1,0.004,-5.5,6},123456", wrench));
+  EXPECT_EQ(1.5, wrench.fx_);
+  EXPECT_EQ(-2.0, wrench.fy_);
+  EXPECT_EQ(0.3, wrench.fz_);
+  EXPECT_EQ(0.004, wrench.tx_);
+  EXPECT_EQ(-5.5, wrench.ty_);
+  EXPECT_EQ(6.0, wrench.tz_);
+  EXPECT_EQ(123456, wrench.timestamp_);
+
+  ASSERT_TRUE(parse_wrench(" F={ 1 , 2 , 3 , 4 , 5 , 6 }, -7 \r", wrench));
+  EXPECT_EQ(1.0, wrench.fx_);
+  EXPECT_EQ(6.0, wrench.tz_);
+  EXPECT_EQ(-7, wrench.timestamp_);
+}
+
+TEST(Parser, RejectedWrenchStaysUnchanged)
+{
+  const char* cases[] = {
+      "F={1,2,3,4,5},6", "F={1,2,3,4,5,6,7},8", "F={1,2,3,4,5,6}", "F={1,2,3,4,5,6},",
+      "F={1,2,3,4,5,6},7x", "F={1,2,3,4,5,6},7.5", "F=(1,2,3,4,5,6),7", "L1",
+      "F={1,2,3,4,5,6},99999999999999999999"};
+  Wrench wrench;
+  wrench.fx_ = 42.0;
+  wrench.timestamp_ = 42;
+
+  for (size_t i=0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+  {
+    EXPECT_FALSE(parse_wrench(cases[i], wrench)) << cases[i];
+    EXPECT_EQ(42.0, wrench.fx_);
+    EXPECT_EQ(42, wrench.timestamp_);
+  }
+
+  char timestamp[64];
+  snprintf(timestamp, sizeof(timestamp), "F={1,2,3,4,5,6},%ld", LONG_MAX);
+  ASSERT_TRUE(parse_wrench(timestamp, wrench));
+  EXPECT_EQ(LONG_MAX, wrench.timestamp_);
+  snprintf(timestamp, sizeof(timestamp), "F={1,2,3,4,5,6},%ld", LONG_MIN);
+  ASSERT_TRUE(parse_wrench(timestamp, wrench));
+  EXPECT_EQ(LONG_MIN, wrench.timestamp_);
+}
+
+int main(int argc, char **argv)
+{
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
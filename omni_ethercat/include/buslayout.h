@@ -0,0 +1,79 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Bus layout: which EtherCAT master (one per NIC) and which domain carries
+ * each drive. Every domain is exchanged by its own realtime thread at its
+ * own rate, so e.g. the wheels can run at 2 kHz and the torso at 250 Hz.
+ */
+
+#ifndef BUSLAYOUT_H
+#define BUSLAYOUT_H
+
+#include <stdint.h>
+
+#define OMNI_NUM_DRIVES  5  // same as NUM_DRIVES in realtime.h
+#define OMNI_MAX_MASTERS 2
+#define OMNI_MAX_DOMAINS 4
+#define OMNI_MAX_PATH    256
+
+typedef struct omni_domain_layout {
+  unsigned int master;      // index passed to ecrt_request_master()
+  unsigned int frequency;   // Hz
+} omni_domain_layout_t;
+
+typedef struct omni_drive_layout {
+  uint16_t alias;           // slave alias and position on its master
+  uint16_t position;
+  uint32_t vendor_id;       // expected identity of the slave
+  uint32_t product_code;
+  uint32_t serial_number;   // filled in by the discovery, 0 if unknown
+  int domain;               // index into omni_layout_t.domains
+} omni_drive_layout_t;
+
+typedef struct omni_layout {
+  int num_domains;
+  omni_domain_layout_t domains[OMNI_MAX_DOMAINS];
+  omni_drive_layout_t drives[OMNI_NUM_DRIVES];
+  int discover;             // scan the bus instead of using alias/position/identity above
+  char topology_cache[OMNI_MAX_PATH];  // discovery result, empty for none
+  int distributed_clocks;   // stamp the inputs with the reference clock of each master
+} omni_layout_t;
+
+/* Timing and working counter of one domain */
+typedef struct omni_domain_stats {
+  unsigned int master;
+  unsigned int frequency;
+  int working_counter;
+  int working_counter_state;  // EC_WC_ZERO, EC_WC_INCOMPLETE or EC_WC_COMPLETE
+  uint32_t cycles;
+  uint32_t misses;            // periods which were overrun
+  int32_t jitter_ns;          // wake-up latency of the last cycle
+  int32_t max_jitter_ns;
+  int32_t exec_ns;            // time spent in the last cycle
+  int32_t max_exec_ns;
+  int dc;                     // inputs are stamped through the distributed clock
+  int32_t dc_error_ns;        // host send time minus filtered estimate, last cycle
+  int32_t dc_max_error_ns;
+  uint32_t dc_resets;
+} omni_domain_stats_t;
+
+/* One master, one domain at 1 kHz, Elmo Gold drives 0-4 at positions 0-4,
+ * no discovery */
+void omni_default_layout(omni_layout_t *layout);
+
+#endif // BUSLAYOUT_H
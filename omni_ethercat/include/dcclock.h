@@ -0,0 +1,48 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Relates the distributed clock of a master to the host clock. Every cycle
+ * the reference clock time of the received frame is paired with the host
+ * time at which that frame was sent. An alpha-beta filter tracks offset and
+ * drift, so the send jitter of the host does not show up in the stamps.
+ */
+
+#ifndef DCCLOCK_H
+#define DCCLOCK_H
+
+#include <stdint.h>
+
+typedef struct dc_clock {
+  int valid;
+  uint64_t dc_ns;           // last reference clock time, extended to 64 bit
+  int64_t base_ns;          // host time - dc time = base_ns + offset_ns,
+  double offset_ns;         // split to keep the filter precise
+  double drift;             // ns of offset per ns of dc time
+  int32_t error_ns;         // last measurement minus prediction
+  int32_t max_error_ns;
+  uint32_t resets;          // times the filter had to start over
+} dc_clock_t;
+
+void dc_clock_init(dc_clock_t *c);
+
+/* ref_time: lower 32 bit of the reference clock as read from the frame,
+ * host_ns: host time when the frame was sent. Returns the host time at
+ * which the reference clock sampled the frame. */
+int64_t dc_clock_update(dc_clock_t *c, uint32_t ref_time, int64_t host_ns);
+
+#endif // DCCLOCK_H
@@ -0,0 +1,46 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Slave discovery. The slaves on each master are enumerated with
+ * ecrt_master_get_slave() and matched against a table of known drive
+ * profiles, the drives are assigned in bus order. The result is cached in a
+ * file; on the next start only the cached slaves are checked, the full scan
+ * is repeated if any of them changed.
+ */
+
+#ifndef DISCOVERY_H
+#define DISCOVERY_H
+
+#include <ecrt.h>
+
+#include "buslayout.h"
+
+/* A slave we know how to drive */
+typedef struct slave_profile {
+  uint32_t vendor_id;
+  uint32_t product_code;
+  const char *name;
+} slave_profile_t;
+
+const slave_profile_t *find_slave_profile(uint32_t vendor_id, uint32_t product_code);
+
+/* Fills in position, vendor and product of every drive in the layout.
+ * drive_master[i] is the master of drive i. Returns 0 on success. */
+int discover_drives(omni_layout_t *layout, ec_master_t *const *drive_master);
+
+#endif // DISCOVERY_H
@@ -0,0 +1,64 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Health statistics of a drive, kept by the realtime thread in fixed
+ * memory. Time is counted per CiA-402 state, torque and following error
+ * are averaged over the last STATS_TIME_CONSTANT seconds.
+ */
+
+#ifndef DRIVESTATS_H
+#define DRIVESTATS_H
+
+#include <stdint.h>
+
+#define CIA402_NOT_READY            0
+#define CIA402_SWITCH_ON_DISABLED   1
+#define CIA402_READY_TO_SWITCH_ON   2
+#define CIA402_SWITCHED_ON          3
+#define CIA402_OPERATION_ENABLED    4
+#define CIA402_QUICK_STOP_ACTIVE    5
+#define CIA402_FAULT_REACTION       6
+#define CIA402_FAULT                7
+#define CIA402_NUM_STATES           8
+
+#define STATS_TIME_CONSTANT 10.0    // s
+
+typedef struct drive_stats {
+  uint32_t faults;                        // times the drive went into fault
+  uint64_t state_ns[CIA402_NUM_STATES];   // time spent in each state
+  uint32_t bit_flips[16];                 // changes of each statusword bit
+  double torque_ms;                       // mean square, torque in per mille of rated torque
+  int16_t torque_peak;
+  double following_error_ms;              // ticks/s for velocity, ticks for position mode,
+  int32_t following_error_peak;           // only counted while operation is enabled
+
+  uint16_t statusword;                    // as of the last update
+  int state;
+  int valid;
+} drive_stats_t;
+
+int cia402_state(uint16_t statusword);
+const char *cia402_state_name(int state);
+
+void drive_stats_init(drive_stats_t *s);
+
+/* Realtime safe, once per cycle of period_ns */
+void drive_stats_update(drive_stats_t *s, uint16_t statusword, int16_t torque,
+                        int32_t following_error, int32_t period_ns);
+
+#endif // DRIVESTATS_H
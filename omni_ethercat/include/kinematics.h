@@ -0,0 +1,60 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Kinematic limits of the base as omnidrive_drive() applies them, for one
+ * twist or for many at once. Planners link this on its own: it does not
+ * touch the bus, the limits are passed in. Batches are structure of arrays
+ * so the loop vectorizes; on x86-64 an AVX2 clone is picked at load time
+ * when the CPU has it.
+ */
+
+#ifndef KINEMATICS_H
+#define KINEMATICS_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* half of wheel base plus half of track width, m */
+#define OMNI_WHEEL_ALPHA (0.39225 + 0.303495)
+
+typedef struct omni_drive_limits {
+  double wheel_limit;       // m/s, a single wheel may drive this fast
+  double cart_limit;        // m/s, any point on the robot may move this fast
+  double limit_radius;      // m, (maximum) radius of the robot for cart_limit
+  double max_wheel_speed;   // m/s, the realtime thread clamps each wheel to this
+} omni_drive_limits_t;
+
+/* Factor omnidrive_drive() scales the twist with, 1 if it is within the limits */
+double omni_limit_factor(const omni_drive_limits_t *l, double x, double y, double a);
+
+/* For n twists (x[i], y[i], a[i]): scale[i] as omni_limit_factor() and the
+ * wheel speeds w0..w3[i] in m/s which would reach the drives, in the order
+ * of jac_forward(). A twist passes unchanged if scale[i] is 1 and no wheel
+ * reached max_wheel_speed. The arrays must not overlap. */
+void omni_feasibility_batch(const omni_drive_limits_t *l, size_t n,
+                            const double *x, const double *y, const double *a,
+                            double *scale, double *w0, double *w1, double *w2, double *w3);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // KINEMATICS_H
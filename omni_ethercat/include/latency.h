@@ -0,0 +1,48 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Trace points along the command path. A velocity command gets a sequence
+ * number when it arrives; omni_write_data() and the realtime thread mark the
+ * time they first handle it. Every point keeps the last LATENCY_SLOTS marks,
+ * a non-realtime reader looks them up and builds the statistics. Marking
+ * costs a clock read and two stores, and nothing while tracing is off.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+#define LATENCY_CMD_ARRIVED 0   // cmd_vel callback
+#define LATENCY_CMD_WRITTEN 1   // handed to the realtime threads by omni_write_data()
+#define LATENCY_CMD_ON_BUS  2   // target velocities written to the process data
+#define LATENCY_NUM_POINTS  3
+
+#define LATENCY_SLOTS 64        // power of two
+
+void latency_enable(int on);
+int latency_enabled(void);
+
+/* Realtime safe, one writer per point */
+void latency_mark(int point, uint32_t seq);
+
+/* CLOCK_MONOTONIC in ns at which seq passed point. Returns 0 if it did not
+ * (yet), or if the mark was already overwritten. */
+int latency_lookup(int point, uint32_t seq, int64_t *t_ns);
+
+#endif // LATENCY_H
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2009 by Ingo Kresse <kresse@in.tum.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <deque>
+#include <string>
+
+// Turns the trace points of latency.h into latency histograms. Only used
+// from the I/O thread: commands are tagged when they arrive, update()
+// picks up the marks the control and realtime threads left for them.
+// Every sample can also go to a CSV file for offline analysis.
+class LatencyTracer
+{
+public:
+  enum Path { CMD_TO_WRITE, WRITE_TO_BUS, CMD_TO_BUS, ENCODER_TO_TF, NUM_PATHS };
+  enum { NUM_BINS = 24 };  // bin 0 is below 1 us, bin k up to 2^k us
+
+  struct Histogram
+  {
+    unsigned long count;
+    double min, max, sum;        // s
+    unsigned long bins[NUM_BINS];
+
+    double mean() const { return count ? sum / count : 0.0; }
+    double percentile(double p) const;  // upper bin edge, s
+  };
+
+  LatencyTracer();
+  ~LatencyTracer();
+
+  // Turns on the trace points. csv is a file for every sample, empty for none.
+  bool start(const std::string& csv);
+  bool enabled() const { return enabled_; }
+
+  // Tag for a command which just arrived, 0 while tracing is off
+  uint32_t commandArrived();
+
+  // Resolves the commands which reached the bus since the last call, now in s
+  void update(double now);
+
+  void add(Path path, uint32_t seq, double now, double latency);
+
+  static const char* name(int path);
+  const Histogram& histogram(int path) const { return hist_[path]; }
+  unsigned long dropped() const { return dropped_; }  // commands replaced before they were driven
+
+private:
+  bool enabled_;
+  uint32_t seq_;
+  std::deque<uint32_t> pending_;
+  Histogram hist_[NUM_PATHS];
+  unsigned long dropped_;
+  FILE* csv_;
+};
+
+#endif // LATENCY_TRACER_H
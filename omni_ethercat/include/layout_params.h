@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2009 by Ingo Kresse <kresse@in.tum.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef LAYOUT_PARAMS_H
+#define LAYOUT_PARAMS_H
+
+#include <ros/ros.h>
+
+extern "C" {
+#include "buslayout.h"
+}
+
+// Bus layout from the parameters of n: wheel_master, wheel_frequency,
+// torso_master, torso_frequency, torso_position, discover_drives,
+// topology_cache and distributed_clocks. Shared by the nodes which own
+// the bus, so they read the same configuration.
+void loadBusLayout(const ros::NodeHandle& n, omni_layout_t* layout);
+
+#endif // LAYOUT_PARAMS_H
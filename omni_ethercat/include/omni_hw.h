@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2009 by Ingo Kresse <kresse@in.tum.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef OMNI_HW_H
+#define OMNI_HW_H
+
+#include <list>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+#include <hardware_interface/robot_hw.h>
+#include <hardware_interface/joint_state_interface.h>
+#include <hardware_interface/joint_command_interface.h>
+
+// The base and the torso as ros_control joints: four wheel velocity joints
+// (rad, rad/s) and the torso position joint (m). read() and write() go
+// straight to omnilib, so a controller manager updated right after read()
+// commands the drives with the data of the same bus cycle. Call read(),
+// the controller manager and write() from one thread. Wheels which no
+// running controller claims are commanded to stand still.
+class OmniHW : public hardware_interface::RobotHW
+{
+public:
+  // wheel_joints in drive order: front left, back left, back right, front right
+  OmniHW(const std::vector<std::string>& wheel_joints, const std::string& torso_joint,
+         double wheel_radius);
+
+  void read(const ros::Time& time, const ros::Duration& period);
+  void write(const ros::Time& time, const ros::Duration& period);
+
+  // called by the controller manager in its update(), i.e. in our thread
+  void doSwitch(const std::list<hardware_interface::ControllerInfo>& start_list,
+                const std::list<hardware_interface::ControllerInfo>& stop_list);
+
+  // when the bus sampled the wheels of the last read(), falls back to now
+  ros::Time stamp() const { return stamp_; }
+
+private:
+  hardware_interface::JointStateInterface state_interface_;
+  hardware_interface::VelocityJointInterface velocity_interface_;
+  hardware_interface::PositionJointInterface position_interface_;
+
+  double wheel_radius_;
+  std::vector<std::string> wheel_joints_;
+  std::set<std::string> claimed_wheels_;  // joints of running controllers
+  ros::Time stamp_;
+
+  // wheels 0-3 and the torso, as in omnidrive_joint_state()
+  double position_[5], velocity_[5], effort_[5], command_[5];
+  double torso_sent_;  // last torso set-point passed to omnilib
+  bool initialized_;
+};
+
+#endif // OMNI_HW_H
@@ -0,0 +1,73 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Limits and gains which can be changed at runtime. Every reader works on
+ * its own copy of the current block, taken under a sequence lock: neither
+ * readers nor writers ever wait for each other, and an update never
+ * changes a block somebody is still using. An update is validated by the
+ * caller's thread.
+ */
+
+#ifndef OMNI_PARAMS_H
+#define OMNI_PARAMS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct omni_params {
+  uint32_t version;                     // incremented by every update
+
+  /* base controller of the node, cartesian */
+  double speed;                         // m/s or rad/s
+  double acceleration;                  // m/s^2 or rad/s^2
+  double radius;                        // m, scales the rotational limits
+  double watchdog_period;               // s without a command until the base stops
+
+  /* omnidrive_drive() and odometry */
+  double wheel_limit;                   // m/s, a single wheel may drive this fast
+  double cart_limit;                    // m/s, any point on the robot may move this fast
+  double limit_radius;                  // m, (maximum) radius of the robot for cart_limit
+  double odometry_correction;
+  double slip_warn;                     // m/s of wheel motion no rigid base motion explains
+  double slip_error;
+  double slip_weight;                   // odometry weight of a slipping wheel, 1 to keep it
+
+  /* realtime thread, wheel drives */
+  int32_t max_tick_speed;               // ticks/s
+  uint32_t wheel_profile_acceleration;  // ticks/s^2
+  uint32_t wheel_profile_deceleration;
+} omni_params_t;
+
+void omni_params_defaults(omni_params_t *p);
+
+/* Returns non-zero and a reason if p can not be used */
+int omni_params_invalid(const omni_params_t *p, char *reason, size_t size);
+
+/* Validates and publishes p. Returns 0 on success, -1 if p is invalid (the
+ * current block stays). */
+int omni_params_set(const omni_params_t *p, char *reason, size_t size);
+
+/* Copies the current block to p, retrying until no update interferes */
+void omni_params_get(omni_params_t *p);
+
+/* Realtime safe refresh of a copy taken by omni_params_get(): gives up
+ * after a few tries if an update keeps interfering and returns -1, p then
+ * stays as it was. Returns 0 if p holds the current block. */
+int omni_params_read(omni_params_t *p);
+
+#endif // OMNI_PARAMS_H
@@ -22,6 +22,11 @@
 #ifndef OMNIDRIVE_H 
 #define OMNIDRIVE_H 
 
+#include "torso.h"
+#include "buslayout.h"
+#include "drivestats.h"
+#include "kinematics.h"
+
 #define NUM_DRIVES_ 5
 #define TORSO_DRIVE_SEQ 4 // Drives 0-3 are the wheels, 4 is the torso
 
@@ -34,11 +39,34 @@ typedef struct {
   int master_slaves_responding;
   int working_counter;
   int working_counter_state;
+  int drive_recovering[NUM_DRIVES_];
+  int recoveries;
+  double last_recovery_time;
+  uint32_t misses;
+  int num_domains;
+  omni_domain_stats_t domain[OMNI_MAX_DOMAINS];
 } commstatus_t;
 
-int omnidrive_init(void);
-int omnidrive_drive(double x, double y, double a, double torso_pos);
+/* Four wheels measure three degrees of freedom. Whatever wheel motion a
+   rigid motion of the base can not explain shows up as slip. With only one
+   redundant measurement all four wheels see the same residual, so the
+   torque share of each wheel tells which one has lost traction. */
+typedef struct {
+  double residual;          // m/s, filtered rms misfit over the wheels
+  double wheel[4];          // m/s, signed misfit of each wheel, last cycle
+  double traction[4];       // |torque| of a wheel relative to the mean of all
+  int weighted_wheel;       // down-weighted in the odometry, -1 for none
+  double max_residual;
+  unsigned long slip_cycles;  // cycles above slip_warn
+} slipstatus_t;
+
+int omnidrive_init(const omni_layout_t *layout);  // NULL for the default bus layout
+int omnidrive_drive(double x, double y, double a);
+int omnidrive_drive_wheels(const double *speeds);  // 4 wheel surface speeds in m/s
+void omnidrive_drive_limits(omni_drive_limits_t *limits);  // the ones omnidrive_drive() applies now
+void omnidrive_trace_command(uint32_t seq);  // tags the next omnidrive_drive() calls, see latency.h
 void omnidrive_set_correction(double drift);
+// odometry, status, commstatus and torso_status share their state, call them from one thread
 int omnidrive_odometry(double *x, double *y, double *a, double *torso_pos);
 int omnidrive_shutdown(void);
 
@@ -46,9 +74,28 @@ void omnidrive_status(char *drive0, char *drive1, char *drive2, char *drive3, ch
 
 commstatus_t omnidrive_commstatus();
 
-void omnidrive_poweron();
+void omnidrive_poweron();   // non-blocking, see omnidrive_powered()
 void omnidrive_poweroff();
-void omnidrive_recover();
+int omnidrive_powered();   // all drives in 'operation enabled'
+
+// torso axis, positions in m, times in s from now. configure returns -1 and
+// keeps the current settings if max_velocity or acceleration are not positive
+int omnidrive_torso_configure(int mode, double min_position, double max_position,
+                              double max_velocity, double acceleration);
+int omnidrive_torso_move(const double *times, const double *positions, int num_points);
+void omnidrive_torso_home();
+torsostatus_t omnidrive_torso_status();  // updated by omnidrive_odometry
+slipstatus_t omnidrive_slip_status();    // updated by omnidrive_odometry
+void omnidrive_drive_stats(drive_stats_t *stats);  // NUM_DRIVES_ entries, from any thread
+
+// when the bus sampled the data of the last omnidrive_odometry(),
+// CLOCK_REALTIME in s, 0 before the first cycle
+double omnidrive_odometry_stamp();
+double omnidrive_torso_stamp();
+
+// drives as joints, as of the last omnidrive_odometry(): wheels in m and m/s
+// along their surface, the torso in m and m/s, torque relative to rated torque
+void omnidrive_joint_state(double *position, double *velocity, double *torque);  // NUM_DRIVES_ each
 
 //void omnidrive_get_motor_currents(double *currents);
 
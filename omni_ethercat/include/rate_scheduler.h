@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2009 by Ingo Kresse <kresse@in.tum.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RATE_SCHEDULER_H
+#define RATE_SCHEDULER_H
+
+#include <string>
+#include <vector>
+
+// Decimates a fixed-rate loop into outputs with arbitrary rates. Each output
+// has a phase accumulator, so 60 Hz on a 250 Hz loop fires 60 times a second
+// on average instead of every 4th cycle. Outputs start at different cycles
+// and at most as many fire in one cycle as their total rate requires; an
+// output which has to wait fires in the next cycle, keeping its average rate.
+class RateScheduler
+{
+public:
+  explicit RateScheduler(double loop_frequency);
+
+  // Phase is the fraction of the output's period before it first fires,
+  // a negative phase spreads it against the outputs added before.
+  // Rates above the loop frequency fire every cycle, see saturated().
+  int add(const std::string& name, double frequency, double phase = -1.0);
+
+  // Call once per loop cycle, now in seconds, then ask due().
+  void tick(double now);
+  bool due(int id) const { return outputs_[id].due; }
+
+  int size() const { return outputs_.size(); }
+  const std::string& name(int id) const { return outputs_[id].name; }
+  double requested(int id) const { return outputs_[id].frequency; }
+  bool saturated(int id) const { return outputs_[id].step >= 1.0; }
+  double achieved(int id) const { return outputs_[id].achieved; }  // Hz, over the last second
+  unsigned int deferred(int id) const { return outputs_[id].deferred; }  // times it had to wait
+
+private:
+  struct Output
+  {
+    std::string name;
+    double frequency, step, accumulator;
+    bool due;
+    unsigned int count, deferred;
+    double achieved;
+  };
+
+  double loop_frequency_;
+  std::vector<Output> outputs_;
+  unsigned int max_per_cycle_;
+  double window_start_;
+};
+
+#endif // RATE_SCHEDULER_H
@@ -3,34 +3,67 @@
 #define REALTIME_H
 
 /* If you change the interface in any way, increase OMNICOM_MAGIC_VERSION */
-#define OMNICOM_MAGIC_VERSION 1003
+#define OMNICOM_MAGIC_VERSION 1010
 #define NUM_DRIVES 5
 
 #include <ecrt.h>  //part of igh's ethercat master
 
-/* Data we read from the EtherCAT slaves */
-typedef struct omniread {  
-	int16_t  magic_version; // magic number to prevent version clashes
-	uint32_t pkg_count;     // Set in omnidrive kernel module
+#include "torso.h"
+#include "buslayout.h"
+#include "drivestats.h"
 
-    int32_t position[NUM_DRIVES];
-    uint32_t digital_inputs[NUM_DRIVES];
-    int32_t actual_velocity[NUM_DRIVES];
-    uint16_t status[NUM_DRIVES];
-    int8_t mode_of_operation_display[NUM_DRIVES];
-    int16_t actual_torque[NUM_DRIVES];
+#if NUM_DRIVES != OMNI_NUM_DRIVES
+#error "NUM_DRIVES does not match the bus layout"
+#endif
 
+#define OMNI_CACHELINE 64
+
+/* Data we read from the EtherCAT slaves, split by how often it changes.
+ * Each section is published under its own sequence lock, readers copy only
+ * the section they need and never block the realtime threads. */
+
+/* Process data, rewritten every cycle */
+typedef struct omni_hot {
+	uint32_t pkg_count;                     // cycles of all domains
+
+	uint16_t status[NUM_DRIVES];
+	int8_t   mode_of_operation_display[NUM_DRIVES];
+	uint8_t  drive_recovering[NUM_DRIVES];  // drive lost or being re-enabled, its data is not valid
+	int32_t  position[NUM_DRIVES];
+	int32_t  actual_velocity[NUM_DRIVES];
+	int16_t  actual_torque[NUM_DRIVES];
+	uint32_t digital_inputs[NUM_DRIVES];
+	uint32_t recovery_count[NUM_DRIVES];    // incremented every time a lost drive is enabled again
+	int64_t  stamp_ns[NUM_DRIVES];          // CLOCK_REALTIME when the inputs were sampled, 0 if never
+
+	torsostatus_t torso;
+} __attribute__((aligned(OMNI_CACHELINE))) omni_hot_t;
+
+/* Bus state, only republished when it changes. The cycle statistics in
+ * domain[] are refreshed at OMNI_STATS_FREQUENCY. */
+#define OMNI_STATS_FREQUENCY 10
+
+typedef struct omni_cold {
+	int16_t  magic_version;        // magic number to prevent version clashes
 
 	// ethercat states
-    int slave_state[NUM_DRIVES];
-    int slave_online[NUM_DRIVES];
-    int slave_operational[NUM_DRIVES];
-	int master_link;
+	uint8_t slave_state[NUM_DRIVES];
+	uint8_t slave_online[NUM_DRIVES];
+	uint8_t slave_operational[NUM_DRIVES];
+	int master_link;               // all masters, link up only if every link is up
 	int master_al_states;
 	int master_slaves_responding;
-	int working_counter;
-	int working_counter_state;
-} omniread_t;
+	int working_counter;           // sum over all domains
+	int working_counter_state;     // worst domain
+	uint32_t misses;               // sum over all domains
+
+	int num_domains;
+	omni_domain_stats_t domain[OMNI_MAX_DOMAINS];
+
+	// hot bus recovery
+	int recoveries;                // total number of completed recoveries
+	double last_recovery_time;     // seconds from loss detection to operation enabled
+} __attribute__((aligned(OMNI_CACHELINE))) omni_cold_t;
 
 /* Data we write to the EtherCAT slaves */
 typedef struct omniwrite { 
@@ -44,19 +77,28 @@ typedef struct omniwrite {
     uint32_t profile_velocity[NUM_DRIVES];
     uint32_t profile_acceleration[NUM_DRIVES];
     uint32_t profile_deceleration[NUM_DRIVES];
-    uint8_t send_new_torso_pos;
-
+    uint32_t trace_seq;             // command being driven, see latency.h
 } omniwrite_t;
 
+/* Requested power state of all drives */
+#define OMNI_POWER_OFF 0
+#define OMNI_POWER_ON  1
+
 // realtime interface
 
 void omni_write_data(struct omniwrite data);
-struct omniread omni_read_data();
+void omni_request_power(int power);  // does not block, sequenced by the realtime thread
+void omni_write_torso(const torsocmd_t *cmd);
+void omni_read_hot(omni_hot_t *hot);
+uint32_t omni_read_cold(omni_cold_t *cold);  // returns the version of the copy
+uint32_t omni_cold_version();                // cheap, changes whenever the cold section does
+void omni_read_drive_stats(drive_stats_t *stats);  // NUM_DRIVES entries, refreshed at OMNI_STATS_FREQUENCY
 
-int start_omni_realtime(int max_vel);
+int start_omni_realtime(const omni_layout_t *layout);  // NULL for the default layout
 void stop_omni_realtime();
 
-ec_master_t* get_master();
+ec_master_t* get_master();  // master 0
+ec_master_t* get_drive_master(int drive, uint16_t *position);
 
 
 #endif // REALTIME_H
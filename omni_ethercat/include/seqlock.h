@@ -0,0 +1,86 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Sequence lock for a single writer and any number of readers. Neither side
+ * ever blocks: the writer bumps the sequence around its update, a reader
+ * copies the data and retries if the sequence was odd or changed meanwhile.
+ * The protected data must be plain old data.
+ */
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+#include <string.h>
+
+typedef struct seqlock {
+  uint32_t seq;   // odd while a write is in progress
+} seqlock_t;
+
+#define SEQLOCK_INITIALIZER {0}
+
+static inline void seqlock_write_begin(seqlock_t *l)
+{
+  __atomic_store_n(&l->seq, l->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlock_write_end(seqlock_t *l)
+{
+  __atomic_store_n(&l->seq, l->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t seqlock_read_begin(const seqlock_t *l)
+{
+  return __atomic_load_n(&l->seq, __ATOMIC_ACQUIRE);
+}
+
+/* non-zero if what was read since seqlock_read_begin() is consistent */
+static inline int seqlock_read_valid(const seqlock_t *l, uint32_t start)
+{
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  return !(start & 1) && __atomic_load_n(&l->seq, __ATOMIC_RELAXED) == start;
+}
+
+/* Copies a snapshot of src, giving up after 'tries' attempts. A realtime
+ * reader should pass a small number and keep its old copy on failure, other
+ * readers may pass 0 to retry until they succeed. Returns non-zero on
+ * success, dst is undefined otherwise. */
+static inline int seqlock_read(const seqlock_t *l, void *dst, const void *src, size_t size,
+                               int tries)
+{
+  int i;
+
+  for (i = 0; tries <= 0 || i < tries; i++) {
+    uint32_t start = seqlock_read_begin(l);
+    memcpy(dst, src, size);
+    if (seqlock_read_valid(l, start))
+      return 1;
+  }
+
+  return 0;
+}
+
+static inline void seqlock_write(seqlock_t *l, void *dst, const void *src, size_t size)
+{
+  seqlock_write_begin(l);
+  memcpy(dst, src, size);
+  seqlock_write_end(l);
+}
+
+#endif // SEQLOCK_H
@@ -0,0 +1,106 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/* Torso axis controller. It runs inside the realtime thread, one call of
+ * torso_update() per bus cycle, and never blocks: homing, mode changes and
+ * motion are all done through the process data of the torso drive.
+ */
+
+#ifndef TORSO_H
+#define TORSO_H
+
+#include <stdint.h>
+
+#define TORSO_MAX_TRAJ_POINTS 64
+
+/* Motion modes */
+#define TORSO_MODE_PROFILE 0  // profile position, the drive plans between set-points
+#define TORSO_MODE_CSP     1  // cyclic synchronous position, we stream a set-point every cycle
+
+/* Controller states */
+#define TORSO_STATE_DISABLED      0  // drive not in 'operation enabled'
+#define TORSO_STATE_IDLE          1  // holding the last set-point
+#define TORSO_STATE_HOMING        2
+#define TORSO_STATE_HOMING_FAILED 3  // idle, but the last homing did not finish
+#define TORSO_STATE_MOVING        4
+
+typedef struct torso_limits {
+  int32_t min_position;     // ticks, no position limit if min_position >= max_position
+  int32_t max_position;
+  uint32_t max_velocity;    // ticks/s, profile velocity and CSP set-point rate limit
+  uint32_t acceleration;    // ticks/s^2, in CSP the set-point's as well
+  uint32_t deceleration;
+} torso_limits_t;
+
+typedef struct torso_trajectory {
+  uint32_t seq;             // change this to start executing the trajectory
+  int num_points;
+  int64_t time_from_start[TORSO_MAX_TRAJ_POINTS];  // ns, ascending
+  int32_t position[TORSO_MAX_TRAJ_POINTS];         // ticks
+} torso_trajectory_t;
+
+typedef struct torsocmd {
+  int mode;                 // TORSO_MODE_*, switched when idle
+  torso_limits_t limits;
+  uint32_t home_seq;        // change this to start homing
+  torso_trajectory_t trajectory;
+} torsocmd_t;
+
+typedef struct torsostatus {
+  int state;                // TORSO_STATE_*
+  int mode;                 // active TORSO_MODE_*
+  int homed;
+  int32_t position;         // actual position, ticks
+  int32_t velocity;         // actual velocity, ticks/s
+  int32_t setpoint;         // last set-point sent to the drive
+  int32_t goal;             // final point of the current trajectory
+  double progress;          // 0..1 of the current trajectory
+  uint32_t trajectory_seq;  // trajectory being executed or last finished
+} torsostatus_t;
+
+/* What the controller wants written to the torso drive */
+typedef struct torso_output {
+  uint16_t controlword_bits;  // or'ed onto 0x0f while the drive is enabled
+  int8_t mode_of_operation;
+  int32_t target_position;
+  uint32_t profile_velocity;
+  uint32_t profile_acceleration;
+  uint32_t profile_deceleration;
+} torso_output_t;
+
+typedef struct torso_ctx {
+  int state, mode, homed;
+  uint32_t home_seq, trajectory_seq;
+  int64_t time_ns;          // since start of homing / trajectory
+  int point;                // next trajectory point
+  int setpoint_state;       // profile mode set-point handshake
+  int halted;               // profile motion stopped by an empty trajectory
+  int stopping;             // CSP motion braking after an empty trajectory
+  int32_t start_position, setpoint, goal;
+  double csp_position;      // ticks, the set-point before rounding
+  double csp_velocity;      // ticks/s of the set-point
+} torso_ctx_t;
+
+void torso_init(torso_ctx_t *c);
+
+void torso_update(torso_ctx_t *c, const torsocmd_t *cmd, int enabled,
+                  uint16_t statusword, int8_t mode_display,
+                  int32_t position, int32_t velocity, int64_t dt_ns,
+                  torso_output_t *out, torsostatus_t *status);
+
+#endif // TORSO_H
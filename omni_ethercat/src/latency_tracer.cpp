@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2009 by Ingo Kresse <kresse@in.tum.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+
+#include "latency_tracer.h"
+
+extern "C" {
+#include "latency.h"
+}
+
+// a command which has not reached the bus by then never will
+const double pending_timeout = 1.0;
+
+
+double LatencyTracer::Histogram::percentile(double p) const
+{
+  unsigned long n = 0;
+
+  for(int i=0; i < NUM_BINS; i++) {
+    n += bins[i];
+    if(n >= p * count)
+      return std::min(ldexp(1e-6, i), max);
+  }
+  return max;
+}
+
+LatencyTracer::LatencyTracer() : enabled_(false), seq_(0), dropped_(0), csv_(0)
+{
+  memset(hist_, 0, sizeof(hist_));
+}
+
+LatencyTracer::~LatencyTracer()
+{
+  latency_enable(0);
+  if(csv_)
+    fclose(csv_);
+}
+
+bool LatencyTracer::start(const std::string& csv)
+{
+  if(!csv.empty()) {
+    csv_ = fopen(csv.c_str(), "w");
+    if(!csv_)
+      return false;
+    fprintf(csv_, "path,seq,time,latency_us\n");
+  }
+
+  enabled_ = true;
+  latency_enable(1);
+  return true;
+}
+
+uint32_t LatencyTracer::commandArrived()
+{
+  if(!enabled_)
+    return 0;
+
+  // 0 means untagged
+  if(++seq_ == 0)
+    ++seq_;
+
+  latency_mark(LATENCY_CMD_ARRIVED, seq_);
+  pending_.push_back(seq_);
+  return seq_;
+}
+
+void LatencyTracer::update(double now)
+{
+  int64_t arrived, written, on_bus;
+
+  // newest command which made it, everything before it was replaced
+  // by a newer one within the same control cycle
+  int last = -1;
+  for(size_t i=0; i < pending_.size(); i++)
+    if(latency_lookup(LATENCY_CMD_ON_BUS, pending_[i], &on_bus))
+      last = i;
+
+  for(int i=0; i <= last; i++) {
+    uint32_t seq = pending_.front();
+    pending_.pop_front();
+
+    if(!latency_lookup(LATENCY_CMD_ARRIVED, seq, &arrived) ||
+       !latency_lookup(LATENCY_CMD_ON_BUS, seq, &on_bus)) {
+      dropped_++;
+      continue;
+    }
+
+    if(latency_lookup(LATENCY_CMD_WRITTEN, seq, &written)) {
+      add(CMD_TO_WRITE, seq, now, (written - arrived) / 1e9);
+      add(WRITE_TO_BUS, seq, now, (on_bus - written) / 1e9);
+    }
+    add(CMD_TO_BUS, seq, now, (on_bus - arrived) / 1e9);
+  }
+
+  // overwritten or never driven
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  int64_t timeout = t.tv_sec * 1000000000LL + t.tv_nsec - (int64_t) (pending_timeout * 1e9);
+  while(!pending_.empty() &&
+        (!latency_lookup(LATENCY_CMD_ARRIVED, pending_.front(), &arrived) || arrived < timeout)) {
+    pending_.pop_front();
+    dropped_++;
+  }
+}
+
+void LatencyTracer::add(Path path, uint32_t seq, double now, double latency)
+{
+  Histogram& h = hist_[path];
+
+  if(latency < 0)
+    latency = 0;
+
+  if(h.count == 0 || latency < h.min)
+    h.min = latency;
+  if(h.count == 0 || latency > h.max)
+    h.max = latency;
+  h.sum += latency;
+  h.count++;
+
+  int bin = 0;
+  if(latency >= 1e-6)
+    bin = std::min((int) NUM_BINS - 1, ilogb(latency / 1e-6) + 1);
+  h.bins[bin]++;
+
+  if(csv_)
+    fprintf(csv_, "%s,%u,%.6f,%.1f\n", name(path), seq, now, latency * 1e6);
+}
+
+const char* LatencyTracer::name(int path)
+{
+  static const char* names[NUM_PATHS] = {"cmd_to_write", "write_to_bus", "cmd_to_bus", "encoder_to_tf"};
+  return names[path];
+}
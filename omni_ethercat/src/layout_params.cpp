@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2009 by Ingo Kresse <kresse@in.tum.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "layout_params.h"
+
+extern "C" {
+#include "omnilib.h"
+}
+
+
+void loadBusLayout(const ros::NodeHandle& n, omni_layout_t* layout)
+{
+  // the torso gets its own domain if its rate or master differs
+  int wheel_master, wheel_frequency, torso_master, torso_frequency, torso_position;
+  n.param("wheel_master", wheel_master, 0);
+  n.param("wheel_frequency", wheel_frequency, 1000);
+  n.param("torso_master", torso_master, wheel_master);
+  n.param("torso_frequency", torso_frequency, wheel_frequency);
+  n.param("torso_position", torso_position, 4);  // slave position on its master, without discovery
+
+  omni_default_layout(layout);
+  layout->domains[0].master = wheel_master;
+  layout->domains[0].frequency = wheel_frequency;
+  if(torso_master != wheel_master || torso_frequency != wheel_frequency) {
+    layout->num_domains = 2;
+    layout->domains[1].master = torso_master;
+    layout->domains[1].frequency = torso_frequency;
+    layout->drives[TORSO_DRIVE_SEQ].domain = 1;
+  }
+  layout->drives[TORSO_DRIVE_SEQ].position = torso_position;
+
+  // find the drives on the bus instead of relying on positions 0-4
+  bool discover;
+  std::string topology_cache, ros_home;
+  if(getenv("ROS_HOME"))
+    ros_home = getenv("ROS_HOME");
+  else if(getenv("HOME"))
+    ros_home = std::string(getenv("HOME")) + "/.ros";
+  n.param("discover_drives", discover, true);
+  n.param("topology_cache", topology_cache,
+          ros_home.empty() ? std::string("") : ros_home + "/omni_ethercat_topology");
+  layout->discover = discover;
+  strncpy(layout->topology_cache, topology_cache.c_str(), sizeof(layout->topology_cache) - 1);
+
+  // stamp odometry and joint states with the reference clock instead of the host send time
+  bool distributed_clocks;
+  n.param("distributed_clocks", distributed_clocks, false);
+  layout->distributed_clocks = distributed_clocks;
+}
@@ -17,36 +17,83 @@
 
 
 #include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
 #include <math.h>
+#include <algorithm>
+#include <vector>
 
 #include <ros/ros.h>
+#include <ros/callback_queue.h>
 #include <geometry_msgs/Twist.h>
 #include <soft_runstop/Handler.h>
 #include <tf/transform_broadcaster.h>
 #include <diagnostic_updater/diagnostic_updater.h>
+#include <dynamic_reconfigure/server.h>
 #include <iai_control_msgs/PowerState.h>
 #include <std_msgs/Float64MultiArray.h>
 
 //For the torso:
 #include <sensor_msgs/JointState.h>
 #include <std_msgs/Float64.h>
+#include <trajectory_msgs/JointTrajectory.h>
+#include <control_msgs/JointTrajectoryControllerState.h>
+#include <std_srvs/Trigger.h>
 
 
+#include "rate_scheduler.h"
+#include "latency_tracer.h"
+#include "layout_params.h"
+#include <omni_ethercat/OmnidriveConfig.h>
+
 extern "C" {
 #include "omnilib.h"
+#include "seqlock.h"
+#include "omni_params.h"
 }
 
 #define LIMIT(x, l) ( (x>l) ? l : (x<-l) ? -l : x )
 
 const int num_drives = 5;
 const double torso_ticks_to_m = 10000000;
+const std::string torso_joint_name = "triangle_base_joint";
+const double io_frequency = 250; // publishing cycles of the I/O thread
 
 
 //FIXME: param that says which ethercat drives are what
 //example: drives 0-3 are on wheels, counterclockwise, starting on front left.
 //example: plus drive 4 is the torso
 
+// Velocity command, written by the I/O thread, read by the control thread
+struct BaseCommand
+{
+  double drive[3];
+  double stamp;        // arrival time, s
+  int runstop;         // soft runstop engaged
+  uint32_t seq;        // latency tracing tag, 0 if off
+};
+
+// Everything the I/O thread publishes, written by the control thread
+struct BaseState
+{
+  double stamp;        // s
+  double base_stamp, torso_stamp;  // when the bus sampled x, y, a and torso_pos, s
+  double x, y, a, torso_pos;
+  torsostatus_t torso;
+  commstatus_t comm;
+  slipstatus_t slip;
+  char drive[5];
+  int estop;
+  unsigned int watchdog_count;  // times the watchdog stopped a moving base
+
+  // control loop timing
+  unsigned int cycles, misses;
+  double jitter, max_jitter, mean_jitter;  // wake-up latency, s
+};
+
 class Omnidrive
 {
 private:
@@ -55,90 +102,204 @@ private:
   ros::Publisher current_pub_;
   ros::Publisher power_pub_;
   ros::Publisher js_pub_; //torso
+  ros::Publisher torso_state_pub_;
   ros::Subscriber power_sub_;
-  ros::Time watchdog_time_;
-  double drive_[3], drive_last_[3];
-  double torso_des_pos_; // torso
-  bool fresh_torso_des_pos_; //torso
+  ros::ServiceServer torso_home_srv_;
+  double drive_last_[3];
+  int loop_frequency_;
+  seqlock_t command_lock_, state_lock_;
+  BaseCommand command_, io_command_;  // io_command_ is the I/O thread's copy
+  BaseState state_;
+  int running_;
+  pthread_t control_thread_;
   soft_runstop::Handler soft_runstop_handler_;
   std::string frame_id_;
   std::string child_frame_id_;
   std::string power_name_;
+  RateScheduler outputs_;  // publishing rates of the I/O thread
+  LatencyTracer latency_;
+  ros::Publisher latency_pub_;
+  double drive_stats_period_, drive_stats_time_;  // s, refresh of drive_stats_
+  drive_stats_t drive_stats_[NUM_DRIVES_];
   void cmdArrived(const geometry_msgs::Twist::ConstPtr& msg);
   void torsoCmdArrived(const std_msgs::Float64::ConstPtr& msg); //torso
+  void torsoTrajectoryArrived(const trajectory_msgs::JointTrajectory::ConstPtr& msg);
+  bool torsoHome(std_srvs::Trigger::Request& req, std_srvs::Trigger::Response& res);
+  void torsoUpdate(diagnostic_updater::DiagnosticStatusWrapper &s);
   void stateUpdate(diagnostic_updater::DiagnosticStatusWrapper &s);
   void powerCommand(const iai_control_msgs::PowerState::ConstPtr& msg);
+  void loopUpdate(diagnostic_updater::DiagnosticStatusWrapper &s);
+  void ratesUpdate(diagnostic_updater::DiagnosticStatusWrapper &s);
+  void slipUpdate(diagnostic_updater::DiagnosticStatusWrapper &s);
+  void driveStatsUpdate(diagnostic_updater::DiagnosticStatusWrapper &s);
+  void reconfigure(omni_ethercat::OmnidriveConfig &config, uint32_t level);
+  void writeCommand(const BaseCommand &cmd);
+  BaseState readState();
+  void controlLoop();
+  static void* controlThread(void* arg);
 public:
   Omnidrive();
   void main();
 };
 
 
-Omnidrive::Omnidrive() : n_("omnidrive"), diagnostic_(), soft_runstop_handler_(Duration(0.5)), fresh_torso_des_pos_(false)
+Omnidrive::Omnidrive() : n_("omnidrive"), diagnostic_(), soft_runstop_handler_(Duration(0.5)),
+                         outputs_(io_frequency), drive_stats_time_(0.0)
 {
   diagnostic_.setHardwareID("omnidrive");
   diagnostic_.add("Base", this, &Omnidrive::stateUpdate);
+  diagnostic_.add("Torso", this, &Omnidrive::torsoUpdate);
+  diagnostic_.add("Control loop", this, &Omnidrive::loopUpdate);
+  diagnostic_.add("Publishing rates", this, &Omnidrive::ratesUpdate);
+  diagnostic_.add("Wheel slip", this, &Omnidrive::slipUpdate);
+  diagnostic_.add("Drive statistics", this, &Omnidrive::driveStatsUpdate);
   n_.param("frame_id", frame_id_, std::string("/odom"));
   n_.param("child_frame_id", child_frame_id_, std::string("/base_link"));
   n_.param("power_name", power_name_, std::string("Wheels"));
+  n_.param("drive_stats_period", drive_stats_period_, 10.0);
+  memset(drive_stats_, 0, sizeof(drive_stats_));
 
   //current_pub_ = n_.advertise<std_msgs::Float64MultiArray>("motor_currents", 1);
   power_pub_ = n_.advertise<iai_control_msgs::PowerState>("/power_state", 1);
   power_sub_ = n_.subscribe<iai_control_msgs::PowerState>("/power_command", 16, &Omnidrive::powerCommand, this);
 
   js_pub_ = n_.advertise<sensor_msgs::JointState>("/torso/joint_states", 1);  //torso
+  torso_state_pub_ = n_.advertise<control_msgs::JointTrajectoryControllerState>("/torso/state", 1);
 
-  for(int i=0; i < 3; i++) {
+  for(int i=0; i < 3; i++)
     drive_last_[i] = 0;
-    drive_[i] = 0;
-  }
 
-  watchdog_time_ = ros::Time::now();
+  command_lock_.seq = 0;
+  state_lock_.seq = 0;
+  memset(&command_, 0, sizeof(command_));
+  memset(&io_command_, 0, sizeof(io_command_));
+  memset(&state_, 0, sizeof(state_));
+  running_ = 0;
+}
+
+void Omnidrive::writeCommand(const BaseCommand &cmd)
+{
+  // single writer: only ever called from the I/O thread
+  seqlock_write(&command_lock_, &command_, &cmd, sizeof(cmd));
+}
+
+BaseState Omnidrive::readState()
+{
+  BaseState state;
+  seqlock_read(&state_lock_, &state, &state_, sizeof(state), 0);
+  return state;
 }
 
 void Omnidrive::cmdArrived(const geometry_msgs::Twist::ConstPtr& msg)
 {
   // FIXME: use TwistStamped instead of Twist and check that people command in the right frame
-  // NOTE: No need for synchronization since this is called inside spinOnce() in the main loop
+  // NOTE: called in the I/O thread, handed to the control thread through command_lock_
+  BaseCommand &cmd = io_command_;
 
-  drive_[0] = msg->linear.x;
-  drive_[1] = msg->linear.y;
-  drive_[2] = msg->angular.z;
+  cmd.drive[0] = msg->linear.x;
+  cmd.drive[1] = msg->linear.y;
+  cmd.drive[2] = msg->angular.z;
 
 
   //FIXME:  FUGLY, this needs to be fixed in omnilib.c (fix the jacobian)
   //  plus, the direction of rotation and position of wheels needs to be documented
   //Rotate 180deg around the z axis
-  drive_[0] = -drive_[0];
-  drive_[1] = -drive_[1];
+  cmd.drive[0] = -cmd.drive[0];
+  cmd.drive[1] = -cmd.drive[1];
 
   //also the z rotation was wrong
-  drive_[2] = -drive_[2];
+  cmd.drive[2] = -cmd.drive[2];
 
 
-  watchdog_time_ = ros::Time::now();
+  cmd.stamp = ros::Time::now().toSec();
+  cmd.runstop = soft_runstop_handler_.getState();
+  cmd.seq = latency_.commandArrived();
+  writeCommand(cmd);
 }
 
 //torso:
-//FIXME: need param to turn torso into velocity or position resolved
 //FIXME: All topics receiving commands need a watchdog, this one too
  
+// a single position to go to right away
 void Omnidrive::torsoCmdArrived(const std_msgs::Float64::ConstPtr& msg)
 {
+  double now = 0.0;
+  omnidrive_torso_move(&now, &msg->data, 1);
+}
+
+void Omnidrive::torsoTrajectoryArrived(const trajectory_msgs::JointTrajectory::ConstPtr& msg)
+{
+  size_t joint = std::find(msg->joint_names.begin(), msg->joint_names.end(), torso_joint_name) -
+                 msg->joint_names.begin();
+  if(joint == msg->joint_names.size()) {
+    ROS_ERROR("Torso trajectory does not contain joint %s", torso_joint_name.c_str());
+    return;
+  }
+
+  // a header stamp in the future delays the start of the trajectory
+  double delay = 0.0;
+  if(!msg->header.stamp.isZero())
+    delay = std::max(0.0, (msg->header.stamp - ros::Time::now()).toSec());
+
+  std::vector<double> times, positions;
+  for(size_t i=0; i < msg->points.size(); i++) {
+    if(msg->points[i].positions.size() <= joint) {
+      ROS_ERROR("Torso trajectory point %zu has no position for %s", i, torso_joint_name.c_str());
+      return;
+    }
+    times.push_back(delay + msg->points[i].time_from_start.toSec());
+    positions.push_back(msg->points[i].positions[joint]);
+  }
+
+  if(omnidrive_torso_move(times.empty() ? 0 : &times[0],
+                          positions.empty() ? 0 : &positions[0], times.size()) != 0)
+    ROS_ERROR("Rejected torso trajectory: at most %d points with ascending times",
+              TORSO_MAX_TRAJ_POINTS);
+}
+
+bool Omnidrive::torsoHome(std_srvs::Trigger::Request& req, std_srvs::Trigger::Response& res)
+{
+  // progress is reported in /torso/state and the diagnostics
+  omnidrive_torso_home();
+  res.success = true;
+  res.message = "homing started";
+  return true;
+}
 
-  printf("Desired torso position: %f\n", msg->data);
-  torso_des_pos_ = msg->data * torso_ticks_to_m;
-  fresh_torso_des_pos_ = true;
+static const char* torsoStateName(int state)
+{
+  switch(state) {
+    case TORSO_STATE_DISABLED: return "disabled";
+    case TORSO_STATE_IDLE: return "idle";
+    case TORSO_STATE_HOMING: return "homing";
+    case TORSO_STATE_HOMING_FAILED: return "homing failed";
+    case TORSO_STATE_MOVING: return "moving";
+  }
+  return "unknown";
+}
+
+void Omnidrive::torsoUpdate(diagnostic_updater::DiagnosticStatusWrapper &s)
+{
+  torsostatus_t torso = readState().torso;
 
+  if(torso.state == TORSO_STATE_DISABLED || torso.state == TORSO_STATE_HOMING_FAILED)
+    s.summary(1, torsoStateName(torso.state));
+  else
+    s.summary(0, torsoStateName(torso.state));
 
+  s.add("mode", torso.mode == TORSO_MODE_CSP ? "cyclic synchronous position" : "profile position");
+  s.add("homed", torso.homed ? "yes" : "no");
+  s.addf("position", "%.4f m", torso.position / torso_ticks_to_m);
+  s.addf("goal", "%.4f m", torso.goal / torso_ticks_to_m);
+  s.addf("progress", "%.0f %%", torso.progress * 100.0);
 }
 
 
 void Omnidrive::stateUpdate(diagnostic_updater::DiagnosticStatusWrapper &s)
 {
-  int estop;
-  char drive[5]; //+1 for torso
-  omnidrive_status(&drive[0], &drive[1], &drive[2], &drive[3], &drive[4], &estop);
+  BaseState state = readState();
+  int estop = state.estop;
+  const char *drive = state.drive; //+1 for torso
 
   bool operational = (drive[0] == '4' &&
                       drive[1] == '4' &&
@@ -157,7 +318,7 @@ void Omnidrive::stateUpdate(diagnostic_updater::DiagnosticStatusWrapper &s)
           std::string("") + drive[i]);
   s.add("Emergency Stop", (estop) ? "== pressed ==" : "released");
 
-  commstatus_t comm = omnidrive_commstatus();
+  const commstatus_t &comm = state.comm;
 
   for(int i=0; i < num_drives; i++)
     s.addf(std::string("comm status drive ")+(char) ('1' + i),
@@ -176,6 +337,35 @@ void Omnidrive::stateUpdate(diagnostic_updater::DiagnosticStatusWrapper &s)
            comm.working_counter,
            comm.working_counter_state == 2 ? "complete" : "incomplete");
 
+  s.addf("realtime misses", "%u", comm.misses);
+
+  for(int i=0; i < comm.num_domains; i++) {
+    const omni_domain_stats_t &d = comm.domain[i];
+    s.addf(std::string("domain ") + (char) ('0' + i),
+           "master %u, %u Hz, WC %d %s, %u cycles, %u misses, "
+           "jitter %.1f us (max %.1f), exec %.1f us (max %.1f)",
+           d.master, d.frequency, d.working_counter,
+           d.working_counter_state == 2 ? "complete" : "incomplete",
+           d.cycles, d.misses,
+           d.jitter_ns / 1e3, d.max_jitter_ns / 1e3,
+           d.exec_ns / 1e3, d.max_exec_ns / 1e3);
+    if(d.dc)
+      s.addf(std::string("domain ") + (char) ('0' + i) + " clock",
+             "send jitter against the distributed clock %.1f us (max %.1f), %u resets",
+             d.dc_error_ns / 1e3, d.dc_max_error_ns / 1e3, d.dc_resets);
+  }
+
+  std::string recovering;
+  for(int i=0; i < num_drives; i++)
+    if(comm.drive_recovering[i])
+      recovering += std::string(" ") + (char) ('1' + i);
+
+  s.addf("bus recoveries", "%d, last took %.3f s%s%s",
+           comm.recoveries,
+           comm.last_recovery_time,
+           recovering.empty() ? "" : ", recovering drives",
+           recovering.c_str());
+
   iai_control_msgs::PowerState power;
   power.name = power_name_;
   power.enabled = operational;
@@ -184,15 +374,141 @@ void Omnidrive::stateUpdate(diagnostic_updater::DiagnosticStatusWrapper &s)
 }
 
 
+void Omnidrive::loopUpdate(diagnostic_updater::DiagnosticStatusWrapper &s)
+{
+  BaseState state = readState();
+
+  if(state.misses == 0)
+    s.summary(0, "OK");
+  else
+    s.summary(1, "Missed deadlines");
+
+  s.addf("frequency", "%d Hz", loop_frequency_);
+  s.addf("cycles", "%u", state.cycles);
+  s.addf("misses", "%u", state.misses);
+  s.addf("jitter", "%.1f us (mean %.1f, max %.1f)",
+         state.jitter * 1e6, state.mean_jitter * 1e6, state.max_jitter * 1e6);
+}
+
+
+void Omnidrive::slipUpdate(diagnostic_updater::DiagnosticStatusWrapper &s)
+{
+  BaseState state = readState();
+  const slipstatus_t &slip = state.slip;
+  omni_params_t params;
+  omni_params_get(&params);
+
+  if(slip.residual > params.slip_error)
+    s.summary(2, "Wheels slipping");
+  else if(slip.residual > params.slip_warn)
+    s.summary(1, "Wheels slipping");
+  else
+    s.summary(0, "OK");
+
+  s.addf("residual", "%.3f m/s (max %.3f), warn at %.3f, error at %.3f",
+         slip.residual, slip.max_residual, params.slip_warn, params.slip_error);
+  s.addf("cycles above warning", "%lu", slip.slip_cycles);
+  for(int i=0; i < 4; i++)
+    s.addf(std::string("wheel ") + (char) ('1' + i), "misfit %.3f m/s, traction %.2f%s",
+           slip.wheel[i], slip.traction[i],
+           slip.weighted_wheel == i ? ", down-weighted in the odometry" : "");
+}
+
+
+void Omnidrive::driveStatsUpdate(diagnostic_updater::DiagnosticStatusWrapper &s)
+{
+  // the trends change slowly, do not copy and format them on every diagnostics cycle
+  double now = ros::Time::now().toSec();
+  if(now - drive_stats_time_ >= drive_stats_period_) {
+    omnidrive_drive_stats(drive_stats_);
+    drive_stats_time_ = now;
+  }
+
+  uint32_t faults = 0;
+  for(int i=0; i < NUM_DRIVES_; i++) {
+    const drive_stats_t &d = drive_stats_[i];
+    std::string name = (i == TORSO_DRIVE_SEQ) ? std::string("torso") : std::string("wheel ") + (char) ('1' + i);
+    const char *unit = (i == TORSO_DRIVE_SEQ) ? "ticks" : "ticks/s";
+
+    faults += d.faults;
+    if(!d.valid) {
+      s.add(name, "no data");
+      continue;
+    }
+
+    uint64_t total = 0;
+    for(int j=0; j < CIA402_NUM_STATES; j++)
+      total += d.state_ns[j];
+
+    std::string states;
+    for(int j=0; j < CIA402_NUM_STATES; j++) {
+      if(d.state_ns[j] == 0)
+        continue;
+      char buf[64];
+      snprintf(buf, sizeof(buf), "%s%s %.1f%%", states.empty() ? "" : ", ",
+               cia402_state_name(j), 100.0 * d.state_ns[j] / total);
+      states += buf;
+    }
+
+    // the three most active statusword bits
+    std::string flips;
+    bool listed[16] = {false};
+    for(int n=0; n < 3; n++) {
+      int top = -1;
+      for(int j=0; j < 16; j++)
+        if(!listed[j] && d.bit_flips[j] > 0 && (top < 0 || d.bit_flips[j] > d.bit_flips[top]))
+          top = j;
+      if(top < 0)
+        break;
+      listed[top] = true;
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%sbit %d: %u", flips.empty() ? "" : ", ", top, d.bit_flips[top]);
+      flips += buf;
+    }
+
+    s.addf(name, "state %s (%04x), %u faults", cia402_state_name(d.state), d.statusword, d.faults);
+    s.addf(name + " time in state", "%s", states.c_str());
+    s.addf(name + " statusword flips", "%s", flips.empty() ? "none" : flips.c_str());
+    s.addf(name + " torque", "rms %.1f, peak %d per mille", sqrt(d.torque_ms), d.torque_peak);
+    s.addf(name + " following error", "rms %.1f, peak %d %s",
+           sqrt(d.following_error_ms), d.following_error_peak, unit);
+  }
+
+  if(faults > 0)
+    s.summary(1, "Drives had faults");
+  else
+    s.summary(0, "OK");
+  s.addf("age", "%.1f s, refreshed every %.1f s", now - drive_stats_time_, drive_stats_period_);
+}
+
+
+void Omnidrive::ratesUpdate(diagnostic_updater::DiagnosticStatusWrapper &s)
+{
+  bool saturated = false;
+
+  for(int i=0; i < outputs_.size(); i++) {
+    s.addf(outputs_.name(i), "%.1f Hz of %.1f Hz, waited %u times%s",
+           outputs_.achieved(i), outputs_.requested(i), outputs_.deferred(i),
+           outputs_.saturated(i) ? ", limited by the loop rate" : "");
+    saturated = saturated || outputs_.saturated(i);
+  }
+
+  if(saturated)
+    s.summary(1, "Rate above the loop frequency");
+  else
+    s.summary(0, "OK");
+}
+
+
 //FIXME: Do we need this for this base? This allows to bring the ethercat drives down and up at wish
 void Omnidrive::powerCommand(const iai_control_msgs::PowerState::ConstPtr& msg)
 {
   if(msg->name == power_name_)
   {
     printf("Received power command!\n");
-    int estop;
-    char drive[4];
-    omnidrive_status(&drive[0], &drive[1], &drive[2], &drive[3], &drive[4], &estop);
+    BaseState state = readState();
+    int estop = state.estop;
+    const char *drive = state.drive;
 
     bool power_state = (drive[0] == '4' &&
                         drive[1] == '4' &&
@@ -203,10 +519,11 @@ void Omnidrive::powerCommand(const iai_control_msgs::PowerState::ConstPtr& msg)
                         
     printf("Power_state=%d    drive[0]=%d\n", power_state, drive[0]);
 
+    // both only request the new state, the drives are sequenced through
+    // process data by the realtime thread and report back via stateUpdate
     if(msg->enabled == true && power_state == false)
     {
       printf("Recovering\n");
-      omnidrive_recover();
       omnidrive_poweron();
     }
 
@@ -219,156 +536,378 @@ void Omnidrive::powerCommand(const iai_control_msgs::PowerState::ConstPtr& msg)
   }
 }
 
-void Omnidrive::main()
+// Called from the I/O thread. The new block is validated and swapped in,
+// the loops pick it up in their next cycle.
+void Omnidrive::reconfigure(omni_ethercat::OmnidriveConfig &config, uint32_t level)
 {
-  double speed, acc_max, t, radius, drift;
-  int tf_frequency, runstop_frequency, js_frequency;
-  const int loop_frequency = 250; // 250Hz update frequency
-
-  n_.param("speed", speed, 100.0); // 0.1
-  // default acc: brake from max. speed to 0 within 1.5cm
-  n_.param("acceleration", acc_max, 1000.0);  //0.5*speed*speed/0.015
-  // radius of the robot
-  n_.param("radius", radius, 0.6);
-  n_.param("tf_frequency", tf_frequency, 50);
-  n_.param("js_frequency", js_frequency, 125);
-  n_.param("runstop_frequency", runstop_frequency, 10);
-  n_.param("watchdog_period", t, 0.15);
-  ros::Duration watchdog_period(t);
-  n_.param("odometry_correction", drift, 1.0);
-
-  // set acceleration to correct scale
-  acc_max /= loop_frequency;
-
-  if(omnidrive_init() != 0) {
-    ROS_ERROR("failed to initialize omnidrive");
-    ROS_ERROR("check dmesg and try \"sudo /etc/init.d/ethercat restart\"");
-    return;
+  omni_params_t p;
+  char reason[128];
+
+  omni_params_get(&p);
+
+  p.speed = config.speed;
+  p.acceleration = config.acceleration;
+  p.radius = config.radius;
+  p.watchdog_period = config.watchdog_period;
+  p.wheel_limit = config.wheel_limit;
+  p.cart_limit = config.cart_limit;
+  p.limit_radius = config.limit_radius;
+  p.odometry_correction = config.odometry_correction;
+  p.slip_warn = config.slip_warn;
+  p.slip_error = config.slip_error;
+  p.slip_weight = config.slip_weight;
+  p.max_tick_speed = config.max_tick_speed;
+  p.wheel_profile_acceleration = config.wheel_profile_acceleration;
+  p.wheel_profile_deceleration = config.wheel_profile_deceleration;
+
+  if(omni_params_set(&p, reason, sizeof(reason)) != 0) {
+    ROS_ERROR("rejected new parameters: %s", reason);
+
+    // report what is actually in use
+    omni_params_t cur;
+    omni_params_get(&cur);
+    config.speed = cur.speed;
+    config.acceleration = cur.acceleration;
+    config.radius = cur.radius;
+    config.watchdog_period = cur.watchdog_period;
+    config.wheel_limit = cur.wheel_limit;
+    config.cart_limit = cur.cart_limit;
+    config.limit_radius = cur.limit_radius;
+    config.odometry_correction = cur.odometry_correction;
+    config.slip_warn = cur.slip_warn;
+    config.slip_error = cur.slip_error;
+    config.slip_weight = cur.slip_weight;
+    config.max_tick_speed = cur.max_tick_speed;
+    config.wheel_profile_acceleration = cur.wheel_profile_acceleration;
+    config.wheel_profile_deceleration = cur.wheel_profile_deceleration;
   }
-  omnidrive_set_correction(drift);
 
-  tf::TransformBroadcaster transforms;
+  if(omnidrive_torso_configure(config.torso_mode == "csp" ? TORSO_MODE_CSP : TORSO_MODE_PROFILE,
+                               config.torso_min_position, config.torso_max_position,
+                               config.torso_max_velocity, config.torso_acceleration) != 0)
+    ROS_ERROR("rejected torso limits: torso_max_velocity and torso_acceleration must be positive");
+}
 
-  ros::Subscriber sub = n_.subscribe("/base/cmd_vel", 10, &Omnidrive::cmdArrived, this);
-  ros::Subscriber sub_torso = n_.subscribe("/torso/cmd_vel", 10, &Omnidrive::torsoCmdArrived, this); //torso
-  ros::Publisher hard_runstop_pub = n_.advertise<std_msgs::Bool>("/hard_runstop", 1);
+void* Omnidrive::controlThread(void* arg)
+{
+  static_cast<Omnidrive*>(arg)->controlLoop();
+  return 0;
+}
 
-  double x=0, y=0, a=0, torso_pos=0;
+// Runs the base at loop_frequency_: odometry, watchdog, acceleration limits
+// and the wheel command. Nothing in here publishes or logs, the I/O thread
+// takes what it needs from state_.
+void Omnidrive::controlLoop()
+{
+  const long period = 1000000000L / loop_frequency_;
+  BaseCommand cmd, fresh;
+  BaseState state;
+  struct timespec tick, now;
+  bool stopped = true;
+  double acc_max;
+  omni_params_t params;
+
+  memset(&cmd, 0, sizeof(cmd));
+  memset(&state, 0, sizeof(state));
+  omni_params_get(&params);
+  clock_gettime(CLOCK_MONOTONIC, &tick);
+
+  while(__atomic_load_n(&running_, __ATOMIC_RELAXED)) {
+    // wake-up latency, the mean is over roughly the last second
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    state.jitter = (now.tv_sec - tick.tv_sec) + (now.tv_nsec - tick.tv_nsec) / 1e9;
+    state.max_jitter = std::max(state.max_jitter, state.jitter);
+    state.cycles++;
+    state.mean_jitter += (state.jitter - state.mean_jitter) /
+                         std::min(state.cycles, (unsigned int) loop_frequency_);
+
+    // keep the last command if the I/O thread is writing right now
+    if(seqlock_read(&command_lock_, &fresh, &command_, sizeof(fresh), 3))
+      cmd = fresh;
+
+    omnidrive_odometry(&state.x, &state.y, &state.a, &state.torso_pos);
+    state.torso = omnidrive_torso_status();
+    state.slip = omnidrive_slip_status();
+    state.comm = omnidrive_commstatus();
+    omnidrive_status(&state.drive[0], &state.drive[1], &state.drive[2],
+                     &state.drive[3], &state.drive[4], &state.estop);
+    state.stamp = ros::Time::now().toSec();
+    state.base_stamp = omnidrive_odometry_stamp();
+    state.torso_stamp = omnidrive_torso_stamp();
+    if(state.base_stamp == 0)
+      state.base_stamp = state.stamp;
+    if(state.torso_stamp == 0)
+      state.torso_stamp = state.stamp;
+
+    // limits may change at any time, use one copy for the whole cycle and
+    // keep the last one if an update races it
+    omni_params_read(&params);
+    acc_max = params.acceleration / loop_frequency_;
 
-  int tf_publish_counter=0;
-  int tf_send_rate = loop_frequency / tf_frequency;
+    //FIXME: Do we need a watchdog for the torso?
 
+    //The watchdog for the /cmd_vel topic
+    //should stop the base if now new messages arrive
+    double drive[3];
+    if(state.stamp - cmd.stamp > params.watchdog_period || cmd.runstop) {
+      //Only count it when it had some driving velocities, and getting here
+      //not because of the runstop
+      if(!stopped && (cmd.drive[0] != 0 || cmd.drive[1] != 0 || cmd.drive[2] != 0)
+         && !cmd.runstop)
+        state.watchdog_count++;
+      stopped = true;
+
+      //zero the velocities of the wheels
+      for(int i=0; i < 3; i++) {
+        drive_last_[i] = 0;
+        drive[i] = 0;
+      }
+    } else {
+      stopped = false;
+      for(int i=0; i < 3; i++)
+        drive[i] = cmd.drive[i];
+    }
 
-  //torso:
-  int js_publish_counter=0;
-  int js_send_rate = loop_frequency / js_frequency;
 
-  int runstop_publish_counter=0;
-  int runstop_send_rate = loop_frequency / runstop_frequency;
+    //Evil acceleration limitation
+    //FIXME: Limit in twist-space, make it use time 
+    
+    for(int i=0; i < 3; i++) {
+      // acceleration limiting
+      double acc = drive[i] - drive_last_[i];
+      double fac_rot = (i == 2) ? 1.0/params.radius : 1.0;
+      acc = LIMIT(acc, acc_max*fac_rot*fac_rot);
+      drive[i] = drive_last_[i] + acc;
 
-  ros::Rate r(loop_frequency);
+      // velocity limiting
+      drive[i] = LIMIT(drive[i], params.speed*fac_rot);
 
-  while(n_.ok()) {
+      drive_last_[i] = drive[i];
+    }
+   
+    //if the watchdog was activated drive[0-2] are 0.0
+    omnidrive_trace_command(cmd.seq);
+    omnidrive_drive(drive[0], drive[1], drive[2]);
 
-    omnidrive_odometry(&x, &y, &a, &torso_pos);
+    seqlock_write(&state_lock_, &state_, &state, sizeof(state));
 
+    // Compute end of next period, snap to the next one if we overran
+    tick.tv_nsec += period;
+    while(tick.tv_nsec >= 1000000000L) {
+      tick.tv_nsec -= 1000000000L;
+      tick.tv_sec++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(now.tv_sec > tick.tv_sec || (now.tv_sec == tick.tv_sec && now.tv_nsec > tick.tv_nsec)) {
+      tick = now;
+      state.misses++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tick, NULL);
+  }
+}
 
-    //FIXME: Do we need a watchdog for the torso?
+void Omnidrive::main()
+{
+  double tf_frequency, runstop_frequency, js_frequency;
+  loop_frequency_ = 250; // 250Hz update frequency
+
+  // speed, acceleration, radius, watchdog_period, odometry_correction and
+  // the torso limits are loaded by the reconfigure server, see cfg/Omnidrive.cfg
+  n_.param("tf_frequency", tf_frequency, 50.0);
+  n_.param("js_frequency", js_frequency, 125.0);
+  n_.param("runstop_frequency", runstop_frequency, 10.0);
+
+  bool torso_home;
+  n_.param("home_torso", torso_home, false);
+
+  // command-to-wheel and encoder-to-tf latencies, see latency_tracer.h
+  bool latency_trace;
+  std::string latency_csv;
+  n_.param("latency_trace", latency_trace, false);
+  n_.param("latency_csv", latency_csv, std::string(""));
+  if(latency_trace) {
+    if(!latency_.start(latency_csv)) {
+      ROS_WARN("could not open %s, tracing latencies without a CSV dump", latency_csv.c_str());
+      latency_.start("");
+    }
+    latency_pub_ = n_.advertise<std_msgs::Float64MultiArray>("latency", 1);
+  }
 
-    //The watchdog for the /cmd_vel topic
-    //should stop the base if now new messages arrive
-    if( (( ros::Time::now() - watchdog_time_) > watchdog_period) || soft_runstop_handler_.getState()) {
+  omni_layout_t layout;
+  loadBusLayout(n_, &layout);
+
+  if(omnidrive_init(&layout) != 0) {
+    ROS_ERROR("failed to initialize omnidrive");
+    ROS_ERROR("check dmesg and try \"sudo /etc/init.d/ethercat restart\"");
+    return;
+  }
 
-        //printf("Watchdog!\n");
-        //printf("State of the soft_runstop = %d\n", soft_runstop_handler_.getState());
+  // applies the initial parameters right away, later updates come from the I/O thread
+  dynamic_reconfigure::Server<omni_ethercat::OmnidriveConfig> reconfigure_server(n_);
+  reconfigure_server.setCallback(boost::bind(&Omnidrive::reconfigure, this, _1, _2));
 
+  if(torso_home)
+    omnidrive_torso_home();
 
-        //Only send the ROS warning the first time
-        //when it had some driving velocities, and getting here not because of
-        //the runstop
-        if((drive_[0] != 0 || drive_[1] != 0 || drive_[2] !=0)
-             && !soft_runstop_handler_.getState())
-            ROS_WARN("engaged watchdog!");
+  tf::TransformBroadcaster transforms;
 
-        //zero the velocities of the wheels
-        for(int i=0; i < 3; i++) {
-            drive_last_[i] = 0;
-            drive_[i] = 0;
-        }
+  ros::Subscriber sub = n_.subscribe("/base/cmd_vel", 10, &Omnidrive::cmdArrived, this);
+  ros::Subscriber sub_torso = n_.subscribe("/torso/cmd_vel", 10, &Omnidrive::torsoCmdArrived, this); //torso
+  ros::Subscriber sub_torso_traj = n_.subscribe("/torso/command", 1, &Omnidrive::torsoTrajectoryArrived, this);
+  torso_home_srv_ = n_.advertiseService("home_torso", &Omnidrive::torsoHome, this);
+  ros::Publisher hard_runstop_pub = n_.advertise<std_msgs::Bool>("/hard_runstop", 1);
 
-        //While the watchdog is active, revisit here after watchdog_period
-        watchdog_time_ = ros::Time::now();
+  // the control loop gets its own thread, just below the EtherCAT threads
+  pthread_attr_t tattr;
+  struct sched_param sparam;
+  sparam.sched_priority = sched_get_priority_max(SCHED_FIFO) - 10;
+  pthread_attr_init(&tattr);
+  pthread_attr_setschedpolicy(&tattr, SCHED_FIFO);
+  pthread_attr_setschedparam(&tattr, &sparam);
+  pthread_attr_setinheritsched(&tattr, PTHREAD_EXPLICIT_SCHED);
+
+  running_ = 1;
+  if(pthread_create(&control_thread_, &tattr, &Omnidrive::controlThread, this) != 0) {
+    ROS_WARN("could not start a realtime control thread, running it with normal priority");
+    if(pthread_create(&control_thread_, 0, &Omnidrive::controlThread, this) != 0) {
+      ROS_ERROR("could not start the control thread");
+      pthread_attr_destroy(&tattr);
+      omnidrive_shutdown();
+      return;
     }
+  }
+  pthread_attr_destroy(&tattr);
+
+  // Everything below is the I/O thread: callbacks, publishing and
+  // diagnostics. It only sees the control loop through state_.
+  int torso_state = TORSO_STATE_DISABLED;
+  unsigned int watchdog_count = 0;
+
+  // fractional rates, spread over the I/O cycles
+  int tf_output = outputs_.add("tf", tf_frequency);
+  int js_output = outputs_.add("joint states", js_frequency);  //torso
+  int runstop_output = outputs_.add("hard runstop", runstop_frequency);
+  int latency_output = -1;
+  if(latency_.enabled())
+    latency_output = outputs_.add("latency", 1.0);
+
+  for(int i=0; i < outputs_.size(); i++)
+    if(outputs_.saturated(i))
+      ROS_WARN("%s requested at %.1f Hz, limited to %.1f Hz",
+               outputs_.name(i).c_str(), outputs_.requested(i), io_frequency);
+
+  ros::CallbackQueue* queue = ros::getGlobalCallbackQueue();
+  ros::WallDuration io_period(1.0 / io_frequency);
+  ros::WallTime next_io = ros::WallTime::now();
 
+  while(n_.ok()) {
 
-    //Evil acceleration limitation
-    // this runs in a slow loop
-    //FIXME: Move to the high-speed loop for smoothness -> Maybe not needed, this loop is 250Hz.
-    //FIXME: Limit in twist-space, make it use time 
-    
-    for(int i=0; i < 3; i++) {
-      // acceleration limiting
-      double acc = drive_[i] - drive_last_[i];
-      double fac_rot = (i == 2) ? 1.0/radius : 1.0;
-      acc = LIMIT(acc, acc_max*fac_rot*fac_rot);
-      drive_[i] = drive_last_[i] + acc;
+    // process incoming messages until the next publishing cycle
+    for(ros::WallTime now = ros::WallTime::now(); now < next_io; now = ros::WallTime::now())
+      queue->callAvailable(next_io - now);
+    next_io += io_period;
+    if(next_io < ros::WallTime::now())
+      next_io = ros::WallTime::now() + io_period;
+
+    // the soft runstop may change without a new command
+    if((int) soft_runstop_handler_.getState() != io_command_.runstop) {
+      io_command_.runstop = soft_runstop_handler_.getState();
+      writeCommand(io_command_);
+    }
 
-      // velocity limiting
-      drive_[i] = LIMIT(drive_[i], speed*fac_rot);
+    outputs_.tick(ros::WallTime::now().toSec());
 
-      drive_last_[i] = drive_[i];
+    BaseState state = readState();
+    const torsostatus_t &torso = state.torso;
+
+    if(latency_.enabled())
+      latency_.update(ros::WallTime::now().toSec());
+
+    if(torso.state != torso_state) {
+      ROS_INFO("Torso %s", torsoStateName(torso.state));
+      torso_state = torso.state;
+    }
+
+    if(state.watchdog_count != watchdog_count) {
+      ROS_WARN("engaged watchdog!");
+      watchdog_count = state.watchdog_count;
     }
-   
-    //if the watchdog was activated drive_[0-2] are 0.0
-    //only call omnidrive_drive once in the loop
-    //the last call will probably override the previous ones 
-    omnidrive_drive(drive_[0], drive_[1], drive_[2], torso_des_pos_);
 
     // publish odometry readings
-    if(++tf_publish_counter == tf_send_rate) {
+    if(outputs_.due(tf_output)) {
       tf::Quaternion q;
-      q.setRPY(0, 0, a);
-      tf::Transform pose(q, tf::Point(x, y, 0.0));
+      q.setRPY(0, 0, state.a);
+      tf::Transform pose(q, tf::Point(state.x, state.y, 0.0));
       // FIXME: publish this on a separate topic like /base/odom
-      transforms.sendTransform(tf::StampedTransform(pose, ros::Time::now(), frame_id_, child_frame_id_));
+      transforms.sendTransform(tf::StampedTransform(pose, ros::Time(state.base_stamp), frame_id_, child_frame_id_));
+      if(latency_.enabled()) {
+        double now = ros::WallTime::now().toSec();
+        latency_.add(LatencyTracer::ENCODER_TO_TF, 0, now, now - state.base_stamp);
+      }
       // FIXME: publish actual base twist on topic like /base/vel
-      tf_publish_counter = 0;
     }
 
 
     // publish torso position
-    if(++js_publish_counter == js_send_rate) {
+    if(outputs_.due(js_output)) {
       sensor_msgs::JointState msg;
-      msg.header.stamp = ros::Time::now();
-      msg.name.push_back("triangle_base_joint");
-      msg.position.push_back(torso_pos);
-      // FIXME: report the actual values
-      msg.velocity.push_back(0.0);
+      msg.header.stamp = ros::Time(state.torso_stamp);
+      msg.name.push_back(torso_joint_name);
+      msg.position.push_back(state.torso_pos);
+      msg.velocity.push_back(torso.velocity / torso_ticks_to_m);
+      // FIXME: report the actual effort
       msg.effort.push_back(0.0);
       js_pub_.publish(msg);
-      js_publish_counter = 0;
+
+      control_msgs::JointTrajectoryControllerState controller_state;
+      controller_state.header.stamp = msg.header.stamp;
+      controller_state.joint_names.push_back(torso_joint_name);
+      controller_state.desired.positions.push_back(torso.setpoint / torso_ticks_to_m);
+      controller_state.actual.positions.push_back(state.torso_pos);
+      controller_state.actual.velocities.push_back(msg.velocity[0]);
+      controller_state.error.positions.push_back(controller_state.desired.positions[0] - state.torso_pos);
+      torso_state_pub_.publish(controller_state);
     }
 
     // publish hard runstop state
     // FIXME: report real hard E-stop status
     // in Rosie, the hard runstop was read from the ethercat drives
     // in Boxy it is part of the state reported by the ELMO drives
-    if(++runstop_publish_counter == runstop_send_rate) {
-      int runstop=0;
-      omnidrive_status(0,0,0,0,0, &runstop);
+    if(outputs_.due(runstop_output)) {
       std_msgs::Bool msg;
-      msg.data = (runstop != 0);
+      msg.data = (state.estop != 0);
       hard_runstop_pub.publish(msg);
-      runstop_publish_counter = 0;
     }
 
-    // process incoming messages
-    ros::spinOnce();
+    // one row per path: count, min, mean, p50, p90, p99, max (us)
+    if(latency_output >= 0 && outputs_.due(latency_output)) {
+      std_msgs::Float64MultiArray msg;
+      msg.layout.dim.resize(2);
+      msg.layout.dim[0].label = "cmd_to_write,write_to_bus,cmd_to_bus,encoder_to_tf";
+      msg.layout.dim[0].size = LatencyTracer::NUM_PATHS;
+      msg.layout.dim[0].stride = LatencyTracer::NUM_PATHS * 7;
+      msg.layout.dim[1].label = "count,min,mean,p50,p90,p99,max";
+      msg.layout.dim[1].size = 7;
+      msg.layout.dim[1].stride = 7;
+      for(int i=0; i < LatencyTracer::NUM_PATHS; i++) {
+        const LatencyTracer::Histogram &h = latency_.histogram(i);
+        msg.data.push_back(h.count);
+        msg.data.push_back(h.min * 1e6);
+        msg.data.push_back(h.mean() * 1e6);
+        msg.data.push_back(h.percentile(0.5) * 1e6);
+        msg.data.push_back(h.percentile(0.9) * 1e6);
+        msg.data.push_back(h.percentile(0.99) * 1e6);
+        msg.data.push_back(h.max * 1e6);
+      }
+      latency_pub_.publish(msg);
+    }
 
     diagnostic_.update();
-    r.sleep();
   }
 
+  __atomic_store_n(&running_, 0, __ATOMIC_RELAXED);
+  pthread_join(control_thread_, 0);
+
   omnidrive_shutdown();
 
 }
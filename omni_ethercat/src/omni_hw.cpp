@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2009 by Ingo Kresse <kresse@in.tum.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <math.h>
+
+#include "omni_hw.h"
+
+extern "C" {
+#include "omnilib.h"
+}
+
+// torso set-points closer than this to the last one are not sent again
+const double torso_deadband = 1e-6;  // m
+
+
+OmniHW::OmniHW(const std::vector<std::string>& wheel_joints, const std::string& torso_joint,
+               double wheel_radius) :
+  wheel_radius_(wheel_radius), wheel_joints_(wheel_joints), torso_sent_(0.0), initialized_(false)
+{
+  for(int i=0; i < NUM_DRIVES_; i++) {
+    position_[i] = velocity_[i] = effort_[i] = command_[i] = 0.0;
+
+    std::string name = (i == TORSO_DRIVE_SEQ) ? torso_joint : wheel_joints[i];
+    hardware_interface::JointStateHandle state(name, &position_[i], &velocity_[i], &effort_[i]);
+    state_interface_.registerHandle(state);
+
+    hardware_interface::JointHandle command(state, &command_[i]);
+    if(i == TORSO_DRIVE_SEQ)
+      position_interface_.registerHandle(command);
+    else
+      velocity_interface_.registerHandle(command);
+  }
+
+  registerInterface(&state_interface_);
+  registerInterface(&velocity_interface_);
+  registerInterface(&position_interface_);
+}
+
+
+void OmniHW::read(const ros::Time& time, const ros::Duration& period)
+{
+  double x, y, a, torso_pos;
+
+  // updates the snapshot omnidrive_joint_state() reads, and the odometry
+  omnidrive_odometry(&x, &y, &a, &torso_pos);
+  omnidrive_joint_state(position_, velocity_, effort_);
+
+  for(int i=0; i < 4; i++) {
+    position_[i] /= wheel_radius_;
+    velocity_[i] /= wheel_radius_;
+  }
+
+  double stamp = omnidrive_odometry_stamp();
+  stamp_ = (stamp > 0) ? ros::Time(stamp) : time;
+
+  // hold the torso where it is until a controller commands it
+  if(!initialized_) {
+    command_[TORSO_DRIVE_SEQ] = torso_sent_ = position_[TORSO_DRIVE_SEQ];
+    initialized_ = true;
+  }
+}
+
+
+void OmniHW::write(const ros::Time& time, const ros::Duration& period)
+{
+  double speeds[4];
+
+  // a stopped controller leaves its last command behind
+  for(int i=0; i < 4; i++) {
+    if(!claimed_wheels_.count(wheel_joints_[i]))
+      command_[i] = 0.0;
+    speeds[i] = command_[i] * wheel_radius_;
+  }
+  omnidrive_drive_wheels(speeds);
+
+  // a one-point trajectory due at the next cycle, the torso controller
+  // limits the set-point rate to the configured velocity
+  double target = command_[TORSO_DRIVE_SEQ];
+  if(initialized_ && !isnan(target) && fabs(target - torso_sent_) > torso_deadband) {
+    double t = period.toSec();
+    if(omnidrive_torso_move(&t, &target, 1) == 0)
+      torso_sent_ = target;
+  }
+}
+
+
+void OmniHW::doSwitch(const std::list<hardware_interface::ControllerInfo>& start_list,
+                      const std::list<hardware_interface::ControllerInfo>& stop_list)
+{
+  typedef std::list<hardware_interface::ControllerInfo>::const_iterator ControllerIt;
+  typedef std::vector<hardware_interface::InterfaceResources>::const_iterator ResourcesIt;
+
+  // a joint belongs to at most one running controller, the controller
+  // manager has checked that for the new set. Only the wheels are looked
+  // up, the torso joint may be in here as well.
+  for(ControllerIt c = stop_list.begin(); c != stop_list.end(); ++c)
+    for(ResourcesIt r = c->claimed_resources.begin(); r != c->claimed_resources.end(); ++r)
+      for(std::set<std::string>::const_iterator j = r->resources.begin(); j != r->resources.end(); ++j)
+        claimed_wheels_.erase(*j);
+
+  for(ControllerIt c = start_list.begin(); c != start_list.end(); ++c)
+    for(ResourcesIt r = c->claimed_resources.begin(); r != c->claimed_resources.end(); ++r)
+      claimed_wheels_.insert(r->resources.begin(), r->resources.end());
+}
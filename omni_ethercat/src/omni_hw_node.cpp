@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2009 by Ingo Kresse <kresse@in.tum.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// Runs a controller manager on the base and the torso, see omni_hw.h. It
+// owns the bus, so it replaces the omni_ethercat node and reads the same
+// bus layout parameters.
+
+#include <pthread.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include <ros/ros.h>
+#include <controller_manager/controller_manager.h>
+
+#include "omni_hw.h"
+#include "layout_params.h"
+
+extern "C" {
+#include "omnilib.h"
+#include "omni_params.h"
+}
+
+struct ControlLoop
+{
+  OmniHW* hw;
+  controller_manager::ControllerManager* cm;
+  int frequency;
+  int running;
+};
+
+
+// read, update and write once per cycle; nothing in here may block
+static void* controlThread(void* arg)
+{
+  ControlLoop* loop = (ControlLoop*) arg;
+  const long period = 1000000000L / loop->frequency;
+  struct timespec tick, now, last;
+
+  clock_gettime(CLOCK_MONOTONIC, &tick);
+  last = tick;
+
+  while(__atomic_load_n(&loop->running, __ATOMIC_RELAXED)) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ros::Duration dt((now.tv_sec - last.tv_sec) + (now.tv_nsec - last.tv_nsec) / 1e9);
+    last = now;
+
+    loop->hw->read(ros::Time::now(), dt);
+    loop->cm->update(loop->hw->stamp(), dt);
+    loop->hw->write(loop->hw->stamp(), dt);
+
+    tick.tv_nsec += period;
+    while(tick.tv_nsec >= 1000000000L) {
+      tick.tv_nsec -= 1000000000L;
+      tick.tv_sec++;
+    }
+
+    // skip cycles we missed instead of catching up
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(now.tv_sec > tick.tv_sec || (now.tv_sec == tick.tv_sec && now.tv_nsec > tick.tv_nsec))
+      tick = now;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tick, NULL);
+  }
+
+  return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  ros::init(argc, argv, "omni_hw");
+  ros::NodeHandle n("omnidrive");
+
+  // the loop runs at the wheel domain rate unless told otherwise
+  omni_layout_t layout;
+  loadBusLayout(n, &layout);
+
+  ControlLoop loop;
+  n.param("control_frequency", loop.frequency, (int) layout.domains[0].frequency);
+
+  std::vector<std::string> wheel_joints;
+  std::string torso_joint;
+  double wheel_radius;
+  if(!n.getParam("wheel_joints", wheel_joints)) {
+    wheel_joints.push_back("wheel_front_left_joint");
+    wheel_joints.push_back("wheel_back_left_joint");
+    wheel_joints.push_back("wheel_back_right_joint");
+    wheel_joints.push_back("wheel_front_right_joint");
+  }
+  n.param("torso_joint", torso_joint, std::string("triangle_base_joint"));
+  n.param("wheel_radius", wheel_radius, 0.1016);  // 8" wheels
+
+  if(wheel_joints.size() != 4 || !(wheel_radius > 0) || loop.frequency <= 0) {
+    ROS_ERROR("need 4 wheel_joints, a positive wheel_radius and control_frequency");
+    return 1;
+  }
+
+  // the bus stops the wheels when the loop misses a watchdog period
+  omni_params_t params;
+  omni_params_get(&params);
+  if(2.0 / loop.frequency > params.watchdog_period) {
+    ROS_ERROR("control_frequency must be at least %.0f Hz for a watchdog_period of %.3f s",
+              2.0 / params.watchdog_period, params.watchdog_period);
+    return 1;
+  }
+
+  if(omnidrive_init(&layout) != 0) {
+    ROS_ERROR("failed to initialize omnidrive");
+    ROS_ERROR("check dmesg and try \"sudo /etc/init.d/ethercat restart\"");
+    return 1;
+  }
+
+  OmniHW hw(wheel_joints, torso_joint, wheel_radius);
+  controller_manager::ControllerManager cm(&hw, n);
+  loop.hw = &hw;
+  loop.cm = &cm;
+
+  // controller manager services are served while the loop runs
+  ros::AsyncSpinner spinner(1);
+  spinner.start();
+
+  omnidrive_poweron();
+
+  // just below the EtherCAT threads, like the control loop of omni_ethercat
+  pthread_t thread;
+  pthread_attr_t tattr;
+  struct sched_param sparam;
+  sparam.sched_priority = sched_get_priority_max(SCHED_FIFO) - 10;
+  pthread_attr_init(&tattr);
+  pthread_attr_setschedpolicy(&tattr, SCHED_FIFO);
+  pthread_attr_setschedparam(&tattr, &sparam);
+  pthread_attr_setinheritsched(&tattr, PTHREAD_EXPLICIT_SCHED);
+
+  loop.running = 1;
+  if(pthread_create(&thread, &tattr, &controlThread, &loop) != 0) {
+    ROS_WARN("could not start a realtime control thread, running it with normal priority");
+    if(pthread_create(&thread, 0, &controlThread, &loop) != 0) {
+      ROS_ERROR("could not start the control thread");
+      pthread_attr_destroy(&tattr);
+      omnidrive_shutdown();
+      return 1;
+    }
+  }
+  pthread_attr_destroy(&tattr);
+
+  ros::waitForShutdown();
+
+  __atomic_store_n(&loop.running, 0, __ATOMIC_RELAXED);
+  pthread_join(thread, 0);
+
+  omnidrive_poweroff();
+  omnidrive_shutdown();
+
+  return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <string.h>
+
+#include "dcclock.h"
+
+/* Filter gains, critically damped: beta = alpha^2 / (2 - alpha) */
+#define ALPHA (1.0 / 32)
+#define BETA  (ALPHA * ALPHA / (2 - ALPHA))
+
+/* A larger error is a clock step or a lost reference, start over */
+#define MAX_ERROR_NS 1000000
+
+
+static void restart(dc_clock_t *c, int64_t host_ns)
+{
+  c->base_ns = host_ns - (int64_t) c->dc_ns;
+  c->offset_ns = 0.0;
+  c->drift = 0.0;
+  c->error_ns = 0;
+  c->valid = 1;
+}
+
+
+void dc_clock_init(dc_clock_t *c)
+{
+  memset(c, 0, sizeof(*c));
+}
+
+
+int64_t dc_clock_update(dc_clock_t *c, uint32_t ref_time, int64_t host_ns)
+{
+  uint32_t dt;
+  double predicted, error;
+
+  if (!c->valid) {
+    c->dc_ns = ref_time;
+    restart(c, host_ns);
+    return host_ns;
+  }
+
+  /* the 32 bit clock wraps every 4.3 s, we are called much more often */
+  dt = ref_time - (uint32_t) c->dc_ns;
+  c->dc_ns += dt;
+
+  predicted = c->offset_ns + c->drift * dt;
+  error = (double) (host_ns - (int64_t) c->dc_ns - c->base_ns) - predicted;
+
+  if (error > MAX_ERROR_NS || error < -MAX_ERROR_NS) {
+    c->resets++;
+    restart(c, host_ns);
+    return host_ns;
+  }
+
+  c->offset_ns = predicted + ALPHA * error;
+  if (dt > 0)
+    c->drift += BETA * error / dt;
+
+  c->error_ns = (int32_t) error;
+  if (c->error_ns > c->max_error_ns)
+    c->max_error_ns = c->error_ns;
+  else if (-c->error_ns > c->max_error_ns)
+    c->max_error_ns = -c->error_ns;
+
+  return (int64_t) c->dc_ns + c->base_ns + (int64_t) c->offset_ns;
+}
@@ -0,0 +1,274 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "discovery.h"
+
+/* The master scans the bus when it is requested, wait at most this long */
+#define SCAN_WAIT_US   5000000
+#define SCAN_POLL_US   10000
+
+#define CACHE_VERSION  1
+
+/* Known drive profiles. All drives are CiA-402 and get the same PDO mapping,
+ * the role of a drive (wheel or torso) follows from its place in the
+ * layout. */
+static const slave_profile_t profiles[] = {
+  {0x0000009a, 0x00030924, "Elmo Gold"},
+  {0, 0, NULL}
+};
+
+/* Enumeration state of one master */
+typedef struct bus_cursor {
+  ec_master_t *master;
+  unsigned int slave_count;
+  uint16_t next_position;
+} bus_cursor_t;
+
+
+const slave_profile_t *find_slave_profile(uint32_t vendor_id, uint32_t product_code)
+{
+  const slave_profile_t *p;
+
+  for (p = profiles; p->name; p++)
+    if (p->vendor_id == vendor_id && p->product_code == product_code)
+      return p;
+
+  return NULL;
+}
+
+
+static int wait_for_scan(ec_master_t *master, ec_master_info_t *info)
+{
+  int waited;
+
+  for (waited = 0; waited < SCAN_WAIT_US; waited += SCAN_POLL_US) {
+    if (ecrt_master(master, info))
+      return -1;
+    if (!info->scan_busy)
+      return 0;
+    usleep(SCAN_POLL_US);
+  }
+
+  printf("Bus scan did not finish within %d s\n", SCAN_WAIT_US / 1000000);
+  return -1;
+}
+
+
+static bus_cursor_t *get_cursor(bus_cursor_t *cursors, int *num_cursors, ec_master_t *master)
+{
+  ec_master_info_t info;
+  int i;
+
+  for (i = 0; i < *num_cursors; i++)
+    if (cursors[i].master == master)
+      return &cursors[i];
+
+  if (wait_for_scan(master, &info))
+    return NULL;
+
+  cursors[*num_cursors].master = master;
+  cursors[*num_cursors].slave_count = info.slave_count;
+  cursors[*num_cursors].next_position = 0;
+  return &cursors[(*num_cursors)++];
+}
+
+
+static void assign_drive(omni_drive_layout_t *d, const ec_slave_info_t *s)
+{
+  d->alias = 0;   /* absolute positions */
+  d->position = s->position;
+  d->vendor_id = s->vendor_id;
+  d->product_code = s->product_code;
+  d->serial_number = s->serial_number;
+}
+
+
+/* Full scan, drives are assigned to matching slaves in bus order */
+static int scan_bus(omni_layout_t *layout, ec_master_t *const *drive_master)
+{
+  bus_cursor_t cursors[OMNI_NUM_DRIVES];
+  int num_cursors = 0;
+  int i;
+
+  printf("Scanning the bus...\n");
+
+  for (i = 0; i < OMNI_NUM_DRIVES; i++) {
+    unsigned int master_index = layout->domains[layout->drives[i].domain].master;
+    bus_cursor_t *c = get_cursor(cursors, &num_cursors, drive_master[i]);
+    int found = 0;
+
+    if (!c)
+      return -1;
+
+    while (!found && c->next_position < c->slave_count) {
+      ec_slave_info_t s;
+      const slave_profile_t *p;
+
+      if (ecrt_master_get_slave(c->master, c->next_position++, &s)) {
+        printf("Master%u: failed to read slave %u\n", master_index, c->next_position - 1);
+        return -1;
+      }
+
+      p = find_slave_profile(s.vendor_id, s.product_code);
+      if (!p) {
+        printf("Master%u: skipping slave %u '%s' (0x%08x, 0x%08x)\n", master_index,
+               s.position, s.name, s.vendor_id, s.product_code);
+        continue;
+      }
+
+      printf("m%d: %s at master %u position %u, serial %u\n", i, p->name,
+             master_index, s.position, s.serial_number);
+      assign_drive(&layout->drives[i], &s);
+      found = 1;
+    }
+
+    if (!found) {
+      printf("m%d: no matching slave left on master %u (%u slaves)\n", i,
+             master_index, c->slave_count);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+
+/*****************************************************************************/
+
+/* The cache holds the slave count of each drive's master and the identity
+ * of the slave at the drive's position. */
+
+static int load_cache(const char *path, omni_drive_layout_t *drives, unsigned int *slave_count)
+{
+  FILE *f = fopen(path, "r");
+  int version, i, ok = 1;
+
+  if (!f)
+    return -1;
+
+  if (fscanf(f, "omni_ethercat topology %d\n", &version) != 1 || version != CACHE_VERSION)
+    ok = 0;
+
+  for (i = 0; ok && i < OMNI_NUM_DRIVES; i++) {
+    int drive;
+    unsigned int position;
+
+    if (fscanf(f, "drive %d slaves %u position %u vendor %x product %x serial %u\n",
+               &drive, &slave_count[i], &position, &drives[i].vendor_id,
+               &drives[i].product_code, &drives[i].serial_number) != 6 || drive != i)
+      ok = 0;
+
+    drives[i].alias = 0;
+    drives[i].position = position;
+  }
+
+  fclose(f);
+  return ok ? 0 : -1;
+}
+
+
+static void save_cache(const char *path, const omni_layout_t *layout, ec_master_t *const *drive_master)
+{
+  char tmp[OMNI_MAX_PATH + 8];
+  ec_master_info_t info;
+  FILE *f;
+  int i;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  f = fopen(tmp, "w");
+  if (!f) {
+    printf("Could not write the topology cache %s\n", tmp);
+    return;
+  }
+
+  fprintf(f, "omni_ethercat topology %d\n", CACHE_VERSION);
+  for (i = 0; i < OMNI_NUM_DRIVES; i++) {
+    const omni_drive_layout_t *d = &layout->drives[i];
+
+    if (ecrt_master(drive_master[i], &info))
+      info.slave_count = 0;   /* never matches, forces a scan next time */
+
+    fprintf(f, "drive %d slaves %u position %u vendor 0x%08x product 0x%08x serial %u\n",
+            i, info.slave_count, d->position, d->vendor_id, d->product_code, d->serial_number);
+  }
+
+  /* replace the old cache only once the new one is complete */
+  if (fclose(f) == 0 && rename(tmp, path) == 0)
+    printf("Topology cached in %s\n", path);
+  else
+    unlink(tmp);
+}
+
+
+/* Checks only the cached slaves instead of walking the whole bus */
+static int verify_cache(const omni_drive_layout_t *drives, const unsigned int *slave_count,
+                        ec_master_t *const *drive_master)
+{
+  int i;
+
+  for (i = 0; i < OMNI_NUM_DRIVES; i++) {
+    ec_master_info_t info;
+    ec_slave_info_t s;
+
+    if (wait_for_scan(drive_master[i], &info) || info.slave_count != slave_count[i])
+      return -1;
+
+    if (ecrt_master_get_slave(drive_master[i], drives[i].position, &s))
+      return -1;
+
+    if (s.vendor_id != drives[i].vendor_id || s.product_code != drives[i].product_code ||
+        s.serial_number != drives[i].serial_number ||
+        !find_slave_profile(s.vendor_id, s.product_code))
+      return -1;
+  }
+
+  return 0;
+}
+
+
+int discover_drives(omni_layout_t *layout, ec_master_t *const *drive_master)
+{
+  omni_drive_layout_t cached[OMNI_NUM_DRIVES];
+  unsigned int slave_count[OMNI_NUM_DRIVES];
+  int i;
+
+  if (layout->topology_cache[0] &&
+      load_cache(layout->topology_cache, cached, slave_count) == 0) {
+    if (verify_cache(cached, slave_count, drive_master) == 0) {
+      printf("Topology unchanged, using %s\n", layout->topology_cache);
+      for (i = 0; i < OMNI_NUM_DRIVES; i++) {
+        cached[i].domain = layout->drives[i].domain;
+        layout->drives[i] = cached[i];
+      }
+      return 0;
+    }
+    printf("Topology changed since %s was written\n", layout->topology_cache);
+  }
+
+  if (scan_bus(layout, drive_master))
+    return -1;
+
+  if (layout->topology_cache[0])
+    save_cache(layout->topology_cache, layout, drive_master);
+
+  return 0;
+}
@@ -0,0 +1,89 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "drivestats.h"
+
+
+int cia402_state(uint16_t statusword)
+{
+  if ((statusword & 0x4f) == 0x00) return CIA402_NOT_READY;
+  if ((statusword & 0x4f) == 0x40) return CIA402_SWITCH_ON_DISABLED;
+  if ((statusword & 0x6f) == 0x21) return CIA402_READY_TO_SWITCH_ON;
+  if ((statusword & 0x6f) == 0x23) return CIA402_SWITCHED_ON;
+  if ((statusword & 0x6f) == 0x27) return CIA402_OPERATION_ENABLED;
+  if ((statusword & 0x6f) == 0x07) return CIA402_QUICK_STOP_ACTIVE;
+  if ((statusword & 0x4f) == 0x0f) return CIA402_FAULT_REACTION;
+  if ((statusword & 0x4f) == 0x08) return CIA402_FAULT;
+  return CIA402_NOT_READY;
+}
+
+
+const char *cia402_state_name(int state)
+{
+  static const char *names[CIA402_NUM_STATES] = {
+    "not ready", "switch on disabled", "ready to switch on", "switched on",
+    "operation enabled", "quick stop active", "fault reaction active", "fault"};
+
+  return (state >= 0 && state < CIA402_NUM_STATES) ? names[state] : "unknown";
+}
+
+
+void drive_stats_init(drive_stats_t *s)
+{
+  memset(s, 0, sizeof(*s));
+}
+
+
+void drive_stats_update(drive_stats_t *s, uint16_t statusword, int16_t torque,
+                        int32_t following_error, int32_t period_ns)
+{
+  int bit, state = cia402_state(statusword);
+  uint16_t flipped;
+  double k = period_ns / (STATS_TIME_CONSTANT * 1e9 + period_ns);
+
+  if (s->valid) {
+    flipped = statusword ^ s->statusword;
+    for (bit = 0; flipped; bit++, flipped >>= 1)
+      if (flipped & 1)
+        s->bit_flips[bit]++;
+
+    if (state == CIA402_FAULT && s->state != CIA402_FAULT && s->state != CIA402_FAULT_REACTION)
+      s->faults++;
+    if (state == CIA402_FAULT_REACTION && s->state != CIA402_FAULT_REACTION)
+      s->faults++;
+  }
+
+  s->state_ns[state] += period_ns;
+  s->statusword = statusword;
+  s->state = state;
+  s->valid = 1;
+
+  s->torque_ms += ((double) torque * torque - s->torque_ms) * k;
+  if (abs(torque) > s->torque_peak)
+    s->torque_peak = abs(torque);
+
+  if (state == CIA402_OPERATION_ENABLED) {
+    s->following_error_ms += ((double) following_error * following_error -
+                              s->following_error_ms) * k;
+    if (abs(following_error) > s->following_error_peak)
+      s->following_error_peak = abs(following_error);
+  }
+}
@@ -0,0 +1,89 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <math.h>
+
+#include "kinematics.h"
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__clang__)
+#define BATCH_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define BATCH_CLONES
+#endif
+
+
+/* The expressions are the ones of omnidrive_drive(), keep them in sync
+   with the batch loop below. */
+double omni_limit_factor(const omni_drive_limits_t *l, double x, double y, double a)
+{
+  // cartesian limit: add linear and angular parts
+  double corr_cart = l->cart_limit / (sqrt(x*x + y*y) + l->limit_radius*fabs(a));
+
+  // wheel limit: for one wheel, x,y and a always add up
+  double corr_wheels = l->wheel_limit / (fabs(x) + fabs(y) + fabs(a));
+
+  // get limiting factor as min(1, corr_cart, corr_wheels)
+  return (1 < corr_cart) ? 1 : ((corr_cart < corr_wheels) ? corr_cart : corr_wheels);
+}
+
+
+/* Branch-free, so GCC turns the loop body into packed operations. Counting
+   the feasible twists in here would keep it scalar, the caller does that. */
+BATCH_CLONES
+void omni_feasibility_batch(const omni_drive_limits_t *l, size_t n,
+                            const double *restrict x, const double *restrict y,
+                            const double *restrict a, double *restrict scale,
+                            double *restrict w0, double *restrict w1,
+                            double *restrict w2, double *restrict w3)
+{
+  const double cart_limit = l->cart_limit, wheel_limit = l->wheel_limit;
+  const double radius = l->limit_radius, max = l->max_wheel_speed;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    double corr_cart = cart_limit / (sqrt(x[i]*x[i] + y[i]*y[i]) + radius*fabs(a[i]));
+    double corr_wheels = wheel_limit / (fabs(x[i]) + fabs(y[i]) + fabs(a[i]));
+    double corr;
+
+    // min(1, corr_cart, corr_wheels) as in omni_limit_factor(); nested
+    // conditionals keep GCC from if-converting the loop, so one at a time
+    corr = (corr_cart < corr_wheels) ? corr_cart : corr_wheels;
+    corr = (1 < corr_cart) ? 1 : corr;
+
+    // jac_forward() times corr
+    double v0 = ( x[i] - y[i] + OMNI_WHEEL_ALPHA*a[i]) * corr;
+    double v1 = (-x[i] - y[i] + OMNI_WHEEL_ALPHA*a[i]) * corr;
+    double v2 = ( x[i] + y[i] + OMNI_WHEEL_ALPHA*a[i]) * corr;
+    double v3 = (-x[i] + y[i] + OMNI_WHEEL_ALPHA*a[i]) * corr;
+
+    scale[i] = corr;
+    // enforce_max_velocities() of the realtime thread
+    v0 = v0 > max ? max : v0;
+    v0 = v0 < -max ? -max : v0;
+    v1 = v1 > max ? max : v1;
+    v1 = v1 < -max ? -max : v1;
+    v2 = v2 > max ? max : v2;
+    v2 = v2 < -max ? -max : v2;
+    v3 = v3 > max ? max : v3;
+    v3 = v3 < -max ? -max : v3;
+    w0[i] = v0;
+    w1[i] = v1;
+    w2[i] = v2;
+    w3[i] = v3;
+  }
+}
@@ -0,0 +1,77 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <time.h>
+
+#include "latency.h"
+
+typedef struct latency_mark {
+  uint32_t seq;             // written last, 0 while empty
+  int64_t t_ns;
+} latency_mark_t;
+
+static int enabled = 0;
+static latency_mark_t marks[LATENCY_NUM_POINTS][LATENCY_SLOTS];
+
+
+void latency_enable(int on)
+{
+  __atomic_store_n(&enabled, on, __ATOMIC_RELAXED);
+}
+
+
+int latency_enabled(void)
+{
+  return __atomic_load_n(&enabled, __ATOMIC_RELAXED);
+}
+
+
+void latency_mark(int point, uint32_t seq)
+{
+  latency_mark_t *m;
+  struct timespec t;
+
+  if (!latency_enabled() || seq == 0)
+    return;
+
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  m = &marks[point][seq & (LATENCY_SLOTS - 1)];
+
+  /* invalidate first, a reader must not pair the old seq with the new time */
+  __atomic_store_n(&m->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&m->t_ns, t.tv_sec * 1000000000LL + t.tv_nsec, __ATOMIC_RELAXED);
+  __atomic_store_n(&m->seq, seq, __ATOMIC_RELEASE);
+}
+
+
+int latency_lookup(int point, uint32_t seq, int64_t *t_ns)
+{
+  latency_mark_t *m = &marks[point][seq & (LATENCY_SLOTS - 1)];
+  int64_t t;
+
+  if (__atomic_load_n(&m->seq, __ATOMIC_ACQUIRE) != seq)
+    return 0;
+  t = __atomic_load_n(&m->t_ns, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&m->seq, __ATOMIC_RELAXED) != seq)
+    return 0;
+
+  *t_ns = t;
+  return 1;
+}
@@ -0,0 +1,131 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdio.h>
+
+#include <pthread.h>
+
+#include "omni_params.h"
+#include "seqlock.h"
+
+/* A realtime reader must not spin on an update: a writer preempted by it on
+ * the same CPU would never finish. It keeps its copy and retries next cycle. */
+#define READ_TRIES 3
+
+#define DEFAULT_PARAMS {                                                  \
+  0,          /* version */                                               \
+                                                                          \
+  100.0,      /* speed */                                                 \
+  1000.0,     /* acceleration: brake from max. speed to 0 within 1.5cm */ \
+  0.6,        /* radius */                                                \
+  0.15,       /* watchdog_period */                                       \
+                                                                          \
+  1.0,        /* wheel_limit */                                           \
+  0.5,        /* cart_limit */                                            \
+  0.7,        /* limit_radius */                                          \
+  1.0,        /* odometry_correction */                                   \
+  0.05,       /* slip_warn */                                             \
+  0.2,        /* slip_error */                                            \
+  1.0,        /* slip_weight */                                           \
+                                                                          \
+  833333,     /* max_tick_speed: 5000 rpm/ 60s * 10000 ticks/rev */       \
+  5000000,    /* wheel_profile_acceleration */                            \
+  5000001     /* wheel_profile_deceleration */                            \
+}
+
+static const omni_params_t default_params = DEFAULT_PARAMS;
+
+/* Readers copy 'current' under the sequence lock, the mutex keeps the
+ * writers apart. */
+static omni_params_t current = DEFAULT_PARAMS;
+static seqlock_t current_lock = SEQLOCK_INITIALIZER;
+static pthread_mutex_t update_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+void omni_params_defaults(omni_params_t *p)
+{
+  *p = default_params;
+}
+
+
+int omni_params_invalid(const omni_params_t *p, char *reason, size_t size)
+{
+  const char *why = NULL;
+
+  if (!(p->speed >= 0))
+    why = "speed must not be negative";
+  else if (!(p->acceleration > 0))
+    why = "acceleration must be positive";
+  else if (!(p->radius > 0) || !(p->limit_radius > 0))
+    why = "radius must be positive";
+  else if (!(p->watchdog_period > 0 && p->watchdog_period <= 10.0))
+    why = "watchdog_period must be in (0, 10] s";
+  else if (!(p->wheel_limit >= 0) || !(p->cart_limit >= 0))
+    why = "speed limits must not be negative";
+  else if (!(p->odometry_correction > 0.5 && p->odometry_correction < 2.0))
+    why = "odometry_correction must be in (0.5, 2)";
+  else if (!(p->slip_warn >= 0) || !(p->slip_error >= p->slip_warn))
+    why = "slip thresholds must satisfy 0 <= slip_warn <= slip_error";
+  else if (!(p->slip_weight >= 0 && p->slip_weight <= 1.0))
+    why = "slip_weight must be in [0, 1]";
+  else if (p->max_tick_speed < 0 || p->max_tick_speed > 1000000)
+    why = "max_tick_speed must be in [0, 1000000] ticks/s";
+  else if (p->wheel_profile_acceleration == 0 || p->wheel_profile_deceleration == 0)
+    why = "wheel profile acceleration and deceleration must be positive";
+
+  if (why && reason && size > 0)
+    snprintf(reason, size, "%s", why);
+
+  return why != NULL;
+}
+
+
+int omni_params_set(const omni_params_t *p, char *reason, size_t size)
+{
+  omni_params_t next;
+
+  if (omni_params_invalid(p, reason, size))
+    return -1;
+
+  pthread_mutex_lock(&update_mutex);
+
+  next = *p;
+  next.version = current.version + 1;
+  seqlock_write(&current_lock, &current, &next, sizeof(next));
+
+  pthread_mutex_unlock(&update_mutex);
+  return 0;
+}
+
+
+void omni_params_get(omni_params_t *p)
+{
+  seqlock_read(&current_lock, p, &current, sizeof(*p), 0);
+}
+
+
+int omni_params_read(omni_params_t *p)
+{
+  omni_params_t copy;
+
+  if (!seqlock_read(&current_lock, &copy, &current, sizeof(copy), READ_TRIES))
+    return -1;
+
+  *p = copy;
+  return 0;
+}
@@ -36,7 +36,9 @@
 #include <math.h>
 
 #include "omnilib.h"
-#include "realtime.h" // defines omniread_t, omniwrite_t
+#include "realtime.h" // defines omni_hot_t, omni_cold_t, omniwrite_t
+#include "omni_params.h"
+#include "kinematics.h"
 #include <ecrt.h>  //part of igh's ethercat master
 
 
@@ -47,68 +49,115 @@
 // Calculated for the APM-SC05-ADK9 motors with 8" HD AndyMark wheels
 double odometry_constant=626594.7934;  // in ticks/m
 double drive_constant=626594.7934;
-double odometry_correction=1.0;
-//int max_tick_speed = 666666; // ticks/s : 4000 rpm/ 60s * 10000 ticks/rev
-int max_tick_speed = 833333; // ticks/s : 5000 rpm/ 60s * 10000 ticks/rev
+// odometry_correction, max_tick_speed and the speed limits: see omni_params.c
+
+double torso_ticks_per_m = 10000000.0;
 
 int odometry_initialized = 0;
 int32_t last_odometry_position[NUM_DRIVES]={0, 0, 0, 0, 0};
+uint32_t last_recovery_count[NUM_DRIVES]={0, 0, 0, 0, 0};
 double odometry[3] = {0, 0, 0};
+int64_t last_odometry_stamp = 0;
+slipstatus_t slip_status;
+
+uint32_t trace_seq = 0;  /* tag of the commands passed to omnidrive_drive() */
 
 int status[NUM_DRIVES];
+static omni_hot_t cur;   /* as of the last omnidrive_odometry() */
+static omni_params_t params;  /* also refreshed by omnidrive_odometry() */
 commstatus_t commstatus;
+uint32_t commstatus_version = 0;
+torsostatus_t torso_status;
+torsocmd_t torso_cmd;
 
 void omnidrive_speedcontrol();
 void configure_torso_drive();
 
-double static old_torso_pos = 0.0;
-
-int omnidrive_init(void)
+int omnidrive_init(const omni_layout_t *layout)
 {
   printf("---- omnidrive_init ---- \n");
   int counter=0;
 
+  omni_params_get(&params);
 
 
-  if(!start_omni_realtime(max_tick_speed))
+
+  if(!start_omni_realtime(layout))
     return -1;
 
   omnidrive_poweroff();
 
-  omniread_t cur = omni_read_data();
+  omni_cold_t cold;
+  omni_read_cold(&cold);
 
   for (counter = 0; counter < 200; counter ++) {
-    printf("---------working_counter: %d\n", cur.working_counter_state);
-    if (cur.working_counter_state >= 2)
+    printf("---------working_counter: %d\n", cold.working_counter_state);
+    if (cold.working_counter_state >= 2)
       break;
 
     usleep(100000);
-    cur = omni_read_data();
+    omni_read_cold(&cold);
   }
 
-  printf("After init, working_counter_state = %d\n", cur.working_counter_state);
-  printf("After init, working_counter = %d\n", cur.working_counter);
+  printf("After init, working_counter_state = %d\n", cold.working_counter_state);
+  printf("After init, working_counter = %d\n", cold.working_counter);
 
-  if (cur.working_counter_state < 2) {// failed to initialize modules...
-    printf("cur.working_counter_state = %d\n", cur.working_counter_state);
+  if (cold.working_counter_state < 2) {// failed to initialize modules...
+    printf("cold.working_counter_state = %d\n", cold.working_counter_state);
     return -1;
   }
 
   omnidrive_speedcontrol();
   configure_torso_drive();
-  omnidrive_recover();
+
+  memset(&torso_cmd, 0, sizeof(torso_cmd));
+  torso_cmd.mode = TORSO_MODE_PROFILE;
+  torso_cmd.limits.max_velocity = 200000;
+  torso_cmd.limits.acceleration = 10000000;
+  torso_cmd.limits.deceleration = 10000000;
+  omni_write_torso(&torso_cmd);
   omnidrive_poweron();
 
+  for (counter = 0; counter < 200 && !omnidrive_powered(); counter++)
+    usleep(10000);
+
+  if (!omnidrive_powered())
+    printf("Drives not enabled after init, check the emergency stop\n");
+
   printf("Returning happy\n");
   return 0;
 }
 
 
+/* Drives which can be reached show neither 'ready to switch on', 'switched
+ * on' nor 'operation enabled' */
+static int drives_disabled(void)
+{
+  omni_hot_t hot;
+  int i;
+
+  omni_read_hot(&hot);
+  for(i=0; i < NUM_DRIVES; i++)
+    if(!hot.drive_recovering[i] && (hot.status[i] & 0x07) != 0)
+      return 0;
+
+  return 1;
+}
+
 int omnidrive_shutdown(void)
 {
-  omnidrive_drive(0, 0, 0, 0);   /* SAFETY */  //FIXME: 0 as goal torso pos might be wrong
+  int counter;
 
+  omnidrive_drive(0, 0, 0);   /* SAFETY */
+
+  /* the slowest domain may need several cycles to send the controlword
+   * and read back the statusword */
   omnidrive_poweroff();
+  for (counter = 0; counter < 1000 && !drives_disabled(); counter++)
+    usleep(1000);
+
+  if (!drives_disabled())
+    printf("Drives still enabled after 1 s, stopping the bus anyway\n");
 
   stop_omni_realtime();
 
@@ -139,7 +188,7 @@ void jac_forward(double *in, double *out)
 
   int i,j;
 //#define alpha (0.3425 + 0.24)
-#define alpha (0.39225 + 0.303495)
+#define alpha OMNI_WHEEL_ALPHA
   double C_J_fwd[4][3] = {{ 1, -1, alpha},
                           {-1, -1, alpha},
                           { 1,  1, alpha},
@@ -157,6 +206,60 @@ void jac_forward(double *in, double *out)
 }
 
 
+static double det3(double m[3][3])
+{
+  return m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+       - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+       + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+}
+
+
+/*! Weighted least squares version of jac_inverse: out minimizes
+ *  sum(weight[i] * (in[i] - (C*J_fwd*out)[i])^2). Returns -1 and leaves
+ *  out alone if the weights leave the base underdetermined.
+ */
+int jac_inverse_weighted(double *in, const double *weight, double *out)
+{
+  double J[4][3], A[3][3], b[3], M[3][3], det, unit[3], column[4];
+  int i, j, k;
+
+  // columns of C*J_fwd
+  for(j=0; j < 3; j++) {
+    for(k=0; k < 3; k++)
+      unit[k] = (j == k);
+    jac_forward(unit, column);
+    for(i=0; i < 4; i++)
+      J[i][j] = column[i];
+  }
+
+  // normal equations: (J^T W J) out = J^T W in
+  for(j=0; j < 3; j++) {
+    b[j] = 0;
+    for(k=0; k < 3; k++) {
+      A[j][k] = 0;
+      for(i=0; i < 4; i++)
+        A[j][k] += J[i][j]*weight[i]*J[i][k];
+    }
+    for(i=0; i < 4; i++)
+      b[j] += J[i][j]*weight[i]*in[i];
+  }
+
+  det = det3(A);
+  if(fabs(det) < 1e-9)
+    return -1;
+
+  // Cramer's rule
+  for(j=0; j < 3; j++) {
+    memcpy(M, A, sizeof(M));
+    for(k=0; k < 3; k++)
+      M[k][j] = b[k];
+    out[j] = det3(M) / det;
+  }
+
+  return 0;
+}
+
+
 void jac_inverse(double *in, double *out)
 {
   // computing:
@@ -173,7 +276,7 @@ void jac_inverse(double *in, double *out)
 
   int i,j;
 //#define alpha (0.3425 + 0.24)
-#define alpha (0.39225 + 0.303495)
+#define alpha OMNI_WHEEL_ALPHA
   double J_inv_C[3][4] = {{ 0.25,      -0.25,       0.25,      -0.25},
                           {-0.25,      -0.25,       0.25,       0.25},
                           { 0.25/alpha, 0.25/alpha, 0.25/alpha, 0.25/alpha}};
@@ -190,16 +293,22 @@ void jac_inverse(double *in, double *out)
 }
 
 
-int omnidrive_drive(double x, double y, double a, double torso_pos)
+void omnidrive_drive_limits(omni_drive_limits_t *limits)
+{
+  limits->wheel_limit = params.wheel_limit;
+  limits->cart_limit = params.cart_limit;
+  limits->limit_radius = params.limit_radius;
+  limits->max_wheel_speed = params.max_tick_speed / drive_constant;
+}
+
+int omnidrive_drive(double x, double y, double a)
 {
   // speed limits for the robot
-  double wheel_limit = 1.0 ;//0.8;  // a single wheel may drive this fast (m/s)
-  double cart_limit = 0.5 ; //0.5;   // any point on the robot may move this fast (m/s)
-  double radius = 0.7;       // (maximum) radius of the robot (m)
+  omni_drive_limits_t limits;
 
   // 0.5 m/s is 1831 ticks. kernel limit is 2000 ticks.
 
-  double corr_wheels, corr_cart, corr;
+  double corr;
 
   omniwrite_t tar;
   memset(&tar, 0, sizeof(tar));
@@ -210,17 +319,11 @@ int omnidrive_drive(double x, double y, double a, double torso_pos)
   //TODO: check if the robot is up. if not, return immediately
   
   tar.magic_version = OMNICOM_MAGIC_VERSION;
+  tar.trace_seq = trace_seq;
 
-  // check for limits
-
-  // cartesian limit: add linear and angular parts
-  corr_cart = cart_limit / (sqrt(x*x + y*y) + radius*fabs(a));
-
-  // wheel limit: for one wheel, x,y and a always add up
-  corr_wheels = wheel_limit / (fabs(x) + fabs(y) + fabs(a));
-
-  // get limiting factor as min(1, corr_cart, corr_wheels)
-  corr = (1 < corr_cart) ? 1 : ((corr_cart < corr_wheels) ? corr_cart : corr_wheels);
+  // check for limits, see kinematics.h for planners doing the same
+  omnidrive_drive_limits(&limits);
+  corr = omni_limit_factor(&limits, x, y, a);
 
   jac_forward(cartesian_speeds, wheel_speeds);
 
@@ -230,68 +333,91 @@ int omnidrive_drive(double x, double y, double a, double torso_pos)
     //tar.torque_set_value[i] = 0.0;
   }
 
-  //torso
-  if (old_torso_pos != torso_pos){
-      printf("omnilib-> new_torso_pos = %f\n", torso_pos);
-      tar.target_position[TORSO_DRIVE_SEQ] = torso_pos;
-      tar.send_new_torso_pos = 1;
-  } else {
-      tar.target_position[TORSO_DRIVE_SEQ] = old_torso_pos;
-      tar.send_new_torso_pos = 0;
-  }
+  /* Let the kernel know the velocities we want to set. */
+  omni_write_data(tar);
 
-  old_torso_pos = torso_pos;
+  return 0;
+}
 
-  tar.profile_velocity[TORSO_DRIVE_SEQ] = 250000;
-  tar.profile_acceleration[TORSO_DRIVE_SEQ] = 1000000;
-  tar.profile_deceleration[TORSO_DRIVE_SEQ] = 1000000;
+/* Wheels commanded one by one, e.g. by ros_control. Only wheel_limit
+   applies; all wheels are scaled alike so the direction of motion stays. */
+int omnidrive_drive_wheels(const double *speeds)
+{
+  double wheel_limit = params.wheel_limit;
+  double corr = 1.0;
+  omniwrite_t tar;
+  int i;
 
+  memset(&tar, 0, sizeof(tar));
+  tar.magic_version = OMNICOM_MAGIC_VERSION;
+  tar.trace_seq = trace_seq;
 
+  for(i = 0; i < 4; i++)
+    if(fabs(speeds[i]) * corr > wheel_limit)
+      corr = wheel_limit / fabs(speeds[i]);
+
+  for(i = 0; i < 4; i++)
+    tar.target_velocity[i] = speeds[i] * corr * drive_constant;
 
-  /* Let the kernel know the velocities we want to set. */
   omni_write_data(tar);
 
   return 0;
 }
 
+void omnidrive_trace_command(uint32_t seq)
+{
+  trace_seq = seq;
+}
+
 void omnidrive_set_correction(double drift)
 {
-  odometry_correction = drift;
+  omni_params_t p;
+
+  omni_params_get(&p);
+  p.odometry_correction = drift;
+  if (omni_params_set(&p, NULL, 0) != 0)
+    printf("omnidrive_set_correction: %f rejected\n", drift);
 }
 
 int omnidrive_odometry(double *x, double *y, double *a, double *torso_pos)
 {
-  omniread_t cur; /* Current velocities / torques / positions */
   int i;
-  double d_wheel[4], d[3], ang;
+  double d_wheel[4], d[3], ang, odometry_correction;
+  double fit[4], weight[4], dt, sum, mean_torque;
+  int recovering = 0, slowest = 0;
 
-  /* Read data from kernel module. */
-  cur = omni_read_data();
+  /* Only the process data, the bus state is fetched by omnidrive_commstatus() */
+  omni_read_hot(&cur);
+  omni_params_read(&params);  // keeps the last copy if an update races it
 
   // copy status values
   for(i=0; i < NUM_DRIVES; i++)
     status[i] = cur.status[i];
 
-  for(i=0; i < NUM_DRIVES; i++) {
-    commstatus.slave_state[i] = cur.slave_state[i];
-    commstatus.slave_online[i] = cur.slave_online[i];
-    commstatus.slave_operational[i] = cur.slave_operational[i];
-  }
-  commstatus.master_link = cur.master_link;
-  commstatus.master_al_states = cur.master_al_states;
-  commstatus.master_slaves_responding = cur.master_slaves_responding;
-  commstatus.working_counter = cur.working_counter;
-  commstatus.working_counter_state = cur.working_counter_state;
+  torso_status = cur.torso;
 
 
   /* start at (0, 0, 0) */
   if(!odometry_initialized) {
-    for (i = 0; i < NUM_DRIVES; i++)
+    for (i = 0; i < NUM_DRIVES; i++) {
       last_odometry_position[i] = cur.position[i];
+      last_recovery_count[i] = cur.recovery_count[i];
+    }
     odometry_initialized = 1;
   }
 
+  /* A drive which was lost may come back with a reset encoder. Do not
+     integrate its readings until it is enabled again, then continue from
+     wherever its encoder is now. */
+  for (i = 0; i < 4; i++) {
+    if (cur.drive_recovering[i] || cur.recovery_count[i] != last_recovery_count[i]) {
+      last_odometry_position[i] = cur.position[i];
+      last_recovery_count[i] = cur.recovery_count[i];
+    }
+  }
+
   /* compute differences of encoder readings and convert to meters */
+  odometry_correction = params.odometry_correction;
   for (i = 0; i < 4; i++) {
     d_wheel[i] = (int) (cur.position[i] - last_odometry_position[i]) * (1.0/(odometry_constant*odometry_correction));
     /* remember last wheel position */
@@ -302,7 +428,51 @@ int omnidrive_odometry(double *x, double *y, double *a, double *torso_pos)
      --> moved to jacobian_inverse */
 
   jac_inverse(d_wheel, d);
-    
+
+  /* slip: the misfit of the least squares solution, as a speed */
+  dt = last_odometry_stamp ? (cur.stamp_ns[0] - last_odometry_stamp) / 1e9 : 0.0;
+  last_odometry_stamp = cur.stamp_ns[0];
+
+  for (i = 0; i < 4; i++)
+    recovering |= cur.drive_recovering[i];
+
+  if (dt > 0 && !recovering) {
+    jac_forward(d, fit);
+    sum = 0;
+    for (i = 0; i < 4; i++) {
+      slip_status.wheel[i] = (d_wheel[i] - fit[i]) / dt;
+      sum += slip_status.wheel[i] * slip_status.wheel[i];
+    }
+    // low pass, 0.1 s
+    slip_status.residual += (sqrt(sum / 4) - slip_status.residual) * dt / (0.1 + dt);
+    if (slip_status.residual > slip_status.max_residual)
+      slip_status.max_residual = slip_status.residual;
+    if (slip_status.residual > params.slip_warn)
+      slip_status.slip_cycles++;
+
+    mean_torque = 0;
+    for (i = 0; i < 4; i++)
+      mean_torque += abs(cur.actual_torque[i]) / 4.0;
+    for (i = 0; i < 4; i++)
+      slip_status.traction[i] = mean_torque > 0 ? abs(cur.actual_torque[i]) / mean_torque : 1.0;
+  }
+
+  for (i = 1; i < 4; i++)
+    if (slip_status.traction[i] < slip_status.traction[slowest])
+      slowest = i;
+
+  /* Degrade gracefully: leave out wheels which are recovering, and trust
+     the wheel with the least traction less while the base slips. */
+  slip_status.weighted_wheel = -1;
+  for (i = 0; i < 4; i++)
+    weight[i] = cur.drive_recovering[i] ? 0.0 : 1.0;
+  if (!recovering && params.slip_weight < 1.0 && slip_status.residual > params.slip_warn) {
+    weight[slowest] = params.slip_weight;
+    slip_status.weighted_wheel = slowest;
+  }
+  if (recovering || slip_status.weighted_wheel >= 0)
+    jac_inverse_weighted(d_wheel, weight, d);
+
   ang = odometry[2] + d[2]/2.0;
 
   //FIXME: Inverted the commands, also invert the readings
@@ -315,7 +485,7 @@ int omnidrive_odometry(double *x, double *y, double *a, double *torso_pos)
   *x = odometry[0];
   *y = odometry[1];
   *a = odometry[2];
-  *torso_pos = (double)cur.position[TORSO_DRIVE_SEQ] / 10000000.0;
+  *torso_pos = (double)cur.position[TORSO_DRIVE_SEQ] / torso_ticks_per_m;
 
   return 0;
 }
@@ -361,8 +531,9 @@ int writeSDO_old(int device, int objectNum, int value, int type)
 int writeSDO_lib(int device, int index, int subindex, int value, int type)
 {
 
-    //get the point to the ethercat master from the realtime section
-    ec_master_t* master = get_master();
+    //get the master and bus position of the drive from the realtime section
+    uint16_t position = 0;
+    ec_master_t* master = get_drive_master(device, &position);
 
     //abort if the master is not initialized
     if (master == NULL) {
@@ -391,7 +562,7 @@ int writeSDO_lib(int device, int index, int subindex, int value, int type)
     uint8_t *data = &value;
 
     //send the SDO (blocking call)
-    int ret = ecrt_master_sdo_download(master, device, index, subindex, data, data_size, 0);
+    int ret = ecrt_master_sdo_download(master, position, index, subindex, data, data_size, 0);
 
     return(ret);
 
@@ -411,6 +582,35 @@ void drive_status(char *drive, int index)
 
 commstatus_t omnidrive_commstatus()
 {
+  omni_cold_t cold;
+  int i;
+
+  for(i=0; i < NUM_DRIVES; i++)
+    commstatus.drive_recovering[i] = cur.drive_recovering[i];
+
+  /* the bus state rarely changes, only copy it when it did */
+  if(omni_cold_version() == commstatus_version)
+    return commstatus;
+
+  commstatus_version = omni_read_cold(&cold);
+
+  for(i=0; i < NUM_DRIVES; i++) {
+    commstatus.slave_state[i] = cold.slave_state[i];
+    commstatus.slave_online[i] = cold.slave_online[i];
+    commstatus.slave_operational[i] = cold.slave_operational[i];
+  }
+  commstatus.master_link = cold.master_link;
+  commstatus.master_al_states = cold.master_al_states;
+  commstatus.master_slaves_responding = cold.master_slaves_responding;
+  commstatus.working_counter = cold.working_counter;
+  commstatus.working_counter_state = cold.working_counter_state;
+  commstatus.recoveries = cold.recoveries;
+  commstatus.last_recovery_time = cold.last_recovery_time;
+  commstatus.misses = cold.misses;
+  commstatus.num_domains = cold.num_domains;
+  for(i=0; i < cold.num_domains; i++)
+    commstatus.domain[i] = cold.domain[i];
+
   return commstatus;
 }
 
@@ -426,44 +626,31 @@ void omnidrive_status(char *drive0, char *drive1, char *drive2, char *drive3, ch
     *estop = 0x80 & (status[0] & status[1] & status[2] & status[3] & status[4]); //added one for the torso
 }
 
-void omnidrive_recover()
+/* Power is sequenced through the controlword in the process data by the
+ * realtime thread (fault reset, shutdown, switch on, enable operation), for
+ * all drives in the same cycles. These calls only set the request and
+ * return immediately. */
+void omnidrive_poweron()
 {
-  writeSDO(0, 0x6040, 0x80, UINT16);
-  writeSDO(1, 0x6040, 0x80, UINT16);
-  writeSDO(2, 0x6040, 0x80, UINT16);
-  writeSDO(3, 0x6040, 0x80, UINT16);
-  writeSDO(4, 0x6040, 0x80, UINT16);
+  omni_request_power(OMNI_POWER_ON);
 }
 
-void omnidrive_poweron()
+void omnidrive_poweroff()
 {
-  writeSDO(0, 0x6040, 0x06, UINT16);
-  writeSDO(1, 0x6040, 0x06, UINT16);
-  writeSDO(2, 0x6040, 0x06, UINT16);
-  writeSDO(3, 0x6040, 0x06, UINT16);
-  writeSDO(4, 0x6040, 0x06, UINT16);  //torso
-
-  writeSDO(0, 0x6040, 0x07, UINT16);
-  writeSDO(1, 0x6040, 0x07, UINT16);
-  writeSDO(2, 0x6040, 0x07, UINT16);
-  writeSDO(3, 0x6040, 0x07, UINT16);
-  writeSDO(4, 0x6040, 0x07, UINT16);  //torso
-
-  writeSDO(0, 0x6040, 0x0f, UINT16);
-  writeSDO(1, 0x6040, 0x0f, UINT16);
-  writeSDO(2, 0x6040, 0x0f, UINT16);
-  writeSDO(3, 0x6040, 0x0f, UINT16);
-  writeSDO(4, 0x6040, 0x0f, UINT16);  //torso
-
+  omni_request_power(OMNI_POWER_OFF);
 }
 
-void omnidrive_poweroff()
+int omnidrive_powered()
 {
-  writeSDO(0, 0x6040, 0x00, UINT16);
-  writeSDO(1, 0x6040, 0x00, UINT16);
-  writeSDO(2, 0x6040, 0x00, UINT16);
-  writeSDO(3, 0x6040, 0x00, UINT16);
-  writeSDO(4, 0x6040, 0x00, UINT16); //torso
+  omni_hot_t hot;
+  int i;
+
+  omni_read_hot(&hot);
+  for(i=0; i < NUM_DRIVES; i++)
+    if(hot.drive_recovering[i] || (hot.status[i] & 0x6f) != 0x27)  // operation enabled
+      return 0;
+
+  return 1;
 }
 
 void omnidrive_speedcontrol()
@@ -492,30 +679,100 @@ void configure_torso_drive()
 }
 
 
-void start_home_torso_drive()
+/* The torso axis is driven by the torso controller in the realtime thread
+ * (see torso.c). These only hand over new commands and never block. */
+int omnidrive_torso_configure(int mode, double min_position, double max_position,
+                              double max_velocity, double acceleration)
 {
-    //set the torso drive to velocity profile mode, and good default values
-    writeSDO_lib(TORSO_DRIVE_SEQ, 0x6099, 1, 200000, UINT32);     //home search speed
-    writeSDO_lib(TORSO_DRIVE_SEQ, 0x6099, 2, 20000, UINT32);      //home search slow speed
-    writeSDO_lib(TORSO_DRIVE_SEQ, 0x609A, 0, 10000000, UINT32);   //deceleration
-    writeSDO_lib(TORSO_DRIVE_SEQ, 0x6098, 0, 2, INT8);            //homing method
-    writeSDO_lib(TORSO_DRIVE_SEQ, 0x607C, 0, 0, INT32);           //home offset to zero
-    writeSDO_lib(TORSO_DRIVE_SEQ, 0x6060, 0, 6, INT8);            //mode of operation to 6 (homing)
-    writeSDO_lib(TORSO_DRIVE_SEQ, 0x6040, 0, 0x0f, UINT16);       //control word to 0x0f (bring up the drive)
-    writeSDO_lib(TORSO_DRIVE_SEQ, 0x6040, 0, 0x1f, UINT16);       //control word to 0x1f (start the homing)
-
-    //After the homing is finished, switch back to mode 1 (profiled position)
-    //writeSDO_lib(TORSO_DRIVE_SEQ, 0x6060, 0, 1, INT8);            //mode of operation to 1 (profiled position)
-}
-
-int homing_reached(int statusword)
-{
-    #define STATUSWORD_HOMING_ATTAINED_BIT 12
-    if ((statusword & (1 << STATUSWORD_HOMING_ATTAINED_BIT))) {
-        return (1);
-    } else {
-        return(0);
-    }
+  /* at 0 a CSP motion never reaches its goal and the profile does not move */
+  if (!(max_velocity * torso_ticks_per_m >= 1.0) || !(acceleration * torso_ticks_per_m >= 1.0))
+    return -1;
+
+  torso_cmd.mode = mode;
+  torso_cmd.limits.min_position = min_position * torso_ticks_per_m;
+  torso_cmd.limits.max_position = max_position * torso_ticks_per_m;
+  torso_cmd.limits.max_velocity = max_velocity * torso_ticks_per_m;
+  torso_cmd.limits.acceleration = acceleration * torso_ticks_per_m;
+  torso_cmd.limits.deceleration = acceleration * torso_ticks_per_m;
+  omni_write_torso(&torso_cmd);
+
+  return 0;
+}
+
+int omnidrive_torso_move(const double *times, const double *positions, int num_points)
+{
+  int i;
+
+  if (num_points > TORSO_MAX_TRAJ_POINTS)
+    return -1;
+
+  for (i = 1; i < num_points; i++)
+    if (times[i] < times[i-1])
+      return -1;
+
+  for (i = 0; i < num_points; i++) {
+    torso_cmd.trajectory.time_from_start[i] = times[i] * 1e9;
+    torso_cmd.trajectory.position[i] = positions[i] * torso_ticks_per_m;
+  }
+  torso_cmd.trajectory.num_points = num_points;
+  torso_cmd.trajectory.seq++;
+  omni_write_torso(&torso_cmd);
+
+  return 0;
+}
+
+void omnidrive_torso_home()
+{
+  torso_cmd.home_seq++;
+  omni_write_torso(&torso_cmd);
+}
+
+torsostatus_t omnidrive_torso_status()
+{
+  return torso_status;
+}
+
+void omnidrive_drive_stats(drive_stats_t *stats)
+{
+  omni_read_drive_stats(stats);
+}
+
+slipstatus_t omnidrive_slip_status()
+{
+  return slip_status;
 }
 
+/* The wheels may be in different domains, the latest of them counts */
+double omnidrive_odometry_stamp()
+{
+  int64_t stamp = 0;
+  int i;
+
+  for(i=0; i < 4; i++)
+    if(cur.stamp_ns[i] > stamp)
+      stamp = cur.stamp_ns[i];
 
+  return stamp / 1e9;
+}
+
+double omnidrive_torso_stamp()
+{
+  return cur.stamp_ns[TORSO_DRIVE_SEQ] / 1e9;
+}
+
+void omnidrive_joint_state(double *position, double *velocity, double *torque)
+{
+  double ticks_per_m = odometry_constant * params.odometry_correction;
+  int i;
+
+  for(i = 0; i < 4; i++) {
+    position[i] = cur.position[i] / ticks_per_m;
+    velocity[i] = cur.actual_velocity[i] / ticks_per_m;
+  }
+  position[TORSO_DRIVE_SEQ] = cur.position[TORSO_DRIVE_SEQ] / torso_ticks_per_m;
+  velocity[TORSO_DRIVE_SEQ] = cur.actual_velocity[TORSO_DRIVE_SEQ] / torso_ticks_per_m;
+
+  // actual torque is in per mille of the rated torque
+  for(i = 0; i < NUM_DRIVES; i++)
+    torque[i] = cur.actual_torque[i] / 1000.0;
+}
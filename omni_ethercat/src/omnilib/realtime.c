@@ -26,6 +26,7 @@
 #include <sys/resource.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <pthread.h>
@@ -36,15 +37,55 @@
 
 /****************************************************************************/
 
-#include "realtime.h"  // defines omniread_t, omniwrite_t
+#include "realtime.h"  // defines omni_hot_t, omni_cold_t, omniwrite_t
+#include "discovery.h"
+#include "omni_params.h"
+#include "seqlock.h"
+#include "dcclock.h"
+#include "latency.h"
 
 /*****************************************************************************/
 
 
 	
-#define FREQUENCY 1000
+#define FREQUENCY 1000  // of the default layout
 //NUM_DRIVES is defined in realtime.h
 
+/* Master and slave states are checked at this rate to detect bus loss */
+#define STATE_CHECK_FREQUENCY 100
+
+#define TORSO_DRIVE 4  // Drives 0-3 are the wheels, 4 is the torso
+
+/* Distributed clocks count from 2000-01-01 */
+#define DC_EPOCH_NS 946684800000000000LL
+
+/* A persisting fault, e.g. with the emergency stop held, is reset at most
+ * this often (s); bit 7 of the controlword stays up for a few cycles */
+#define FAULT_RESET_PERIOD 0.25
+#define FAULT_RESET_HOLD_CYCLES 5
+
+/* CiA-402 statusword bits */
+#define STATUSWORD_READY_TO_SWITCH_ON_BIT 0
+#define STATUSWORD_SWITCHED_ON_BIT 1
+#define STATUSWORD_OPERATION_ENABLE_BIT 2
+#define STATUSWORD_FAULT_BIT 3
+#define STATUSWORD_VOLTAGE_ENABLE_BIT 4
+#define STATUSWORD_QUICK_STOP_BIT 5
+#define STATUSWORD_SWITCH_ON_DISABLED_BIT 6
+#define STATUSWORD_NO_USED_WARNING_BIT 7
+#define STATUSWORD_ELMO_NOT_USED_BIT 8
+#define STATUSWORD_REMOTE_BIT 9
+#define STATUSWORD_TARGET_REACHED_BIT 10
+#define STATUSWORD_INTERNAL_LIMIT_ACTIVE_BIT 11
+
+#define OPERATION_ENABLED(statusword) (((statusword) & 0x6f) == 0x27)
+
+/* Bus recovery state of a drive */
+#define DRIVE_STARTUP  0  // not yet operational since start, brought up by omnidrive_init
+#define DRIVE_UP       1
+#define DRIVE_LOST     2  // link down, slave offline or not operational
+#define DRIVE_ENABLING 3  // slave is operational again, CiA-402 enable in progress
+
 /* Optional features */
 /*#define CONFIGURE_PDOS  1
 #define EXTERNAL_MEMORY 1
@@ -53,36 +94,82 @@
 
 /*****************************************************************************/
 
-static ec_master_t *master = NULL;
-static ec_master_state_t master_state;// = { };
-
-static ec_domain_t *domain1 = NULL;
-static ec_domain_state_t domain1_state;// = { };
+/* One EtherCAT master per NIC. Several domains may share a master, each
+ * serviced by its own thread, so receive and send are serialised. */
+typedef struct omni_master {
+	unsigned int index;               // as passed to ecrt_request_master()
+	ec_master_t *master;
+	pthread_mutex_t lock;
+} omni_master_t;
+
+/* A domain with its own cycle rate and realtime thread. The thread only
+ * touches the process data of the drives in this domain. */
+typedef struct omni_domain {
+	int index;
+	omni_master_t *m;
+	int owns_master;                  // first domain of its master, reports master state
+	ec_domain_t *domain;
+	uint8_t *pd;                      // process data memory
+	ec_domain_state_t state;
+	ec_master_state_t master_state;
+
+	unsigned int frequency;
+	int period_ns;
+	int num_drives;
+	int drives[NUM_DRIVES];
+
+	unsigned int counter;
+	unsigned int state_check_counter;
+	unsigned int stats_counter;
+	int power_target;
+	int recoveries_published;
+	uint32_t cycles_published;
+	int cold_dirty;                   // cold has changed since it was last published
+
+	uint32_t traced_seq;              // last command marked LATENCY_CMD_ON_BUS
+	int64_t send_ns;                  // host time when the last frame went out
+	int use_dc;                       // we read the reference clock of our master
+	dc_clock_t dc;
+
+	omni_params_t params;             // this thread's copy, refreshed every cycle
+	omniwrite_t tar;                  // target values as of the last exchange
+	int stale;                        // the wheel targets are held at 0, see take_targets()
+	omni_hot_t hot;                   // only our drives and our domain entry are valid
+	omni_cold_t cold;
+	drive_stats_t stats[NUM_DRIVES];
+
+	pthread_t thread;
+	int running;
+} omni_domain_t;
+
+static omni_layout_t layout;
+static omni_master_t masters[OMNI_MAX_MASTERS];
+static int num_masters = 0;
+static omni_domain_t domains[OMNI_MAX_DOMAINS];
+static int num_domains = 0;
 
 static ec_slave_config_t *sc[NUM_DRIVES];// = { NULL, NULL, NULL, NULL, NULL};  //added torso
 static ec_slave_config_state_t sc_state[NUM_DRIVES];// = {{}, {}, {}, {}, {}};  //added torso
 
-static char prevent_set_position = 0;
-
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static int exiting = 0;
-static pthread_t thread;
-static int misses=0;
 
-/*****************************************************************************/
+static int power_request = OMNI_POWER_OFF;
 
-/* Process data */
-static uint8_t *domain1_pd;	/* Process data memory */
+static int drive_link_state[NUM_DRIVES];
+static struct timespec drive_lost_time[NUM_DRIVES];
+static struct timespec fault_reset_time[NUM_DRIVES];  // last rising edge of bit 7
+static int fault_reset_hold[NUM_DRIVES];                // cycles bit 7 stays up
+static int drive_down[NUM_DRIVES];   // read by the other domain threads, see wheels_down()
 
-/* Slave alias, slave position */
-#define M0SlavePos 0, 0
-#define M1SlavePos 0, 1
-#define M2SlavePos 0, 2
-#define M3SlavePos 0, 3
-#define M4SlavePos 0, 4
+/* Master state as last reported by the owning domain, guarded by mutex */
+static ec_master_state_t reported_master_state[OMNI_MAX_MASTERS];
 
-/* Slave vendor ID, slave product code */
-#define ELMOG  0x0000009a, 0x00030924
+/*****************************************************************************/
+
+/* Slave vendor ID, slave product code of the default layout */
+#define ELMO_VENDOR_ID    0x0000009a
+#define ELMO_GOLD_PRODUCT 0x00030924
 
 
 /*****************************************************************************/
@@ -154,157 +241,118 @@ static unsigned int off_mode_of_operation_display[NUM_DRIVES];
 static unsigned int off_actual_torque[NUM_DRIVES];
 
 
-/* (alias, position), (VID, PID), PDO entry index, PDO entry subindex, pointer, bit position */
-static const ec_pdo_entry_reg_t domain1_regs[] = {
+/* PDO entries registered for every drive in the domain it belongs to:
+ * PDO entry index, PDO entry subindex, offsets per drive */
+typedef struct drive_pdo_reg {
+    uint16_t index;
+    uint8_t subindex;
+    unsigned int *offset;
+} drive_pdo_reg_t;
+
+static const drive_pdo_reg_t drive_regs[] = {
     //PDOs for writing to the controllers
-    {M0SlavePos,  ELMOG, 0x607A, 0x00, &off_target_position[0]},
-    {M1SlavePos,  ELMOG, 0x607A, 0x00, &off_target_position[1]},
-    {M2SlavePos,  ELMOG, 0x607A, 0x00, &off_target_position[2]},
-    {M3SlavePos,  ELMOG, 0x607A, 0x00, &off_target_position[3]},
-    {M4SlavePos,  ELMOG, 0x607A, 0x00, &off_target_position[4]}, //torso
-    {M0SlavePos,  ELMOG, 0x60FF, 0x00, &off_target_velocity[0]},
-    {M1SlavePos,  ELMOG, 0x60FF, 0x00, &off_target_velocity[1]},
-    {M2SlavePos,  ELMOG, 0x60FF, 0x00, &off_target_velocity[2]},
-    {M3SlavePos,  ELMOG, 0x60FF, 0x00, &off_target_velocity[3]},
-    {M4SlavePos,  ELMOG, 0x60FF, 0x00, &off_target_velocity[4]}, //torso
-    {M0SlavePos,  ELMOG, 0x6071, 0x00, &off_target_torque[0]},
-    {M1SlavePos,  ELMOG, 0x6071, 0x00, &off_target_torque[1]},
-    {M2SlavePos,  ELMOG, 0x6071, 0x00, &off_target_torque[2]},
-    {M3SlavePos,  ELMOG, 0x6071, 0x00, &off_target_torque[3]},
-    {M4SlavePos,  ELMOG, 0x6071, 0x00, &off_target_torque[4]}, //torso
-    {M0SlavePos,  ELMOG, 0x6072, 0x00, &off_max_torque[0]},
-    {M1SlavePos,  ELMOG, 0x6072, 0x00, &off_max_torque[1]},
-    {M2SlavePos,  ELMOG, 0x6072, 0x00, &off_max_torque[2]},
-    {M3SlavePos,  ELMOG, 0x6072, 0x00, &off_max_torque[3]},
-    {M4SlavePos,  ELMOG, 0x6072, 0x00, &off_max_torque[4]}, //torso
-    {M0SlavePos,  ELMOG, 0x6040, 0x00, &off_controlword[0]},
-    {M1SlavePos,  ELMOG, 0x6040, 0x00, &off_controlword[1]},
-    {M2SlavePos,  ELMOG, 0x6040, 0x00, &off_controlword[2]},
-    {M3SlavePos,  ELMOG, 0x6040, 0x00, &off_controlword[3]},
-    {M4SlavePos,  ELMOG, 0x6040, 0x00, &off_controlword[4]},
-    {M0SlavePos,  ELMOG, 0x6060, 0x00, &off_mode_of_operation[0]},
-    {M1SlavePos,  ELMOG, 0x6060, 0x00, &off_mode_of_operation[1]},
-    {M2SlavePos,  ELMOG, 0x6060, 0x00, &off_mode_of_operation[2]},
-    {M3SlavePos,  ELMOG, 0x6060, 0x00, &off_mode_of_operation[3]},
-    {M4SlavePos,  ELMOG, 0x6060, 0x00, &off_mode_of_operation[4]},
-    {M0SlavePos,  ELMOG, 0x6081, 0x00, &off_profile_velocity[0]},
-    {M1SlavePos,  ELMOG, 0x6081, 0x00, &off_profile_velocity[1]},
-    {M2SlavePos,  ELMOG, 0x6081, 0x00, &off_profile_velocity[2]},
-    {M3SlavePos,  ELMOG, 0x6081, 0x00, &off_profile_velocity[3]},
-    {M4SlavePos,  ELMOG, 0x6081, 0x00, &off_profile_velocity[4]},
-    {M0SlavePos,  ELMOG, 0x6083, 0x00, &off_profile_acceleration[0]},
-    {M1SlavePos,  ELMOG, 0x6083, 0x00, &off_profile_acceleration[1]},
-    {M2SlavePos,  ELMOG, 0x6083, 0x00, &off_profile_acceleration[2]},
-    {M3SlavePos,  ELMOG, 0x6083, 0x00, &off_profile_acceleration[3]},
-    {M4SlavePos,  ELMOG, 0x6083, 0x00, &off_profile_acceleration[4]},
-    {M0SlavePos,  ELMOG, 0x6084, 0x00, &off_profile_deceleration[0]},
-    {M1SlavePos,  ELMOG, 0x6084, 0x00, &off_profile_deceleration[1]},
-    {M2SlavePos,  ELMOG, 0x6084, 0x00, &off_profile_deceleration[2]},
-    {M3SlavePos,  ELMOG, 0x6084, 0x00, &off_profile_deceleration[3]},
-    {M4SlavePos,  ELMOG, 0x6084, 0x00, &off_profile_deceleration[4]},
-    {M0SlavePos,  ELMOG, 0x6084, 0x00, &off_digital_outputs[0]},
-    {M1SlavePos,  ELMOG, 0x6084, 0x00, &off_digital_outputs[1]},
-    {M2SlavePos,  ELMOG, 0x6084, 0x00, &off_digital_outputs[2]},
-    {M3SlavePos,  ELMOG, 0x6084, 0x00, &off_digital_outputs[3]},
-    {M4SlavePos,  ELMOG, 0x6084, 0x00, &off_digital_outputs[4]},
+    {0x607A, 0x00, off_target_position},
+    {0x60FF, 0x00, off_target_velocity},
+    {0x6071, 0x00, off_target_torque},
+    {0x6072, 0x00, off_max_torque},
+    {0x6040, 0x00, off_controlword},
+    {0x6060, 0x00, off_mode_of_operation},
+    {0x6081, 0x00, off_profile_velocity},
+    {0x6083, 0x00, off_profile_acceleration},
+    {0x6084, 0x00, off_profile_deceleration},
+    {0x60FE, 0x01, off_digital_outputs},
 
     //From here are the PDOs for reading
-    {M0SlavePos,  ELMOG, 0x6064, 0x00, &off_actual_position[0]},
-    {M1SlavePos,  ELMOG, 0x6064, 0x00, &off_actual_position[1]},
-    {M2SlavePos,  ELMOG, 0x6064, 0x00, &off_actual_position[2]},
-    {M3SlavePos,  ELMOG, 0x6064, 0x00, &off_actual_position[3]},
-    {M4SlavePos,  ELMOG, 0x6064, 0x00, &off_actual_position[4]},
-    {M0SlavePos,  ELMOG, 0x60FD, 0x00, &off_digital_inputs[0]},
-    {M1SlavePos,  ELMOG, 0x60FD, 0x00, &off_digital_inputs[1]},
-    {M2SlavePos,  ELMOG, 0x60FD, 0x00, &off_digital_inputs[2]},
-    {M3SlavePos,  ELMOG, 0x60FD, 0x00, &off_digital_inputs[3]},
-    {M4SlavePos,  ELMOG, 0x60FD, 0x00, &off_digital_inputs[4]},
-    {M0SlavePos,  ELMOG, 0x606C, 0x00, &off_actual_velocity[0]},
-    {M1SlavePos,  ELMOG, 0x606C, 0x00, &off_actual_velocity[1]},
-    {M2SlavePos,  ELMOG, 0x606C, 0x00, &off_actual_velocity[2]},
-    {M3SlavePos,  ELMOG, 0x606C, 0x00, &off_actual_velocity[3]},
-    {M4SlavePos,  ELMOG, 0x606C, 0x00, &off_actual_velocity[4]},
-    {M0SlavePos,  ELMOG, 0x6041, 0x00, &off_statusword[0]},
-    {M1SlavePos,  ELMOG, 0x6041, 0x00, &off_statusword[1]},
-    {M2SlavePos,  ELMOG, 0x6041, 0x00, &off_statusword[2]},
-    {M3SlavePos,  ELMOG, 0x6041, 0x00, &off_statusword[3]},
-    {M4SlavePos,  ELMOG, 0x6041, 0x00, &off_statusword[4]},
-    {M0SlavePos,  ELMOG, 0x6061, 0x00, &off_mode_of_operation_display[0]},
-    {M1SlavePos,  ELMOG, 0x6061, 0x00, &off_mode_of_operation_display[1]},
-    {M2SlavePos,  ELMOG, 0x6061, 0x00, &off_mode_of_operation_display[2]},
-    {M3SlavePos,  ELMOG, 0x6061, 0x00, &off_mode_of_operation_display[3]},
-    {M4SlavePos,  ELMOG, 0x6061, 0x00, &off_mode_of_operation_display[4]},
-    {M0SlavePos,  ELMOG, 0x6077, 0x00, &off_actual_torque[0]},
-    {M1SlavePos,  ELMOG, 0x6077, 0x00, &off_actual_torque[1]},
-    {M2SlavePos,  ELMOG, 0x6077, 0x00, &off_actual_torque[2]},
-    {M3SlavePos,  ELMOG, 0x6077, 0x00, &off_actual_torque[3]},
-    {M4SlavePos,  ELMOG, 0x6077, 0x00, &off_actual_torque[4]},
-    {}
+    {0x6064, 0x00, off_actual_position},
+    {0x60FD, 0x00, off_digital_inputs},
+    {0x606C, 0x00, off_actual_velocity},
+    {0x6041, 0x00, off_statusword},
+    {0x6061, 0x00, off_mode_of_operation_display},
+    {0x6077, 0x00, off_actual_torque},
+    {0, 0, NULL}
 };
 
 
-static unsigned int counter = 0;
+static omniwrite_t tar_buffer;  /* Target velocities */
+static struct timespec tar_stamp;  /* when tar_buffer was written, CLOCK_MONOTONIC */
 
-static int max_v = 100;
+/* What the domains read, for everybody else. Written with mutex held, so
+ * there is only one writer at a time; readers only use the seqlocks. */
+static seqlock_t hot_lock = SEQLOCK_INITIALIZER;
+static omni_hot_t hot_buffer;
+static seqlock_t cold_lock = SEQLOCK_INITIALIZER;
+static omni_cold_t cold_buffer;
+static seqlock_t stats_lock = SEQLOCK_INITIALIZER;
+static drive_stats_t stats_buffer[NUM_DRIVES];
 
-static omniwrite_t tar, tar_buffer;  /* Target velocities */
-static omniread_t cur, cur_buffer;    /* Current velocities/torques/positions */
-
-static uint8_t old_send_new_torso_pos = 0;
+static torsocmd_t torso_cmd, torso_cmd_buffer;  /* torso_cmd belongs to the torso's domain */
+static int torso_cmd_fresh = 0;
+static torso_ctx_t torso_ctx;
 
 /*****************************************************************************/
 
 
-void check_domain1_state(void)
+
+
+void check_domain_state(omni_domain_t *d)
 {
 	ec_domain_state_t ds;
+	omni_domain_stats_t *stats = &d->cold.domain[d->index];
 
-	ecrt_domain_state(domain1, &ds);
+	ecrt_domain_state(d->domain, &ds);
 
-	if (ds.working_counter != domain1_state.working_counter)
-		printf("Domain1: WC %u.\n", ds.working_counter);
-	if (ds.wc_state != domain1_state.wc_state)
-		printf("Domain1: State %u.\n", ds.wc_state);
+	if (ds.working_counter != d->state.working_counter) {
+		printf("Domain%d: WC %u.\n", d->index, ds.working_counter);
+		d->cold_dirty = 1;
+	}
+	if (ds.wc_state != d->state.wc_state) {
+		printf("Domain%d: State %u.\n", d->index, ds.wc_state);
+		d->cold_dirty = 1;
+	}
 
-	domain1_state = ds;
-	cur.working_counter = ds.working_counter;
-	cur.working_counter_state = ds.wc_state;
+	d->state = ds;
+	stats->working_counter = ds.working_counter;
+	stats->working_counter_state = ds.wc_state;
 }
 
 
 /*****************************************************************************/
 
 
-void check_master_state(void)
+void check_master_state(omni_domain_t *d)
 {
 	ec_master_state_t ms;
 
-	ecrt_master_state(master, &ms);
-
-	if (ms.slaves_responding != master_state.slaves_responding)
-		printf("%u slave(s).\n", ms.slaves_responding);
-	if (ms.al_states != master_state.al_states)
-		printf("AL states: 0x%02X.\n", ms.al_states);
-	if (ms.link_up != master_state.link_up)
-		printf("Link is %s.\n",
-		       ms.link_up ? "up" : "down");
-
-	master_state = ms;
-	cur.master_link = ms.link_up;
-	cur.master_al_states = ms.al_states;
-	cur.master_slaves_responding = ms.slaves_responding;
+	ecrt_master_state(d->m->master, &ms);
+
+	if (d->owns_master) {
+		if (ms.slaves_responding != d->master_state.slaves_responding)
+			printf("Master%u: %u slave(s).\n", d->m->index, ms.slaves_responding);
+		if (ms.al_states != d->master_state.al_states)
+			printf("Master%u: AL states: 0x%02X.\n", d->m->index, ms.al_states);
+		if (ms.link_up != d->master_state.link_up)
+			printf("Master%u: Link is %s.\n", d->m->index,
+			       ms.link_up ? "up" : "down");
+		if (ms.slaves_responding != d->master_state.slaves_responding ||
+		    ms.al_states != d->master_state.al_states ||
+		    ms.link_up != d->master_state.link_up)
+			d->cold_dirty = 1;
+	}
 
+	d->master_state = ms;
 }
 
 /*****************************************************************************/
 
-void check_slave_config_states(void)
+void check_slave_config_states(omni_domain_t *d)
 {
-	int i;
+	int j;
 
 	ec_slave_config_state_t s;
 
-    for (i = 0; i < NUM_DRIVES; i++) {
+	for (j = 0; j < d->num_drives; j++) {
+		int i = d->drives[j];
+
 		ecrt_slave_config_state(sc[i], &s);
 		if (s.al_state != sc_state[i].al_state)
 			printf("m%d: State 0x%02X.\n", i, s.al_state);
@@ -314,64 +362,285 @@ void check_slave_config_states(void)
 		if (s.operational != sc_state[i].operational)
 			printf("m%d: %soperational.\n", i,
 			       s.operational ? "" : "Not ");
+		if (s.al_state != sc_state[i].al_state || s.online != sc_state[i].online ||
+		    s.operational != sc_state[i].operational)
+			d->cold_dirty = 1;
 		sc_state[i] = s;
 
-		cur.slave_state[i] = s.al_state;
-		cur.slave_online[i] = s.online;
-		cur.slave_operational[i] = s.operational;	
+		d->cold.slave_state[i] = s.al_state;
+		d->cold.slave_online[i] = s.online;
+		d->cold.slave_operational[i] = s.operational;	
 	}
 }
 
 
 /*****************************************************************************/
 
-void cyclic_task()
+static double seconds_since(const struct timespec *t)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - t->tv_sec) + (now.tv_nsec - t->tv_nsec) / 1e9;
+}
+
+
+/* A fault is reset on the rising edge of bit 7. While the fault persists
+ * the edge is repeated every FAULT_RESET_PERIOD, with bit 7 held up for
+ * FAULT_RESET_HOLD_CYCLES so that the drive sees it. */
+static uint16_t fault_reset_controlword(int drive)
+{
+	if (fault_reset_hold[drive] > 0) {
+		fault_reset_hold[drive]--;
+		return 0x80;
+	}
+
+	if (fault_reset_time[drive].tv_sec == 0 ||
+	    seconds_since(&fault_reset_time[drive]) >= FAULT_RESET_PERIOD) {
+		clock_gettime(CLOCK_MONOTONIC, &fault_reset_time[drive]);
+		fault_reset_hold[drive] = FAULT_RESET_HOLD_CYCLES - 1;
+		return 0x80;
+	}
+
+	return 0x00;
+}
+
+
+/* Next controlword on the way to 'operation enabled' for the given statusword */
+static uint16_t cia402_enable_controlword(int drive, uint16_t statusword)
+{
+	if (statusword & (1<<STATUSWORD_OPERATION_ENABLE_BIT))
+		return 0x0f;       /* all is good, continue */
+	else if (statusword & (1<<STATUSWORD_SWITCHED_ON_BIT))
+		return 0x0f;       /* enable operation */
+	else if (statusword & (1<<STATUSWORD_READY_TO_SWITCH_ON_BIT))
+		return 0x07;       /* switch on */
+	else if (statusword & (1<<STATUSWORD_FAULT_BIT))
+		return fault_reset_controlword(drive);
+	else
+		return 0x06;       /* shutdown */
+}
+
+
+static void set_drive_down(omni_domain_t *d, int i, int down)
+{
+	d->hot.drive_recovering[i] = down;
+	__atomic_store_n(&drive_down[i], down, __ATOMIC_RELAXED);
+}
+
+
+/* The wheels may be spread over several domains, never drive with a
+ * partial set of wheels while some are recovering. */
+static int wheels_down(void)
 {
 	int i;
 
+	for (i = 0; i < TORSO_DRIVE; i++)
+		if (__atomic_load_n(&drive_down[i], __ATOMIC_RELAXED))
+			return 1;
+
+	return 0;
+}
+
+
+/* Track link and slave loss. The master reconfigures slaves on its own when
+ * they come back (including the startup SDOs registered in
+ * start_omni_realtime), after that only the CiA-402 state machine of the
+ * affected drives needs to be walked up again. */
+void supervise_drives(omni_domain_t *d)
+{
+	int j;
+
+	for (j = 0; j < d->num_drives; j++) {
+		int i = d->drives[j];
+		int lost = !d->master_state.link_up || !sc_state[i].online ||
+		           !sc_state[i].operational;
+
+		switch (drive_link_state[i]) {
+		case DRIVE_STARTUP:
+			if (!lost)
+				drive_link_state[i] = DRIVE_UP;
+			break;
+		case DRIVE_UP:
+			if (lost) {
+				printf("\e[31;1mm%d Lost, waiting for reconfiguration <----------------\e[0m\n", i);
+				clock_gettime(CLOCK_MONOTONIC, &drive_lost_time[i]);
+				drive_link_state[i] = DRIVE_LOST;
+			}
+			break;
+		case DRIVE_LOST:
+			if (!lost) {
+				printf("m%d: Reconfigured after %.3f s, enabling.\n", i,
+				       seconds_since(&drive_lost_time[i]));
+				drive_link_state[i] = DRIVE_ENABLING;
+			}
+			break;
+		case DRIVE_ENABLING:
+			if (lost)
+				drive_link_state[i] = DRIVE_LOST;
+			break;
+		}
+
+		set_drive_down(d, i, drive_link_state[i] == DRIVE_LOST ||
+		                     drive_link_state[i] == DRIVE_ENABLING);
+	}
+}
+
+
+/* Walk the drives which came back through the CiA-402 enable sequence,
+ * one step per cycle. */
+void recover_drives(omni_domain_t *d)
+{
+	int j;
+
+	for (j = 0; j < d->num_drives; j++) {
+		int i = d->drives[j];
+
+		if (drive_link_state[i] == DRIVE_ENABLING && d->power_target != OMNI_POWER_ON) {
+			/* nothing to enable, the drive stays switched off */
+			d->hot.recovery_count[i]++;
+			d->cold.recoveries++;
+			d->cold_dirty = 1;
+			set_drive_down(d, i, 0);
+			drive_link_state[i] = DRIVE_UP;
+		} else if (drive_link_state[i] == DRIVE_ENABLING) {
+			uint16_t statusword = d->hot.status[i];
+
+			EC_WRITE_U16(d->pd + off_controlword[i],
+			             cia402_enable_controlword(i, statusword));
+
+			if (statusword & (1<<STATUSWORD_OPERATION_ENABLE_BIT)) {
+				d->cold.last_recovery_time = seconds_since(&drive_lost_time[i]);
+				d->hot.recovery_count[i]++;
+				d->cold.recoveries++;
+				d->cold_dirty = 1;
+				set_drive_down(d, i, 0);
+				drive_link_state[i] = DRIVE_UP;
+				printf("m%d: Recovered in %.3f s.\n", i, d->cold.last_recovery_time);
+			}
+		}
+	}
+}
+
+
+/* Bring all drives towards the requested power state through the
+ * controlword in the process data, one CiA-402 transition per cycle.
+ * This replaces the blocking SDO writes of 0x6040 on each drive. */
+void sequence_power(omni_domain_t *d)
+{
+	int j;
+
+	for (j = 0; j < d->num_drives; j++) {
+		int i = d->drives[j];
+		uint16_t controlword;
+
+		if (d->hot.drive_recovering[i])
+			continue;
+
+		if (d->power_target == OMNI_POWER_ON) {
+			controlword = cia402_enable_controlword(i, d->hot.status[i]);
+		} else if (d->hot.status[i] & (1<<STATUSWORD_FAULT_BIT)) {
+			/* reset the fault, but do not enable */
+			controlword = fault_reset_controlword(i);
+		} else {
+			controlword = 0x00;   /* disable voltage */
+		}
+
+		EC_WRITE_U16(d->pd + off_controlword[i], controlword);
+	}
+}
+
+
+/*****************************************************************************/
+
+static int64_t realtime_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+/* The inputs in the frame we just received were sampled when that frame
+ * passed the slaves, right after we sent it. With distributed clocks the
+ * reference clock tells when that was, without the jitter of the host. */
+static int64_t sample_time(omni_domain_t *d)
+{
+	omni_domain_stats_t *stats = &d->cold.domain[d->index];
+	uint32_t ref_time;
+	int64_t stamp;
+
+	if (!d->use_dc || ecrt_master_reference_clock_time(d->m->master, &ref_time))
+		return d->send_ns;
+
+	stamp = dc_clock_update(&d->dc, ref_time, d->send_ns);
+	stats->dc_error_ns = d->dc.error_ns;
+	stats->dc_max_error_ns = d->dc.max_error_ns;
+	stats->dc_resets = d->dc.resets;
+	return stamp;
+}
+
+
+void cyclic_task(omni_domain_t *d)
+{
+	int i, j, down, torso_enabled;
+	int64_t stamp;
+	torso_output_t torso_out;
+	const omni_params_t *params = &d->params;  // one block for the whole cycle
+
 	/* Receive process data. */
-	ecrt_master_receive(master);
-	ecrt_domain_process(domain1);
+	pthread_mutex_lock(&d->m->lock);
+	ecrt_master_receive(d->m->master);
+	ecrt_domain_process(d->domain);
+	stamp = d->send_ns ? sample_time(d) : 0;
+	pthread_mutex_unlock(&d->m->lock);
 
 	/* Check process data state (optional). */
-	check_domain1_state();
+	check_domain_state(d);
 
 
     //Actually get data from the EtherCAT frames
     //Info about the data type and address found in MAN-CAN402IG.pdf from Elmo
-    for (i = 0; i < NUM_DRIVES; i++) {
-        cur.position[i]          = EC_READ_S32(domain1_pd + off_actual_position[i]);
-        cur.digital_inputs[i]    = EC_READ_U32(domain1_pd + off_digital_inputs[i]);
-        cur.actual_velocity[i]   = EC_READ_S32(domain1_pd + off_actual_velocity[i]);
-        cur.status[i]            = EC_READ_U16(domain1_pd + off_statusword[i]);
-        cur.mode_of_operation_display[i] = EC_READ_S8(domain1_pd + off_mode_of_operation_display[i]);
-        cur.actual_torque[i]     = EC_READ_S16(domain1_pd + off_actual_torque[i]);
+    for (j = 0; j < d->num_drives; j++) {
+        i = d->drives[j];
+        d->hot.position[i]          = EC_READ_S32(d->pd + off_actual_position[i]);
+        d->hot.digital_inputs[i]    = EC_READ_U32(d->pd + off_digital_inputs[i]);
+        d->hot.actual_velocity[i]   = EC_READ_S32(d->pd + off_actual_velocity[i]);
+        d->hot.status[i]            = EC_READ_U16(d->pd + off_statusword[i]);
+        d->hot.mode_of_operation_display[i] = EC_READ_S8(d->pd + off_mode_of_operation_display[i]);
+        d->hot.actual_torque[i]     = EC_READ_S16(d->pd + off_actual_torque[i]);
+        d->hot.stamp_ns[i]          = stamp;
+
+        drive_stats_update(&d->stats[i], d->hot.status[i], d->hot.actual_torque[i],
+                           i == TORSO_DRIVE ? d->hot.torso.setpoint - d->hot.position[i]
+                                            : d->tar.target_velocity[i] - d->hot.actual_velocity[i],
+                           d->period_ns);
 	}
 	
 
-    // TODO: factor out these calls
-	if (counter) {
-		counter--;
-	} else {		/* Do this at 1 Hz */
-		counter = FREQUENCY;
-
-        //printf("profile_vel = %d\n", tar.profile_velocity[4]);
-        //printf("actual_velocity: %d", cur.actual_velocity[0]);
-        //printf("actual_velocity: %d", cur.actual_velocity[4]);
-        //int prof_vel = EC_READ_U32(domain1_pd + off_profile_velocity[4]);
-        //printf("read profile_vel = %d\n",prof_vel);
-        //int mode_of_op = EC_READ_S8(domain1_pd + off_mode_of_operation_display[4]);
-        //int mode_of_op = cur.mode_of_operation_display[4];
-        //printf("mode of operation display(4) = %d\n", mode_of_op);
+	if (d->state_check_counter) {
+		d->state_check_counter--;
+	} else {
+		d->state_check_counter = d->frequency / STATE_CHECK_FREQUENCY;
 
-        /* Check for master state (optional). */
-		check_master_state();
+		/* Check for master state (optional). */
+		pthread_mutex_lock(&d->m->lock);
+		check_master_state(d);
 
 		/* Check for slave configuration state(s) (optional). */
-		check_slave_config_states();
-		//for (i=0; i<2; i++) {
-		//	printf("vel[%d]=%d\n", i, tar.target_velocity[i]);
-		//}
+		check_slave_config_states(d);
+		pthread_mutex_unlock(&d->m->lock);
+
+		supervise_drives(d);
+	}
+
+	recover_drives(d);
+	sequence_power(d);
+	down = wheels_down();
+
+	if (d->counter) {
+		d->counter--;
+	} else {		/* Do this at 1 Hz */
+		d->counter = d->frequency;
 
 		/*
 		double odometry_constant=626594.7934;  // in ticks/m		
@@ -385,145 +654,90 @@ void cyclic_task()
 		printf("0: Pos=%8.3f  Vel=%4.3f   1: Pos=%8.3f  Vel=%4.3f\n", pos0, speed0, pos1, speed1);
 		*/
 		
-        //Ugly hack!  FIXME: Move this to function that deals with the drive operational state machine (is separate from the EtherCAT comm state machine)
-        //After the EtherCAT communication is setup and PDOs are running (in OP mode), it is still necessary to enable the motor controller
-        // which involves reseting errors, enabling voltage, switching on, etc
-		#define STATUSWORD_READY_TO_SWITCH_ON_BIT 0
-		#define STATUSWORD_SWITCHED_ON_BIT 1
-		#define STATUSWORD_OPERATION_ENABLE_BIT 2
-		#define STATUSWORD_FAULT_BIT 3
-		#define STATUSWORD_VOLTAGE_ENABLE_BIT 4
-		#define STATUSWORD_QUICK_STOP_BIT 5
-		#define STATUSWORD_SWITCH_ON_DISABLED_BIT 6
-		#define STATUSWORD_NO_USED_WARNING_BIT 7
-		#define STATUSWORD_ELMO_NOT_USED_BIT 8
-		#define STATUSWORD_REMOTE_BIT 9
-		#define STATUSWORD_TARGET_REACHED_BIT 10
-		#define STATUSWORD_INTERNAL_LIMIT_ACTIVE_BIT 11
-
-        for (i = 0; i< NUM_DRIVES; i++) {
-			int controlword = 0x00;
-			int statusword = cur.status[i];	
-			
-			//printf("StatusWord[%i] = 0x%04x = %d \n", i, statusword, statusword);
-			if (statusword & (1<<STATUSWORD_FAULT_BIT)) {
-			   printf("\e[31;1mm%d Has fault! <----------------\e[0m\n", i);
-			   }
-		
-			   if (!(statusword & (1<<STATUSWORD_VOLTAGE_ENABLE_BIT))){
-				   printf("\e[31;1mm%d Voltage not enabled! <----------------\e[0m\n", i);
-			   }
+		/* Power itself is sequenced every cycle by sequence_power(). */
+        for (j = 0; j < d->num_drives; j++) {
+			int statusword;
 
-			   //if (!(statusword & (1 << STATUSWORD_SWITCH_ON_DISABLED_BIT))){
-			//	   printf("\e[31;1mm%d Switch_on_disabled_bit <----------------\e[0m\n", i);
-			  //}
-		
-		
-			   if (!(statusword & (1<<STATUSWORD_OPERATION_ENABLE_BIT))) {
-				   if (!(statusword & (1<<STATUSWORD_SWITCHED_ON_BIT))) {
-					   if (!(statusword & (1<<STATUSWORD_READY_TO_SWITCH_ON_BIT))) {
-						   if ((statusword & (1<<STATUSWORD_FAULT_BIT))) {
-						   /* reset fault */
-							controlword = 	0x80;
-							printf("\e[31;1mm%d Reset fault <----------------\e[0m\n", i);
-			   				//EC_WRITE_U16(domain1_pd + off_controlword[i], controlword);
-						   } else {
-							   /* shutdown */
-							   controlword = 0x06;
-							   printf("\e[31;1mm%d Shutdown <----------------\e[0m\n", i);
-						   }
-					   } else {
-						/* switch on */
-					   	controlword = 0x07;
-					  	printf("\e[31;1mm%d Switch on <----------------\e[0m\n", i);
-					   }
-				   } else {
-					   /* enable operation */
-					   printf("\e[31;mm%d EnableOperation <----------------\e[0m\n", i);
-					   controlword = 0x0F;
-				   }
-			   } else {
-				// All is good, continue
-				controlword = 0x0f;
-			   }
-		   
-		   
-			   EC_WRITE_U16(domain1_pd + off_controlword[i], controlword);
-		
-		
-		   
-		}   
-		
-		
-		
-		
-	}
+			i = d->drives[j];
+			statusword = d->hot.status[i];
+
+			if (d->hot.drive_recovering[i] || d->power_target != OMNI_POWER_ON)
+				continue;
+
+			if (statusword & (1<<STATUSWORD_FAULT_BIT)) {
+				printf("\e[31;1mm%d Has fault! <----------------\e[0m\n", i);
+			}
 
-	/*
-	if(tar.target_position[0] == 0 && 
-	   tar.target_position[1] == 0) { 
-		for (i = 0; i < 2; i++) { 
-			EC_WRITE_U32(domain1_pd + off_target_position[i], cur.position[i]);
+			if (!(statusword & (1<<STATUSWORD_VOLTAGE_ENABLE_BIT))){
+				printf("\e[31;1mm%d Voltage not enabled! <----------------\e[0m\n", i);
+			}
 		}
-		prevent_set_position = 1; 
-	} else { 
-		prevent_set_position = 0; 
 	}
-	*/
 
 	/* Write process data. */
 	/* Note: You _must_ write something, as this is how the drives sync. */
 
-    //only feeding the wheel drives target velocity
-    for (i = 0; i < 4; i++) {
-        tar.profile_acceleration[i] = 5000000;
-        tar.profile_deceleration[i] = 5000001;
+    for (j = 0; j < d->num_drives; j++) {
+        i = d->drives[j];
+
+        if (i == TORSO_DRIVE) {
+            //now for the torso:
+            torso_enabled = d->power_target == OMNI_POWER_ON && !d->hot.drive_recovering[i] &&
+                            OPERATION_ENABLED(d->hot.status[i]);
+
+            torso_update(&torso_ctx, &torso_cmd, torso_enabled,
+                         d->hot.status[i], d->hot.mode_of_operation_display[i],
+                         d->hot.position[i], d->hot.actual_velocity[i],
+                         d->period_ns, &torso_out, &d->hot.torso);
+
+            EC_WRITE_S8(d->pd + off_mode_of_operation[i], torso_out.mode_of_operation);
+            EC_WRITE_S32(d->pd + off_target_position[i], torso_out.target_position);
+            EC_WRITE_U32(d->pd + off_profile_velocity[i], torso_out.profile_velocity);
+            EC_WRITE_U32(d->pd + off_profile_acceleration[i], torso_out.profile_acceleration);
+            EC_WRITE_U32(d->pd + off_profile_deceleration[i], torso_out.profile_deceleration);
+
+            //while not enabled, the controlword is written by sequence_power() or recover_drives()
+            if (torso_enabled) {
+                EC_WRITE_U16(d->pd + off_controlword[i], 0x0f | torso_out.controlword_bits);
+            }
+            continue;
+        }
 
-        EC_WRITE_S32(domain1_pd + off_target_velocity[i], tar.target_velocity[i]  );
-        EC_WRITE_U32(domain1_pd + off_profile_velocity[i], tar.profile_velocity[i]);
-        //EC_WRITE_U16(domain1_pd + off_controlword[i], controlword);  //We are dealing with the control word before
-        EC_WRITE_U32(domain1_pd + off_profile_acceleration[i], tar.profile_acceleration[i]);    // 5000000
-        EC_WRITE_U32(domain1_pd + off_profile_deceleration[i], tar.profile_deceleration[i]);	//2000000 was smoothing out the jumpiness before
+        //only feeding the wheel drives target velocity
+        d->tar.profile_acceleration[i] = params->wheel_profile_acceleration;
+        d->tar.profile_deceleration[i] = params->wheel_profile_deceleration;
 
+        EC_WRITE_S32(d->pd + off_target_velocity[i], down ? 0 : d->tar.target_velocity[i]  );
+        EC_WRITE_U32(d->pd + off_profile_velocity[i], d->tar.profile_velocity[i]);
+        EC_WRITE_U32(d->pd + off_profile_acceleration[i], d->tar.profile_acceleration[i]);
+        EC_WRITE_U32(d->pd + off_profile_deceleration[i], d->tar.profile_deceleration[i]);	//2000000 was smoothing out the jumpiness before
 	}
 
-    //now for the torso:
-    const unsigned int TORSO_DRIVE_SEQ_=4;
-    tar.profile_velocity[TORSO_DRIVE_SEQ_] = 200000;
-    tar.profile_acceleration[TORSO_DRIVE_SEQ_] = 10000000;
-    tar.profile_deceleration[TORSO_DRIVE_SEQ_] = 10000000;
-
-    EC_WRITE_S32(domain1_pd + off_target_position[TORSO_DRIVE_SEQ_], tar.target_position[TORSO_DRIVE_SEQ_]);
-    EC_WRITE_U32(domain1_pd + off_profile_velocity[TORSO_DRIVE_SEQ_], tar.profile_velocity[TORSO_DRIVE_SEQ_]);
-    EC_WRITE_U32(domain1_pd + off_profile_acceleration[TORSO_DRIVE_SEQ_], tar.profile_acceleration[TORSO_DRIVE_SEQ_]);
-    EC_WRITE_U32(domain1_pd + off_profile_deceleration[TORSO_DRIVE_SEQ_], tar.profile_deceleration[TORSO_DRIVE_SEQ_]);
-
-
-    //only send 0x3f on the rising edge of send_new_torso_pos
-    if ( (tar.send_new_torso_pos == 1) && (old_send_new_torso_pos == 0 )) {
-        printf("Sending 0x3f\n");
-	printf("Moving to %d\n", tar.target_position[TORSO_DRIVE_SEQ_]);
-        EC_WRITE_U16(domain1_pd + off_controlword[TORSO_DRIVE_SEQ_], 0x3f);
-    } else {
-        EC_WRITE_U16(domain1_pd + off_controlword[TORSO_DRIVE_SEQ_], 0x0f);
-    }
-
-
-    old_send_new_torso_pos = tar.send_new_torso_pos;
+	/* the domain of the first wheel reports when a command reached the bus */
+	if (d->tar.trace_seq != d->traced_seq && layout.drives[0].domain == d->index) {
+		latency_mark(LATENCY_CMD_ON_BUS, d->tar.trace_seq);
+		d->traced_seq = d->tar.trace_seq;
+	}
 
 	/* Send process data. */
-	ecrt_domain_queue(domain1);
-	ecrt_master_send(master);
-
-	cur.pkg_count = counter;
+	pthread_mutex_lock(&d->m->lock);
+	ecrt_domain_queue(d->domain);
+	d->send_ns = realtime_ns();
+	if (d->use_dc) {
+		ecrt_master_application_time(d->m->master, d->send_ns - DC_EPOCH_NS);
+		ecrt_master_sync_slave_clocks(d->m->master);
+	}
+	ecrt_master_send(d->m->master);
+	pthread_mutex_unlock(&d->m->lock);
 
+	d->cold.domain[d->index].cycles++;
 }
 
 
 /*****************************************************************************/
 
 
-static void enforce_max_velocities(omniwrite_t *t)
+static void enforce_max_velocities(omniwrite_t *t, int max_v)
 {
 	int i;
 
@@ -538,21 +752,125 @@ static void enforce_max_velocities(omniwrite_t *t)
 
 /*****************************************************************************/
 
-static void stop_motors(void)
+static void stop_motors(omni_domain_t *d)
 {
-	int i;
+	int j;
 
-    for (i = 0; i < NUM_DRIVES; i++)
-        EC_WRITE_S32(domain1_pd + off_target_velocity[i], 0);
+    for (j = 0; j < d->num_drives; j++) {
+        EC_WRITE_S32(d->pd + off_target_velocity[d->drives[j]], 0);
+    }
 
 	/* Send process data. */
-	ecrt_domain_queue(domain1);
-	ecrt_master_send(master);
+	pthread_mutex_lock(&d->m->lock);
+	ecrt_domain_queue(d->domain);
+	ecrt_master_send(d->m->master);
+	pthread_mutex_unlock(&d->m->lock);
 
 	//usleep(1000);
 }
 
 
+/*****************************************************************************/
+
+/* Combine the per-domain entries of cold_buffer. Called with mutex held. */
+static void aggregate_stats(omni_cold_t *r)
+{
+	int i, wc_state = EC_WC_COMPLETE;
+
+	r->working_counter = 0;
+	r->misses = 0;
+	for (i = 0; i < num_domains; i++) {
+		r->working_counter += r->domain[i].working_counter;
+		r->misses += r->domain[i].misses;
+		if (r->domain[i].working_counter_state < wc_state)
+			wc_state = r->domain[i].working_counter_state;
+	}
+	r->working_counter_state = wc_state;
+
+	r->master_link = 1;
+	r->master_al_states = 0;
+	r->master_slaves_responding = 0;
+	for (i = 0; i < num_masters; i++) {
+		r->master_link = r->master_link && reported_master_state[i].link_up;
+		r->master_al_states |= reported_master_state[i].al_states;
+		r->master_slaves_responding += reported_master_state[i].slaves_responding;
+	}
+
+	r->recoveries = 0;
+	for (i = 0; i < NUM_DRIVES; i++)
+		r->recoveries += hot_buffer.recovery_count[i];
+}
+
+
+/* Copy what this domain owns into the shared sections. Called with mutex
+ * held. The hot section goes out every cycle, the cold one only when it
+ * changed. */
+static void publish_domain(omni_domain_t *d)
+{
+	int i, j;
+	uint32_t cycles = d->cold.domain[d->index].cycles;
+
+	seqlock_write_begin(&hot_lock);
+	for (j = 0; j < d->num_drives; j++) {
+		i = d->drives[j];
+		hot_buffer.position[i] = d->hot.position[i];
+		hot_buffer.digital_inputs[i] = d->hot.digital_inputs[i];
+		hot_buffer.actual_velocity[i] = d->hot.actual_velocity[i];
+		hot_buffer.status[i] = d->hot.status[i];
+		hot_buffer.mode_of_operation_display[i] = d->hot.mode_of_operation_display[i];
+		hot_buffer.actual_torque[i] = d->hot.actual_torque[i];
+		hot_buffer.stamp_ns[i] = d->hot.stamp_ns[i];
+		hot_buffer.recovery_count[i] = d->hot.recovery_count[i];
+		hot_buffer.drive_recovering[i] = d->hot.drive_recovering[i];
+
+		if (i == TORSO_DRIVE)
+			hot_buffer.torso = d->hot.torso;
+	}
+	hot_buffer.pkg_count += cycles - d->cycles_published;
+	d->cycles_published = cycles;
+	seqlock_write_end(&hot_lock);
+
+	if (d->stats_counter) {
+		d->stats_counter--;
+	} else {
+		d->stats_counter = d->frequency / OMNI_STATS_FREQUENCY;
+		d->cold_dirty = 1;
+
+		seqlock_write_begin(&stats_lock);
+		for (j = 0; j < d->num_drives; j++) {
+			i = d->drives[j];
+			stats_buffer[i] = d->stats[i];
+		}
+		seqlock_write_end(&stats_lock);
+	}
+
+	if (!d->cold_dirty)
+		return;
+
+	seqlock_write_begin(&cold_lock);
+	for (j = 0; j < d->num_drives; j++) {
+		i = d->drives[j];
+		cold_buffer.slave_state[i] = d->cold.slave_state[i];
+		cold_buffer.slave_online[i] = d->cold.slave_online[i];
+		cold_buffer.slave_operational[i] = d->cold.slave_operational[i];
+	}
+
+	if (d->cold.recoveries != d->recoveries_published) {
+		cold_buffer.last_recovery_time = d->cold.last_recovery_time;
+		d->recoveries_published = d->cold.recoveries;
+	}
+
+	if (d->owns_master)
+		reported_master_state[d->m - masters] = d->master_state;
+
+	cold_buffer.domain[d->index] = d->cold.domain[d->index];
+	aggregate_stats(&cold_buffer);
+	seqlock_write_end(&cold_lock);
+
+	d->cold_dirty = 0;
+}
+
+
 static void timespecInc(struct timespec *tick, int nsec)
 {
   tick->tv_nsec += nsec;
@@ -564,91 +882,304 @@ static void timespecInc(struct timespec *tick, int nsec)
 }
 
 
+static int64_t timespecDiff(const struct timespec *a, const struct timespec *b)
+{
+  return (a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+
+/* Called with mutex held. The wheels stop when nobody has written targets
+ * for a watchdog period, e.g. because the control loop hangs or died; the
+ * last velocity would otherwise be driven for ever. */
+static void take_targets(omni_domain_t *d, const struct timespec *now)
+{
+  int i, moving = 0;
+  int stale = timespecDiff(now, &tar_stamp) > d->params.watchdog_period * 1e9;
+
+  d->tar = tar_buffer;
+  enforce_max_velocities(&d->tar, d->params.max_tick_speed);
+  if (!stale) {
+    if (d->stale)
+      printf("Domain%d: wheel targets are written again.\n", d->index);
+    d->stale = 0;
+    return;
+  }
+
+  for (i = 0; i < NUM_DRIVES; i++)
+    if (i != TORSO_DRIVE) {
+      moving |= d->tar.target_velocity[i] != 0;
+      d->tar.target_velocity[i] = 0;
+    }
+
+  if (moving && !d->stale) {
+    printf("Domain%d: no wheel targets for %.0f ms, stopping the wheels.\n",
+           d->index, timespecDiff(now, &tar_stamp) / 1e6);
+    d->stale = 1;
+  }
+}
+
+
 void* realtimeMain(void* udata)
 {
-  struct timespec tick;
-  int period = 1e+6; // 1 ms in nanoseconds
-  //int period = 5e+5; // 0.5 ms in nanoseconds
+  omni_domain_t *d = (omni_domain_t *) udata;
+  omni_domain_stats_t *stats = &d->cold.domain[d->index];
+  struct timespec tick, now;
 
-  // Initialize the tick struct.
-  // TODO: Would it be better to do the following instead?
-  //       clock_gettime(CLOCK_REALTIME, &before);
-  tick.tv_sec = 0;
-  tick.tv_nsec = 0;
+  clock_gettime(CLOCK_MONOTONIC, &tick);
 
   while(!exiting)
   {
-    cyclic_task();
+    // Wake-up latency of this cycle
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    stats->jitter_ns = timespecDiff(&now, &tick);
+    if (stats->jitter_ns > stats->max_jitter_ns)
+      stats->max_jitter_ns = stats->jitter_ns;
+
+    omni_params_read(&d->params);  // keeps the last copy if an update races it
+    cyclic_task(d);
 
     if(pthread_mutex_trylock(&mutex) == 0)
     {
-      tar = tar_buffer;
-      cur_buffer = cur;
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      take_targets(d, &now);
+      d->power_target = power_request;
+      if (torso_cmd_fresh && layout.drives[TORSO_DRIVE].domain == d->index) {
+        torso_cmd = torso_cmd_buffer;
+        torso_cmd_fresh = 0;
+      }
+      publish_domain(d);
       pthread_mutex_unlock(&mutex);
     }
 
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    stats->exec_ns = timespecDiff(&now, &tick) - stats->jitter_ns;
+    if (stats->exec_ns > stats->max_exec_ns)
+      stats->max_exec_ns = stats->exec_ns;
+
     // Compute end of next period
-    timespecInc(&tick, period);
+    timespecInc(&tick, d->period_ns);
 
-    struct timespec before;
-    clock_gettime(CLOCK_REALTIME, &before);
-    if ((before.tv_sec + before.tv_nsec/1e9) > (tick.tv_sec + tick.tv_nsec/1e9))
+    if (timespecDiff(&now, &tick) > 0)
     {
       // We overran, snap to next "period"
-      tick.tv_sec = before.tv_sec;
-      tick.tv_nsec = (before.tv_nsec / period) * period;
-      timespecInc(&tick, period);
+      tick = now;
+      timespecInc(&tick, d->period_ns);
 
-      misses++;
+      stats->misses++;
     }
     // Sleep until end of period
-    clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &tick, NULL);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &tick, NULL);
 
   }
 
-  stop_motors();
-
-  
-  printf("Releasing master...\n");
-  ecrt_release_master(master);
+  stop_motors(d);
 
   return 0;
 }
 
 
+/*****************************************************************************/
+
+/* Drive settings which do not survive a reset of the drive. These mirror
+ * omnidrive_speedcontrol() and configure_torso_drive() in omnilib.c. */
+static int configure_startup_sdos(int i)
+{
+	int ret = 0;
+
+	if (i != TORSO_DRIVE) {
+		ret |= ecrt_slave_config_sdo8(sc[i], 0x6060, 0, 3);         //velocity profile mode
+	} else {
+		ret |= ecrt_slave_config_sdo32(sc[i], 0x6085, 0, 10000000); //quick stop deceleration
+		ret |= ecrt_slave_config_sdo16(sc[i], 0x6086, 0, 0);        //motion profile type = 0
+		ret |= ecrt_slave_config_sdo8(sc[i], 0x6060, 0, 1);         //profile position mode
+		/* homing is started through the process data by torso_update() */
+		ret |= ecrt_slave_config_sdo32(sc[i], 0x6099, 1, 200000);   //home search speed
+		ret |= ecrt_slave_config_sdo32(sc[i], 0x6099, 2, 20000);    //home search slow speed
+		ret |= ecrt_slave_config_sdo32(sc[i], 0x609A, 0, 10000000); //homing acceleration
+		ret |= ecrt_slave_config_sdo8(sc[i], 0x6098, 0, 2);         //homing method
+		ret |= ecrt_slave_config_sdo32(sc[i], 0x607C, 0, 0);        //home offset to zero
+	}
+
+	return ret;
+}
+
+
+static int register_drive_pdos(int i, ec_domain_t *domain)
+{
+	const drive_pdo_reg_t *r;
+
+	for (r = drive_regs; r->offset; r++) {
+		int off = ecrt_slave_config_reg_pdo_entry(sc[i], r->index, r->subindex, domain, NULL);
+		if (off < 0)
+			return -1;
+		r->offset[i] = off;
+	}
+
+	return 0;
+}
+
+
+static omni_master_t *find_master(unsigned int index)
+{
+	int i;
+
+	for (i = 0; i < num_masters; i++)
+		if (masters[i].index == index)
+			return &masters[i];
+
+	return NULL;
+}
+
+
+static int check_layout(const omni_layout_t *l)
+{
+	int i;
+
+	if (l->num_domains < 1 || l->num_domains > OMNI_MAX_DOMAINS) {
+		printf("Invalid number of domains: %d\n", l->num_domains);
+		return -1;
+	}
+
+	for (i = 0; i < l->num_domains; i++) {
+		if (l->domains[i].frequency < 1 || l->domains[i].frequency > 10000) {
+			printf("Domain%d: invalid frequency %u Hz\n", i, l->domains[i].frequency);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < NUM_DRIVES; i++) {
+		if (l->drives[i].domain < 0 || l->drives[i].domain >= l->num_domains) {
+			printf("m%d: invalid domain %d\n", i, l->drives[i].domain);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
 /*****************************************************************************/
 
 /* Interface functions */
 
-int start_omni_realtime(int max_vel)
+void omni_default_layout(omni_layout_t *l)
 {
 	int i;
 
-	max_v = max_vel;
+	memset(l, 0, sizeof(*l));
+	l->num_domains = 1;
+	l->domains[0].master = 0;
+	l->domains[0].frequency = FREQUENCY;
+
+	for (i = 0; i < NUM_DRIVES; i++) {
+		l->drives[i].alias = 0;
+		l->drives[i].position = i;
+		l->drives[i].vendor_id = ELMO_VENDOR_ID;
+		l->drives[i].product_code = ELMO_GOLD_PRODUCT;
+		l->drives[i].domain = 0;
+	}
+}
+
+
+static void release_masters(void)
+{
+	int i;
+
+	for (i = 0; i < num_masters; i++) {
+		printf( "Releasing master %u...\n", masters[i].index);
+		ecrt_release_master(masters[i].master);
+		pthread_mutex_destroy(&masters[i].lock);
+	}
+	num_masters = 0;
+}
+
+
+int start_omni_realtime(const omni_layout_t *l)
+{
+	int i, j;
 
 	printf("Init omni...\n");
 
+	if (l)
+		layout = *l;
+	else
+		omni_default_layout(&layout);
+
+	if (check_layout(&layout))
+		goto out_return;
+
 	/* Zero out the target/current data structs, just in case. */
-	memset(&tar, 0, sizeof(tar));
-	memset(&cur, 0, sizeof(cur));
-	cur.magic_version = OMNICOM_MAGIC_VERSION;
+	memset(&tar_buffer, 0, sizeof(tar_buffer));
+	memset(&hot_buffer, 0, sizeof(hot_buffer));
+	memset(&cold_buffer, 0, sizeof(cold_buffer));
+	memset(stats_buffer, 0, sizeof(stats_buffer));
+	memset(domains, 0, sizeof(domains));
+	memset(reported_master_state, 0, sizeof(reported_master_state));
+	cold_buffer.magic_version = OMNICOM_MAGIC_VERSION;
+	cold_buffer.num_domains = num_domains = layout.num_domains;
+	power_request = OMNI_POWER_OFF;
+	memset(&torso_cmd, 0, sizeof(torso_cmd));
+	torso_init(&torso_ctx);
+	exiting = 0;
 
 	printf("Starting omni....\n");
 
-	if (!(master = ecrt_request_master(0))) {
-		printf( "Requesting master 0 failed!\n");
-		goto out_return;
+	num_masters = 0;
+	for (i = 0; i < num_domains; i++) {
+		omni_domain_t *d = &domains[i];
+		unsigned int index = layout.domains[i].master;
+
+		d->m = find_master(index);
+		if (!d->m) {
+			d->m = &masters[num_masters];
+			d->owns_master = 1;
+			d->m->index = index;
+			if (!(d->m->master = ecrt_request_master(index))) {
+				printf( "Requesting master %u failed!\n", index);
+				goto out_release_master;
+			}
+			pthread_mutex_init(&d->m->lock, NULL);
+			num_masters++;
+		}
+
+		printf("Registering domain %d on master %u at %u Hz...\n", i, index,
+		       layout.domains[i].frequency);
+		if (!(d->domain = ecrt_master_create_domain(d->m->master))) {
+			printf( "Domain creation failed!\n");
+			goto out_release_master;
+		}
+
+		d->index = i;
+		d->frequency = layout.domains[i].frequency;
+		d->period_ns = 1000000000 / d->frequency;
+		d->power_target = OMNI_POWER_OFF;
+		omni_params_get(&d->params);
+		d->cold.magic_version = OMNICOM_MAGIC_VERSION;
+		d->cold.domain[i].master = index;
+		d->cold.domain[i].frequency = d->frequency;
+		d->cold_dirty = 1;
+		cold_buffer.domain[i] = d->cold.domain[i];
 	}
 
-	printf("Registering domain...\n");
-	if (!(domain1 = ecrt_master_create_domain(master))) {
-		printf( "Domain creation failed!\n");
-		goto out_release_master;
+	if (layout.discover) {
+		ec_master_t *drive_master[NUM_DRIVES];
+
+		for (i = 0; i < NUM_DRIVES; i++)
+			drive_master[i] = domains[layout.drives[i].domain].m->master;
+
+		if (discover_drives(&layout, drive_master)) {
+			printf( "Slave discovery failed!\n");
+			goto out_release_master;
+		}
 	}
 
     for (i = 0; i < NUM_DRIVES; i++) {
+        omni_domain_t *d = &domains[layout.drives[i].domain];
+        const omni_drive_layout_t *dl = &layout.drives[i];
+
         /* master, (slave alias, slave position), (VID, PID) */
-		if (!(sc[i] = ecrt_master_slave_config(master, 0, i /* M?SlavePos */, ELMOG))) {
+		if (!(sc[i] = ecrt_master_slave_config(d->m->master, dl->alias, dl->position,
+		                                       dl->vendor_id, dl->product_code))) {
 			printf(
 			       "Failed to get slave configuration for motor %d.\n", i);
 			goto out_release_master;
@@ -659,45 +1190,92 @@ int start_omni_realtime(int max_vel)
             printf( "Failed to configure PDOs for motor %d.\n", i);
             goto out_release_master;
         }
+
+        /* The master sends these again whenever it reconfigures the slave,
+         * e.g. after a power cycle or link loss of the drive. */
+        if (configure_startup_sdos(i)) {
+            printf( "Failed to configure startup SDOs for motor %d.\n", i);
+            goto out_release_master;
+        }
+
+        printf("Registering PDO entries of motor %d in domain %d...\n", i, d->index);
+        if (register_drive_pdos(i, d->domain)) {
+            printf( "PDO entry registration failed!\n");
+            goto out_release_master;
+        }
+
+        d->drives[d->num_drives++] = i;
+        drive_link_state[i] = DRIVE_STARTUP;
+        drive_down[i] = 0;
 	}
 
-	printf("Registering PDO entries...\n");
-	if (ecrt_domain_reg_pdo_entry_list(domain1, domain1_regs)) {
-		printf( "PDO entry registration failed!\n");
-		goto out_release_master;
+	/* Only the first domain of a master queues the clock datagrams, the
+	 * inputs of the others are stamped with the host send time. */
+	for (i = 0; i < num_domains; i++) {
+		omni_domain_t *d = &domains[i];
+
+		d->use_dc = layout.distributed_clocks && d->owns_master;
+		d->cold.domain[i].dc = d->use_dc;
+		cold_buffer.domain[i].dc = d->use_dc;
+		dc_clock_init(&d->dc);
+		if (d->use_dc)
+			ecrt_master_application_time(d->m->master, realtime_ns() - DC_EPOCH_NS);
 	}
 
-	printf("Activating master...\n");
-	if (ecrt_master_activate(master)) {
-		printf( "Failed to activate master!\n");
-		goto out_release_master;
+	for (i = 0; i < num_masters; i++) {
+		printf("Activating master %u...\n", masters[i].index);
+		if (ecrt_master_activate(masters[i].master)) {
+			printf( "Failed to activate master!\n");
+			goto out_release_master;
+		}
 	}
+
 	/* Get internal process data for domain. */
-	domain1_pd = ecrt_domain_data(domain1);
-
-	printf("Starting cyclic thread.\n");
-
-    pthread_attr_t tattr;
-    struct sched_param sparam;
-    sparam.sched_priority = sched_get_priority_max(SCHED_FIFO);
-    pthread_attr_init(&tattr);
-    pthread_attr_setschedpolicy(&tattr, SCHED_FIFO);
-    pthread_attr_setschedparam(&tattr, &sparam);
-    pthread_attr_setinheritsched (&tattr, PTHREAD_EXPLICIT_SCHED);
-    
-    if(pthread_create(&thread, &tattr, &realtimeMain, 0) != 0) {
-      printf("# ERROR: could not create realtime thread\n");
-      goto out_release_master;
-    }
+	for (i = 0; i < num_domains; i++)
+		domains[i].pd = ecrt_domain_data(domains[i].domain);
+
+	printf("Starting cyclic threads.\n");
+
+	for (i = 0; i < num_domains; i++) {
+		omni_domain_t *d = &domains[i];
+		pthread_attr_t tattr;
+		struct sched_param sparam;
+		int slower = 0;
+
+		/* faster domains get the higher priority */
+		for (j = 0; j < num_domains; j++)
+			if (domains[j].frequency > d->frequency)
+				slower++;
+
+		sparam.sched_priority = sched_get_priority_max(SCHED_FIFO) - slower;
+		pthread_attr_init(&tattr);
+		pthread_attr_setschedpolicy(&tattr, SCHED_FIFO);
+		pthread_attr_setschedparam(&tattr, &sparam);
+		pthread_attr_setinheritsched (&tattr, PTHREAD_EXPLICIT_SCHED);
+
+		if(pthread_create(&d->thread, &tattr, &realtimeMain, d) != 0) {
+			printf("# ERROR: could not create realtime thread for domain %d\n", i);
+			pthread_attr_destroy(&tattr);
+			goto out_stop_threads;
+		}
+		pthread_attr_destroy(&tattr);
+		d->running = 1;
+	}
 
 
 	printf("Started.\n");
 
 	return 1;
 
+out_stop_threads:
+	exiting = 1;
+	for (i = 0; i < num_domains; i++) {
+		if (domains[i].running)
+			pthread_join(domains[i].thread, 0);
+		domains[i].running = 0;
+	}
 out_release_master:
-	printf( "Releasing master...\n");
-	ecrt_release_master(master);
+	release_masters();
 out_return:
 	printf( "Failed to load. Aborting.\n");
 	return 0;
@@ -707,17 +1285,20 @@ out_return:
 
 void stop_omni_realtime(void)
 {
+	int i;
+
 	printf("Stopping...\n");
 
 
-	/* Signal a stop the realtime thread */
+	/* Signal a stop the realtime threads, each stops its motors */
     exiting = 1;
-    pthread_join(thread, 0);
-
-	/* Now stop all motors. */
-	//stop_motors();
-	//usleep(100);
+	for (i = 0; i < num_domains; i++) {
+		if (domains[i].running)
+			pthread_join(domains[i].thread, 0);
+		domains[i].running = 0;
+	}
 
+	release_masters();
 
 	printf("Unloading.\n");
 }
@@ -725,22 +1306,73 @@ void stop_omni_realtime(void)
 
 void omni_write_data(struct omniwrite data)
 {
+  static uint32_t traced_seq = 0;
+
+  if (data.trace_seq != traced_seq) {
+    latency_mark(LATENCY_CMD_WRITTEN, data.trace_seq);
+    traced_seq = data.trace_seq;
+  }
+
   pthread_mutex_lock(&mutex);
   tar_buffer = data;
-  enforce_max_velocities(&tar_buffer);
+  clock_gettime(CLOCK_MONOTONIC, &tar_stamp);
+  pthread_mutex_unlock(&mutex);
+}
+
+void omni_write_torso(const torsocmd_t *cmd)
+{
+  pthread_mutex_lock(&mutex);
+  torso_cmd_buffer = *cmd;
+  torso_cmd_fresh = 1;
   pthread_mutex_unlock(&mutex);
 }
 
-struct omniread omni_read_data()
+void omni_request_power(int power)
 {
-  struct omniread data;
   pthread_mutex_lock(&mutex);
-  data = cur_buffer;
+  power_request = power;
   pthread_mutex_unlock(&mutex);
-  return data;
+}
+
+/* The writers hold a section only for a short copy, retry until we get
+ * a consistent one. */
+void omni_read_hot(omni_hot_t *hot)
+{
+  seqlock_read(&hot_lock, hot, &hot_buffer, sizeof(*hot), 0);
+}
+
+uint32_t omni_read_cold(omni_cold_t *cold)
+{
+  uint32_t version;
+
+  do {
+    version = seqlock_read_begin(&cold_lock);
+    memcpy(cold, &cold_buffer, sizeof(*cold));
+  } while (!seqlock_read_valid(&cold_lock, version));
+
+  return version;
+}
+
+uint32_t omni_cold_version()
+{
+  return seqlock_read_begin(&cold_lock);
+}
+
+void omni_read_drive_stats(drive_stats_t *stats)
+{
+  seqlock_read(&stats_lock, stats, stats_buffer, sizeof(stats_buffer), 0);
 }
 
 ec_master_t* get_master()
 {
-    return(master);
+    return(num_masters > 0 ? masters[0].master : NULL);
+}
+
+ec_master_t* get_drive_master(int drive, uint16_t *position)
+{
+    if (drive < 0 || drive >= NUM_DRIVES || num_masters == 0)
+        return(NULL);
+
+    *position = layout.drives[drive].position;
+    return(domains[layout.drives[drive].domain].m->master);
 }
@@ -0,0 +1,342 @@
+/*
+ * This file is part of the libomnidrive project.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "torso.h"
+
+/* CiA-402 modes of operation */
+#define MODE_PROFILE_POSITION 1
+#define MODE_HOMING           6
+#define MODE_CSP              8
+
+/* Controlword bits on top of 0x0f (enable operation) */
+#define CONTROLWORD_NEW_SETPOINT   0x10  // also 'homing operation start'
+#define CONTROLWORD_CHANGE_AT_ONCE 0x20
+#define CONTROLWORD_HALT           0x100
+
+/* Statusword bits */
+#define STATUSWORD_TARGET_REACHED_BIT 10
+#define STATUSWORD_SETPOINT_ACK_BIT   12  // profile position mode
+#define STATUSWORD_HOMING_ATTAINED_BIT 12 // homing mode
+#define STATUSWORD_HOMING_ERROR_BIT   13
+
+/* The drive may still show the result of an earlier homing for a moment */
+#define HOMING_SETTLE_NS   10000000LL
+#define HOMING_TIMEOUT_NS  120000000000LL
+
+/* Profile position set-point handshake */
+#define SETPOINT_NONE      0
+#define SETPOINT_REQUESTED 1
+#define SETPOINT_ACKED     2
+
+
+static int32_t clamp_position(const torso_limits_t *l, int64_t p)
+{
+  if (l->min_position < l->max_position) {
+    if (p < l->min_position)
+      return l->min_position;
+    if (p > l->max_position)
+      return l->max_position;
+  }
+  return (int32_t) p;
+}
+
+static double limit(double x, double l)
+{
+  return (x > l) ? l : (x < -l) ? -l : x;
+}
+
+static int8_t drive_mode(int mode)
+{
+  return (mode == TORSO_MODE_CSP) ? MODE_CSP : MODE_PROFILE_POSITION;
+}
+
+/* Linear interpolation of the trajectory, starting from where we were */
+static int64_t trajectory_position(const torso_ctx_t *c, const torso_trajectory_t *t)
+{
+  int i;
+  int64_t t0 = 0, p0 = c->start_position;
+
+  for (i = 0; i < t->num_points; i++) {
+    if (c->time_ns < t->time_from_start[i]) {
+      int64_t dt = t->time_from_start[i] - t0;
+      if (dt <= 0)
+        return t->position[i];
+      return p0 + (t->position[i] - p0) * (c->time_ns - t0) / dt;
+    }
+    t0 = t->time_from_start[i];
+    p0 = t->position[i];
+  }
+
+  return p0;
+}
+
+static void start_homing(torso_ctx_t *c)
+{
+  c->state = TORSO_STATE_HOMING;
+  c->homed = 0;
+  c->time_ns = 0;
+}
+
+static void start_trajectory(torso_ctx_t *c, const torsocmd_t *cmd, int32_t position,
+                             int32_t velocity)
+{
+  const torso_trajectory_t *t = &cmd->trajectory;
+  int csp_moving = (c->state == TORSO_STATE_MOVING && c->mode == TORSO_MODE_CSP);
+
+  /* CSP continues from the set-point and its velocity if it is moving
+   * already, from where the drive is if it was moving on its own profile */
+  if (cmd->mode == TORSO_MODE_CSP && !csp_moving) {
+    if (c->state == TORSO_STATE_MOVING) {
+      c->setpoint = position;
+      c->csp_velocity = velocity;
+    } else {
+      c->csp_velocity = 0.0;
+    }
+    c->csp_position = c->setpoint;
+  }
+
+  c->mode = cmd->mode;
+  c->state = TORSO_STATE_MOVING;
+  c->halted = 0;
+  c->stopping = 0;
+  c->time_ns = 0;
+  c->point = 0;
+  c->start_position = (c->mode == TORSO_MODE_CSP) ? c->setpoint : position;
+  c->goal = clamp_position(&cmd->limits, t->position[t->num_points - 1]);
+}
+
+/* One cycle of the CSP set-point: it follows the interpolated trajectory
+ * with at most max_velocity, changes its velocity by at most acceleration
+ * and slows down in time to stop at the goal with deceleration. Returns
+ * non-zero when the motion is done. */
+static int csp_step(torso_ctx_t *c, const torso_limits_t *l, const torso_trajectory_t *t,
+                    int64_t dt_ns)
+{
+  double dt = dt_ns * 1e-9;
+  double v = 0.0, dv;
+  int done;
+
+  if (dt <= 0)
+    return 0;
+
+  if (!c->stopping) {
+    double to_goal = c->goal - c->csp_position;
+    double d = l->deceleration;
+
+    /* the velocity which reaches the interpolated position in this cycle,
+     * and at most the one which covers this cycle plus the braking
+     * distance: v*dt + v^2/(2*d) <= |to_goal| */
+    v = (clamp_position(l, trajectory_position(c, t)) - c->csp_position) / dt;
+    v = limit(v, l->max_velocity);
+    if (v * to_goal > 0)
+      v = limit(v, sqrt(d * d * dt * dt + 2.0 * d * fabs(to_goal)) - d * dt);
+  }
+
+  dv = (fabs(v) < fabs(c->csp_velocity) && v * c->csp_velocity >= 0) ?
+       l->deceleration * dt : l->acceleration * dt;
+  c->csp_velocity += limit(v - c->csp_velocity, dv);
+  c->csp_position += c->csp_velocity * dt;
+
+  c->setpoint = clamp_position(l, llround(c->csp_position));
+  if (c->setpoint != llround(c->csp_position)) {
+    /* at a position limit */
+    c->csp_position = c->setpoint;
+    c->csp_velocity = 0.0;
+  }
+
+  if (c->stopping)
+    done = (c->csp_velocity == 0.0);
+  else
+    done = (c->time_ns >= t->time_from_start[t->num_points - 1] &&
+            fabs(c->goal - c->csp_position) < 0.5 && fabs(c->csp_velocity) <= dv);
+
+  if (done) {
+    if (!c->stopping)
+      c->setpoint = c->goal;
+    c->csp_position = c->setpoint;
+    c->csp_velocity = 0.0;
+    c->goal = c->setpoint;
+  }
+
+  return done;
+}
+
+
+void torso_init(torso_ctx_t *c)
+{
+  memset(c, 0, sizeof(*c));
+  c->state = TORSO_STATE_DISABLED;
+}
+
+
+void torso_update(torso_ctx_t *c, const torsocmd_t *cmd, int enabled,
+                  uint16_t statusword, int8_t mode_display,
+                  int32_t position, int32_t velocity, int64_t dt_ns,
+                  torso_output_t *out, torsostatus_t *status)
+{
+  const torso_limits_t *l = &cmd->limits;
+  const torso_trajectory_t *t = &cmd->trajectory;
+
+  out->controlword_bits = 0;
+  out->profile_velocity = l->max_velocity;
+  out->profile_acceleration = l->acceleration;
+  out->profile_deceleration = l->deceleration;
+
+  if (!enabled) {
+    /* hold wherever the axis is, a homing in progress is lost */
+    if (c->state == TORSO_STATE_HOMING)
+      c->state = TORSO_STATE_HOMING_FAILED;
+    else if (c->state != TORSO_STATE_HOMING_FAILED)
+      c->state = TORSO_STATE_DISABLED;
+    c->setpoint = position;
+    c->setpoint_state = SETPOINT_NONE;
+    c->halted = 0;
+    c->stopping = 0;
+    c->csp_velocity = 0.0;
+  } else if (c->state == TORSO_STATE_DISABLED) {
+    c->state = TORSO_STATE_IDLE;
+    c->setpoint = position;
+  }
+
+  /* new requests */
+  if (cmd->home_seq != c->home_seq) {
+    c->home_seq = cmd->home_seq;
+    if (enabled)
+      start_homing(c);
+  }
+
+  if (t->seq != c->trajectory_seq) {
+    c->trajectory_seq = t->seq;
+    /* trajectories which arrive while homing are dropped */
+    if (enabled && c->state != TORSO_STATE_HOMING && t->num_points > 0)
+      start_trajectory(c, cmd, position, velocity);
+
+    /* an empty trajectory stops the axis, CSP brakes until it stands */
+    if (t->num_points == 0 && c->state == TORSO_STATE_MOVING) {
+      if (c->mode == TORSO_MODE_CSP) {
+        c->stopping = 1;
+      } else {
+        c->state = TORSO_STATE_IDLE;
+        c->halted = 1;
+        c->setpoint_state = SETPOINT_NONE;
+      }
+    }
+  }
+
+  if (c->state != TORSO_STATE_MOVING && c->state != TORSO_STATE_HOMING)
+    c->mode = cmd->mode;
+
+  out->mode_of_operation = drive_mode(c->mode);
+
+  switch (c->state) {
+  case TORSO_STATE_HOMING:
+    out->mode_of_operation = MODE_HOMING;
+
+    if (mode_display != MODE_HOMING)
+      break;   /* wait for the mode switch, bit 4 low */
+
+    c->time_ns += dt_ns;
+    if (c->time_ns > dt_ns)   /* rising edge of bit 4 one cycle after the mode switch */
+      out->controlword_bits = CONTROLWORD_NEW_SETPOINT;
+
+    if (c->time_ns < HOMING_SETTLE_NS)
+      break;
+
+    if (statusword & (1 << STATUSWORD_HOMING_ERROR_BIT) || c->time_ns > HOMING_TIMEOUT_NS) {
+      c->state = TORSO_STATE_HOMING_FAILED;
+      c->setpoint = position;
+    } else if ((statusword & (1 << STATUSWORD_HOMING_ATTAINED_BIT)) &&
+               (statusword & (1 << STATUSWORD_TARGET_REACHED_BIT))) {
+      c->state = TORSO_STATE_IDLE;
+      c->homed = 1;
+      c->setpoint = position;
+    }
+    break;
+
+  case TORSO_STATE_MOVING:
+    if (mode_display != out->mode_of_operation)
+      break;   /* wait for the mode switch before moving */
+
+    c->time_ns += dt_ns;
+
+    if (c->mode == TORSO_MODE_CSP) {
+      if (csp_step(c, l, t, dt_ns)) {
+        c->state = TORSO_STATE_IDLE;
+        c->stopping = 0;
+      }
+    } else {
+      /* hand over each point as a new set-point when it is due */
+      switch (c->setpoint_state) {
+      case SETPOINT_NONE:
+        if (c->point < t->num_points && c->time_ns >= t->time_from_start[c->point]) {
+          c->setpoint = clamp_position(l, t->position[c->point]);
+          c->point++;
+          c->setpoint_state = SETPOINT_REQUESTED;
+        } else if (c->point >= t->num_points &&
+                   (statusword & (1 << STATUSWORD_TARGET_REACHED_BIT))) {
+          c->state = TORSO_STATE_IDLE;
+        }
+        break;
+      case SETPOINT_REQUESTED:
+        if (statusword & (1 << STATUSWORD_SETPOINT_ACK_BIT))
+          c->setpoint_state = SETPOINT_ACKED;
+        break;
+      case SETPOINT_ACKED:
+        if (!(statusword & (1 << STATUSWORD_SETPOINT_ACK_BIT)))
+          c->setpoint_state = SETPOINT_NONE;
+        break;
+      }
+
+      out->controlword_bits = CONTROLWORD_CHANGE_AT_ONCE;
+      if (c->setpoint_state == SETPOINT_REQUESTED)
+        out->controlword_bits |= CONTROLWORD_NEW_SETPOINT;
+    }
+    break;
+
+  default:
+    if (c->halted)
+      out->controlword_bits = CONTROLWORD_HALT;
+    break;
+  }
+
+  out->target_position = c->setpoint;
+
+  status->state = c->state;
+  status->mode = c->mode;
+  status->homed = c->homed;
+  status->position = position;
+  status->velocity = velocity;
+  status->setpoint = c->setpoint;
+  status->goal = c->goal;
+  status->trajectory_seq = c->trajectory_seq;
+
+  if (c->state != TORSO_STATE_MOVING)
+    status->progress = 1.0;
+  else if (c->stopping)
+    status->progress = 0.99;
+  else if (c->mode == TORSO_MODE_CSP && t->time_from_start[t->num_points - 1] > 0)
+    status->progress = (double) c->time_ns / t->time_from_start[t->num_points - 1];
+  else
+    status->progress = (double) c->point / t->num_points;
+
+  if (status->progress > 1.0)
+    status->progress = (c->state == TORSO_STATE_MOVING) ? 0.99 : 1.0;
+}
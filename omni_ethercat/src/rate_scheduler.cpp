@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2009 by Ingo Kresse <kresse@in.tum.de>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <algorithm>
+
+#include "rate_scheduler.h"
+
+// achieved rates are measured over this many seconds
+const double rate_window = 1.0;
+
+
+RateScheduler::RateScheduler(double loop_frequency) :
+  loop_frequency_(loop_frequency), max_per_cycle_(1), window_start_(-1.0)
+{
+}
+
+int RateScheduler::add(const std::string& name, double frequency, double phase)
+{
+  Output o;
+  o.name = name;
+  o.frequency = frequency;
+  o.step = (frequency > 0) ? frequency / loop_frequency_ : 0.0;
+  o.due = false;
+  o.count = 0;
+  o.deferred = 0;
+  o.achieved = 0.0;
+
+  double step = std::min(o.step, 1.0);
+  if(phase < 0) {
+    // first fire one cycle after the previous output
+    double cycles = outputs_.size();
+    if(step > 0)
+      cycles = fmod(cycles, 1.0 / step);
+    o.accumulator = 1.0 - (cycles + 1) * step;
+  } else {
+    o.accumulator = 1.0 - (phase - floor(phase)) - step;
+  }
+
+  outputs_.push_back(o);
+
+  // enough slots per cycle for the sum of all rates
+  double total = 0.0;
+  for(size_t i=0; i < outputs_.size(); i++)
+    total += std::min(outputs_[i].step, 1.0);
+  max_per_cycle_ = std::max(1.0, ceil(total));
+
+  return outputs_.size() - 1;
+}
+
+void RateScheduler::tick(double now)
+{
+  for(size_t i=0; i < outputs_.size(); i++) {
+    outputs_[i].accumulator += std::min(outputs_[i].step, 1.0);
+    outputs_[i].due = false;
+  }
+
+  // the most overdue outputs go first, the others wait for the next cycle
+  for(unsigned int slot=0; slot < max_per_cycle_; slot++) {
+    int next = -1;
+    for(size_t i=0; i < outputs_.size(); i++)
+      if(!outputs_[i].due && outputs_[i].accumulator >= 1.0 &&
+         (next < 0 || outputs_[i].accumulator > outputs_[next].accumulator))
+        next = i;
+    if(next < 0)
+      break;
+
+    outputs_[next].due = true;
+    outputs_[next].accumulator -= 1.0;
+    outputs_[next].count++;
+  }
+
+  for(size_t i=0; i < outputs_.size(); i++)
+    if(!outputs_[i].due && outputs_[i].accumulator >= 1.0)
+      outputs_[i].deferred++;
+
+  if(window_start_ < 0)
+    window_start_ = now;
+  if(now - window_start_ >= rate_window) {
+    for(size_t i=0; i < outputs_.size(); i++) {
+      outputs_[i].achieved = outputs_[i].count / (now - window_start_);
+      outputs_[i].count = 0;
+    }
+    window_start_ = now;
+  }
+}